@@ -0,0 +1,71 @@
+// Code generation time of a generated program with thousands of pali on 1
+// to 32 threads, checking that the assembly is the same on every count.
+// Usage: bin/bench/codegen [pali]
+#define LPC_LIBRARY
+#include "../main.c"
+#include <time.h>
+
+double now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+      out = stdout;
+      errors = stderr;
+      int count = argc > 1 ? atoi(argv[1]) : 4000;
+
+      // Every pali loops and branches and calls the one before it, which
+      // is too big to be inlined
+      size_t capacity = (size_t)count * 512 + 256;
+      char *text = malloc(capacity);
+      size_t length = 0;
+      length += snprintf(text + length, capacity - length,
+                         "pali f0 pi (x li nanpa) li pana nanpa la\n"
+                         "    otawa x;\n"
+                         "pini\n");
+      for (int i = 1; i < count; i++) {
+            length += snprintf(text + length, capacity - length,
+                               "pali f%d pi (x li nanpa) li pana nanpa la\n"
+                               "    o s li nanpa = 0;\n"
+                               "    o a li nanpa[16] = %d;\n"
+                               "    tenpo x > 0 la\n"
+                               "        x = x - 1;\n"
+                               "        x %% 3 == 0 la s = s + a[x %% 16]; ante s = s - x * %d; pini\n"
+                               "    pini\n"
+                               "    s > 1000 la otokis(\"f%d %%n\\n\", s); pini\n"
+                               "    otawa s + f%d(x);\n"
+                               "pini\n", i, i, i, i, i ? i - 1 : 0);
+      }
+      length += snprintf(text + length, capacity - length, "otawa f%d(10);\n", count - 1);
+
+      Prog prog;
+      if (!parseSource(text, &prog)) return 1;
+      char *first = NULL;
+      size_t firstLength = 0;
+      double serial = 0;
+      for (size_t threads = 1; threads <= 32; threads *= 2) {
+            codegenThreads = threads;
+            char *assembly;
+            size_t assemblyLength;
+            out = open_memstream(&assembly, &assemblyLength);
+            double start = now();
+            bool ok = generateProgram(&prog);
+            double seconds = (now() - start) / 1e6;
+            fclose(out);
+            if (!ok) return 1;
+            if (threads == 1) serial = seconds;
+            printf("%2zu threads %7.1f ms, %4.2fx\n", threads, seconds * 1000, serial / seconds);
+            if (!first) {
+                  first = assembly;
+                  firstLength = assemblyLength;
+            } else if (assemblyLength != firstLength || memcmp(assembly, first, assemblyLength)) {
+                  fprintf(stderr, "assembly on %zu threads differs from one thread\n", threads);
+                  return 1;
+            } else {
+                  free(assembly);
+            }
+      }
+      return 0;
+}
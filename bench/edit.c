@@ -0,0 +1,112 @@
+// Latency of incremental edits on a generated 100000 line file, compared to
+// parsing the whole file again.
+// Usage: bin/bench/edit [edits]
+#define LPC_LIBRARY
+#include "../main.c"
+#include <time.h>
+
+#define BLOCKS 12500
+
+double now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int compareDoubles(const void *a, const void *b) {
+      double x = *(const double*)a, y = *(const double*)b;
+      return (x > y) - (x < y);
+}
+
+bool sameSpans(Nodes *a, Nodes *b) {
+      if (a->size != b->size) return false;
+      for (size_t i = 0; i < a->size; i++) {
+            Node x = a->nodes[i], y = b->nodes[i];
+            if (x.type != y.type || x.start != y.start || x.end != y.end || x.line != y.line) return false;
+            if (x.type == Tenpo && !sameSpans(&x.node.tenpo->nodes, &y.node.tenpo->nodes)) return false;
+            if (x.type == Pali && !sameSpans(&x.node.pali->nodes, &y.node.pali->nodes)) return false;
+      }
+      return true;
+}
+
+// Every block is 8 lines: a declaration, a kama, a tenpo and a pali
+char *kinds[] = {"top-level statement", "tenpo body", "new statement", "pali body"};
+int32_t blockEdit(char *text, int32_t block, int kind, char **inserted) {
+      switch (kind) {
+      case 0: *inserted = "7"; return strstr(text + block, ";") - text;
+      case 1: *inserted = "7"; return strstr(text + block, "+ 2;") - text + 3;
+      case 2: *inserted = "b = 1;\n"; return block;
+      default: *inserted = " * 1"; return strstr(text + block, "otawa x") - text + 7;
+      }
+}
+
+void report(char *name, double *samples, size_t count) {
+      qsort(samples, count, sizeof(double), compareDoubles);
+      double sum = 0;
+      for (size_t i = 0; i < count; i++) sum += samples[i];
+      printf("%-22s mean %8.1f us   p50 %8.1f us   p99 %8.1f us\n", name,
+             sum / count, samples[count / 2], samples[count * 99 / 100]);
+}
+
+int main(int argc, char **argv) {
+      out = stdout;
+      errors = stderr;
+      size_t edits = argc > 1 ? atol(argv[1]) : 4000;
+
+      size_t capacity = BLOCKS * 256;
+      char *text = malloc(capacity);
+      int32_t *blocks = malloc(sizeof(int32_t)*BLOCKS);
+      size_t length = 0;
+      for (int i = 0; i < BLOCKS; i++) {
+            blocks[i] = length;
+            length += snprintf(text + length, capacity - length,
+                               "o a%d li nanpa = %d;\n"
+                               "a%d = a%d + 1;\n"
+                               "tenpo a%d < 10 la\n"
+                               "    a%d = a%d + 2;\n"
+                               "pini\n"
+                               "pali f%d pi (x li nanpa) li pana nanpa la\n"
+                               "    otawa x;\n"
+                               "pini\n", i, i, i, i, i, i, i, i);
+      }
+
+      Document doc = {};
+      documentSet(&doc, text, length);
+      double start = now();
+      if (!documentParse(&doc)) return 1;
+      printf("full parse of %d lines: %.1f ms\n", BLOCKS * 8, (now() - start) / 1000);
+
+      double *samples[4];
+      size_t counts[4] = {};
+      srand(1);
+      for (int kind = 0; kind < 4; kind++) samples[kind] = malloc(sizeof(double)*edits*2);
+      for (size_t i = 0; i < edits; i++) {
+            int kind = i % 4;
+            char *inserted;
+            int32_t offset = blockEdit(doc.text, blocks[rand() % BLOCKS], kind, &inserted);
+            int32_t size = strlen(inserted);
+
+            // Every edit is undone right after, so the blocks stay where they are
+            start = now();
+            bool ok = documentEdit(&doc, offset, 0, inserted, size);
+            samples[kind][counts[kind]++] = now() - start;
+            start = now();
+            ok = documentEdit(&doc, offset, size, "", 0) && ok;
+            samples[kind][counts[kind]++] = now() - start;
+            if (!ok) {
+                  fprintf(stderr, "edit %zu (%s) didn't parse\n", i, kinds[kind]);
+                  return 1;
+            }
+      }
+      for (int kind = 0; kind < 4; kind++) report(kinds[kind], samples[kind], counts[kind]);
+
+      // The edited parse has to match parsing the result from scratch
+      Document fresh = {};
+      documentSet(&fresh, doc.text, doc.length);
+      documentParse(&fresh);
+      if (strcmp(doc.text, text) || !sameSpans(&doc.prog.nodes, &fresh.prog.nodes)) {
+            fprintf(stderr, "incremental parse differs from a full parse\n");
+            return 1;
+      }
+      return 0;
+}
@@ -0,0 +1,665 @@
+// Differential fuzzing across optimization levels: generates random
+// programs from the grammar, compiles each at every configuration below,
+// runs them and compares the exit codes and output against -O0. Failing
+// programs are minimized and kept in bin/fuzz.
+// Usage: bin/bench/fuzz [--seed n] [--count n] [--seconds n]
+#define LPC_LIBRARY
+#include "../main.c"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define OUTPUT_MAX (1 << 16)
+
+typedef struct {
+      char *name;
+      int optLevel;
+      size_t unrollFactor;
+      bool profileUse;
+      int march;
+} Config;
+
+// The first one is the reference the others are compared to. Profiled
+// configs compile the program with --profile-use on a profile from a run
+// of its instrumented build.
+Config configs[] = {
+      {"O0", 0, 0, false, MarchSse2},
+      {"O1", 1, 0, false, MarchSse2},
+      {"O2", 2, 0, false, MarchSse2},
+      {"O2-unroll3", 2, 3, false, MarchSse2},
+      {"O2-unroll3-profile", 2, 3, true, MarchSse2},
+      {"O2-avx2", 2, 0, false, MarchAvx2},
+};
+#define CONFIGS (sizeof(configs) / sizeof(*configs))
+
+// An exit code, or one of these
+enum {CompileFailed = 1000, Crashed, TimedOut};
+
+typedef struct {
+      int status;
+      size_t outputLength;
+      char output[OUTPUT_MAX];
+} Outcome;
+
+typedef struct {
+      char *data;
+      size_t length;
+      size_t capacity;
+} Text;
+
+void emit(Text *text, const char *format, ...) {
+      va_list args;
+      va_start(args, format);
+      size_t needed = vsnprintf(NULL, 0, format, args) + 1;
+      va_end(args);
+      if (text->length + needed > text->capacity) {
+            text->capacity = (text->length + needed) * 2;
+            text->data = realloc(text->data, text->capacity);
+      }
+      va_start(args, format);
+      text->length += vsnprintf(text->data + text->length, needed, format, args);
+      va_end(args);
+}
+
+double now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Program generation. Every tenpo counts down its own counter from at most
+// 6, so the nesting depth bounds the run time, and / and % only ever take a
+// literal from 1 to 9 on the right. The top scope also has telo, linja and
+// arrays of a few element types, with loops over the arrays in the shape
+// -O2 vectorizes. Their counters start at the length of an array or at a
+// number that can be past it, so the bounds checks get exercised too.
+
+uint64_t rng;
+
+uint64_t next() {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      return rng;
+}
+
+size_t pick(size_t n) {
+      return next() % n;
+}
+
+typedef struct {
+      char name[8];
+      char *element;
+      // 0 for arrays on the heap, which have at least 3 elements
+      size_t count;
+} Array;
+
+typedef struct {
+      char names[16][8];
+      size_t count;
+      size_t counters;
+      size_t pali;
+      int depth;
+      char telos[4][24];
+      size_t teloCount;
+      char linjas[4][24];
+      size_t linjaCount;
+      Array arrays[4];
+      size_t arrayCount;
+} Scope;
+
+char *binary[] = {"+", "-", "*", "/", "%"};
+char *comparing[] = {"<", ">", "=="};
+char *nanpaTypes[] = {"nanpa", "nanpa", "nanpa lili", "nanpa lili lili", "sitelen", "unsigned nanpa lili", "nanpa suli"};
+char *teloTypes[] = {"telo", "telo lili"};
+char *elementTypes[] = {"nanpa", "nanpa lili", "nanpa lili lili", "sitelen", "telo", "telo lili"};
+char *linjaLiterals[] = {"\"a\"", "\"jan\"", "\"toki pona\"", "\"ilo\""};
+
+bool teloArray(Array *array) {
+      return !strncmp(array->element, "telo", 4);
+}
+
+// An index that is in range, or rarely one that can be past the end
+void randomIndex(Text *text, Scope *scope, Array *array) {
+      if (!pick(40) && scope->count) emit(text, "%s %% 8", scope->names[pick(scope->count)]);
+      else emit(text, "%zu", pick(array->count ? array->count : 3));
+}
+
+// A random array whose elements are telo when telo is set, NULL if there
+// is none
+Array *randomArray(Scope *scope, bool telo) {
+      Array *found[4];
+      size_t count = 0;
+      for (size_t i = 0; i < scope->arrayCount; i++) {
+            if (teloArray(&scope->arrays[i]) == telo) found[count++] = &scope->arrays[i];
+      }
+      return count ? found[pick(count)] : NULL;
+}
+
+void randomTerm(Text *text, Scope *scope, int depth) {
+      size_t kind = pick(10);
+      Array *array = kind == 8 ? randomArray(scope, false) : NULL;
+      if (kind == 7 && scope->linjaCount) {
+            emit(text, "%s.suli()", scope->linjas[pick(scope->linjaCount)]);
+      } else if (array) {
+            emit(text, "%s[", array->name);
+            randomIndex(text, scope, array);
+            emit(text, "]");
+      } else if (kind < 4 || !scope->count) {
+            if (!pick(12)) emit(text, "%llu", (unsigned long long)(next() >> 2));
+            else emit(text, "%zu", pick(100));
+      } else if (kind == 9 && scope->pali && depth < 2) {
+            emit(text, "p%zu(", pick(scope->pali));
+            randomTerm(text, scope, depth + 1);
+            emit(text, ", ");
+            randomTerm(text, scope, depth + 1);
+            emit(text, ")");
+      } else {
+            emit(text, "%s", scope->names[pick(scope->count)]);
+      }
+}
+
+void randomArithmetic(Text *text, Scope *scope) {
+      randomTerm(text, scope, 0);
+      for (size_t i = pick(4); i > 0; i--) {
+            char *op = binary[pick(5)];
+            emit(text, " %s ", op);
+            if (op[0] == '/' || op[0] == '%') emit(text, "%zu", pick(9) + 1);
+            else randomTerm(text, scope, 0);
+      }
+}
+
+void randomCondition(Text *text, Scope *scope) {
+      randomArithmetic(text, scope);
+      emit(text, " %s ", comparing[pick(3)]);
+      randomArithmetic(text, scope);
+}
+
+void indent(Text *text, int depth) {
+      emit(text, "%*s", depth * 4, "");
+}
+
+void randomTeloTerm(Text *text, Scope *scope) {
+      size_t kind = pick(6);
+      Array *array = kind == 5 ? randomArray(scope, true) : NULL;
+      if (array) {
+            emit(text, "%s[", array->name);
+            randomIndex(text, scope, array);
+            emit(text, "]");
+      } else if (kind < 2 && scope->teloCount) {
+            emit(text, "%s", scope->telos[pick(scope->teloCount)]);
+      } else if (kind == 2 && scope->count) {
+            emit(text, "%s", scope->names[pick(scope->count)]);
+      } else {
+            emit(text, "%zu.%zu", pick(20), pick(100));
+      }
+}
+
+void randomTelo(Text *text, Scope *scope) {
+      randomTeloTerm(text, scope);
+      for (size_t i = pick(3); i > 0; i--) {
+            emit(text, " %s ", binary[pick(4)]);
+            randomTeloTerm(text, scope);
+      }
+}
+
+// Mostly array itself, which the counter is in range for, or another array
+// with the same element type that may be shorter
+Array *sameArray(Scope *scope, Array *array) {
+      Array *same = &scope->arrays[pick(scope->arrayCount)];
+      return !pick(4) && !strcmp(same->element, array->element) ? same : array;
+}
+
+// One side of a store in an array loop: elements of arrays with the same
+// element type at the counter, names and numbers
+void randomElementTerm(Text *text, Scope *scope, Array *array, char *counter) {
+      size_t kind = pick(6);
+      bool telo = teloArray(array);
+      if (kind < 3) {
+            emit(text, "%s[%s]", sameArray(scope, array)->name, counter);
+      } else if (kind == 3 && telo && scope->teloCount) {
+            emit(text, "%s", scope->telos[pick(scope->teloCount)]);
+      } else if (kind == 3 && scope->count) {
+            emit(text, "%s", scope->names[pick(scope->count)]);
+      } else if (telo) {
+            emit(text, "%zu.%zu", pick(20), pick(100));
+      } else {
+            emit(text, "%zu", pick(100));
+      }
+}
+
+void randomArrayLoop(Text *text, Text *decls, Scope *scope, int depth) {
+      Array *array = &scope->arrays[pick(scope->arrayCount)];
+      size_t counter = scope->counters++;
+      char name[16];
+      snprintf(name, sizeof(name), "c%zu", counter);
+      indent(decls, scope->depth);
+      emit(decls, "o %s li nanpa = 0;\n", name);
+      indent(text, depth);
+      if (pick(8)) emit(text, "%s = %s.suli();\n", name, array->name);
+      else emit(text, "%s = %zu;\n", name, pick(12));
+      indent(text, depth);
+      emit(text, pick(2) ? "tenpo %s > 0 la\n" : "tenpo %s la\n", name);
+      indent(text, depth + 1);
+      emit(text, "%s = %s - 1;\n", name, name);
+      for (size_t stores = pick(2) + 1; stores > 0; stores--) {
+            Array *target = sameArray(scope, array);
+            indent(text, depth + 1);
+            emit(text, "%s[%s] = ", target->name, name);
+            randomElementTerm(text, scope, array, name);
+            for (size_t i = pick(3); i > 0; i--) {
+                  emit(text, " %s ", binary[pick(teloArray(array) ? 4 : 3)]);
+                  randomElementTerm(text, scope, array, name);
+            }
+            emit(text, ";\n");
+      }
+      indent(text, depth);
+      emit(text, "pini\n");
+}
+
+void randomKama(Text *text, Scope *scope, int depth, bool comparison);
+
+// Statements on the telo, linja and arrays of the top scope
+void randomTypedStatement(Text *text, Text *decls, Scope *scope, int depth) {
+      size_t kind = pick(6);
+      if (kind < 2 && scope->arrayCount && depth <= 3) {
+            randomArrayLoop(text, decls, scope, depth);
+      } else if (kind == 2 && scope->arrayCount) {
+            Array *array = &scope->arrays[pick(scope->arrayCount)];
+            indent(text, depth);
+            emit(text, "%s[", array->name);
+            randomIndex(text, scope, array);
+            emit(text, "] = ");
+            if (teloArray(array)) randomTelo(text, scope);
+            else randomArithmetic(text, scope);
+            emit(text, ";\n");
+      } else if (kind == 3 && scope->linjaCount) {
+            indent(text, depth);
+            char *to = scope->linjas[pick(scope->linjaCount)];
+            if (pick(2)) emit(text, "%s = %s;\n", to, linjaLiterals[pick(4)]);
+            else emit(text, "%s = %s;\n", to, scope->linjas[pick(scope->linjaCount)]);
+      } else if (kind == 4 && scope->linjaCount) {
+            indent(text, depth);
+            emit(text, "otokis(\"%%l\\n\", %s);\n", scope->linjas[pick(scope->linjaCount)]);
+      } else if (scope->teloCount) {
+            indent(text, depth);
+            char *to = scope->telos[pick(scope->teloCount)];
+            if (kind == 5) {
+                  emit(text, "otokis(\"%%t\\n\", %s);\n", to);
+            } else {
+                  emit(text, "%s = ", to);
+                  randomTelo(text, scope);
+                  emit(text, ";\n");
+            }
+      } else {
+            randomKama(text, scope, depth, false);
+      }
+}
+
+void randomBlock(Text *text, Text *decls, Scope *scope, int depth, size_t statements);
+
+void randomKama(Text *text, Scope *scope, int depth, bool comparison) {
+      indent(text, depth);
+      emit(text, "%s = ", scope->names[pick(scope->count)]);
+      if (comparison) randomCondition(text, scope);
+      else randomArithmetic(text, scope);
+      emit(text, ";\n");
+}
+
+void randomStatement(Text *text, Text *decls, Scope *scope, int depth) {
+      if ((scope->teloCount || scope->linjaCount || scope->arrayCount) && !pick(3)) {
+            randomTypedStatement(text, decls, scope, depth);
+            return;
+      }
+      size_t kind = pick(16);
+      if (kind < 8 || depth > 3) {
+            randomKama(text, scope, depth, kind == 0);
+      } else if (kind < 11) {
+            size_t counter = scope->counters++;
+            bool compare = pick(2);
+            indent(decls, scope->depth);
+            emit(decls, "o c%zu li nanpa = 0;\n", counter);
+            indent(text, depth);
+            emit(text, "c%zu = %zu;\n", counter, pick(7));
+            indent(text, depth);
+            emit(text, compare ? "tenpo c%zu > 0 la\n" : "tenpo c%zu la\n", counter);
+            indent(text, depth + 1);
+            emit(text, "c%zu = c%zu - 1;\n", counter, counter);
+            randomBlock(text, decls, scope, depth + 1, pick(4) + 1);
+            indent(text, depth);
+            emit(text, "pini\n");
+      } else if (kind < 14) {
+            indent(text, depth);
+            randomCondition(text, scope);
+            emit(text, " la\n");
+            randomBlock(text, decls, scope, depth + 1, pick(3) + 1);
+            if (pick(2)) {
+                  indent(text, depth);
+                  emit(text, "ante\n");
+                  // A conditional right after the ante would chain onto it
+                  randomKama(text, scope, depth + 1, false);
+                  randomBlock(text, decls, scope, depth + 1, pick(3));
+            }
+            indent(text, depth);
+            emit(text, "pini\n");
+      } else if (kind == 14) {
+            indent(text, depth);
+            emit(text, "otokis(\"%%n\\n\", %s);\n", scope->names[pick(scope->count)]);
+      } else {
+            // An early return, rare enough that most programs run to the end
+            indent(text, depth);
+            emit(text, pick(4) ? "%s = %s + 1;\n" : "otawa %s;\n",
+                 scope->names[pick(scope->count)], scope->names[pick(scope->count)]);
+      }
+}
+
+void randomBlock(Text *text, Text *decls, Scope *scope, int depth, size_t statements) {
+      for (size_t i = 0; i < statements; i++) randomStatement(text, decls, scope, depth);
+}
+
+// Loop counters are declared at the top of the scope, so the body is
+// generated first and the declarations put before it
+void randomScope(Text *text, Scope *scope, int depth) {
+      Text decls = {0}, body = {0};
+      emit(&decls, "");
+      emit(&body, "");
+      scope->depth = depth;
+      // Declarations only see what is declared before them
+      size_t telos = scope->teloCount, linjas = scope->linjaCount, arrays = scope->arrayCount;
+      scope->teloCount = scope->linjaCount = scope->arrayCount = 0;
+      for (size_t locals = pick(3) + 1; locals > 0; locals--) {
+            size_t index = scope->count;
+            indent(&decls, depth);
+            emit(&decls, "o v%zu li %s = ", index, nanpaTypes[pick(7)]);
+            randomArithmetic(&decls, scope);
+            emit(&decls, ";\n");
+            snprintf(scope->names[index], sizeof(scope->names[index]), "v%zu", index);
+            scope->count++;
+      }
+      for (; scope->teloCount < telos; scope->teloCount++) {
+            indent(&decls, depth);
+            emit(&decls, "o %s li %s = ", scope->telos[scope->teloCount], teloTypes[pick(2)]);
+            randomTelo(&decls, scope);
+            emit(&decls, ";\n");
+      }
+      scope->linjaCount = linjas;
+      scope->arrayCount = arrays;
+      for (size_t i = 0; i < scope->linjaCount; i++) {
+            indent(&decls, depth);
+            emit(&decls, "o %s li linja = %s;\n", scope->linjas[i], linjaLiterals[pick(4)]);
+      }
+      for (size_t i = 0; i < scope->arrayCount; i++) {
+            Array *array = &scope->arrays[i];
+            indent(&decls, depth);
+            if (array->count) emit(&decls, "o %s li %s[%zu] = ", array->name, array->element, array->count);
+            else emit(&decls, "o %s li %s[%s %% 7 + 9] = ", array->name, array->element, scope->names[0]);
+            if (teloArray(array)) emit(&decls, "%zu.%zu;\n", pick(20), pick(100));
+            else emit(&decls, "%zu;\n", pick(100));
+      }
+      randomBlock(&body, &decls, scope, depth, pick(8) + 2);
+      emit(text, "%s%s", decls.data, body.data);
+      free(decls.data);
+      free(body.data);
+}
+
+char *randomProgram() {
+      Text text = {0};
+      Scope scope = {0};
+      size_t pali = pick(3);
+      for (size_t p = 0; p < pali; p++) {
+            Scope inner = {.names = {"a", "b"}, .count = 2, .pali = p};
+            emit(&text, "pali p%zu pi (a li nanpa, b li nanpa) li pana nanpa la\n", p);
+            randomScope(&text, &inner, 1);
+            emit(&text, "    otawa ");
+            randomArithmetic(&text, &inner);
+            emit(&text, ";\npini\n\n");
+      }
+      scope.pali = pali;
+      scope.teloCount = pick(3);
+      for (size_t i = 0; i < scope.teloCount; i++) snprintf(scope.telos[i], sizeof(scope.telos[i]), "t%zu", i);
+      scope.linjaCount = pick(2);
+      for (size_t i = 0; i < scope.linjaCount; i++) snprintf(scope.linjas[i], sizeof(scope.linjas[i]), "l%zu", i);
+      scope.arrayCount = pick(5);
+      for (size_t i = 0; i < scope.arrayCount; i++) {
+            Array *array = &scope.arrays[i];
+            snprintf(array->name, sizeof(array->name), "a%zu", i);
+            // Arrays share an element type often enough to be combined
+            array->element = i && pick(2) ? scope.arrays[pick(i)].element : elementTypes[pick(6)];
+            array->count = pick(3) ? pick(40) + 1 : 0;
+      }
+      randomScope(&text, &scope, 0);
+      for (size_t i = 0; i < scope.count; i++) emit(&text, "otokis(\"%%n\\n\", %s);\n", scope.names[i]);
+      for (size_t i = 0; i < scope.teloCount; i++) emit(&text, "otokis(\"%%t\\n\", %s);\n", scope.telos[i]);
+      for (size_t i = 0; i < scope.arrayCount; i++) {
+            Array *array = &scope.arrays[i];
+            char *format = teloArray(array) ? "%t" : "%n";
+            emit(&text, "otokis(\"%s %s\\n\", %s[0], %s[%s.suli() - 1]);\n", format, format, array->name, array->name, array->name);
+      }
+      emit(&text, "otawa ");
+      randomArithmetic(&text, &scope);
+      emit(&text, ";\n");
+      return text.data;
+}
+
+// Compiling happens in a child so a crash or a leaked global in the
+// compiler can't take the harness down with it
+bool compile(char *program, Config config, char *binary, char *instrument, char *profile) {
+      pid_t pid = fork();
+      if (pid == 0) {
+            char path[256];
+            snprintf(path, sizeof(path), "%s.asm", binary);
+            Prog prog;
+            optLevel = config.optLevel;
+            unrollFactor = config.unrollFactor;
+            march = config.march;
+            instrumentPath = instrument;
+            profilePath = profile;
+            if (!parseSource(program, &prog)) _exit(1);
+            out = fopen(path, "w");
+            if (!out || !generateProgram(&prog)) _exit(1);
+            fclose(out);
+            _exit(0);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status)) return false;
+      char command[1024];
+      snprintf(command, sizeof(command), "nasm -felf64 %s.asm -o %s.o && ld %s.o -o %s", binary, binary, binary, binary);
+      return system(command) == 0;
+}
+
+void execute(char *binary, Outcome *outcome) {
+      int pipes[2];
+      outcome->outputLength = 0;
+      if (pipe(pipes)) {
+            outcome->status = Crashed;
+            return;
+      }
+      pid_t pid = fork();
+      if (pid == 0) {
+            dup2(pipes[1], STDOUT_FILENO);
+            // The exit status tells an index out of range apart already
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDERR_FILENO);
+            close(pipes[0]);
+            close(pipes[1]);
+            // The alarm survives the exec
+            alarm(2);
+            execl(binary, binary, (char*)NULL);
+            _exit(127);
+      }
+      close(pipes[1]);
+      char buffer[4096];
+      ssize_t got;
+      while ((got = read(pipes[0], buffer, sizeof(buffer))) > 0) {
+            size_t take = (size_t)got < OUTPUT_MAX - outcome->outputLength ? (size_t)got : OUTPUT_MAX - outcome->outputLength;
+            memcpy(outcome->output + outcome->outputLength, buffer, take);
+            outcome->outputLength += take;
+      }
+      close(pipes[0]);
+      int status;
+      waitpid(pid, &status, 0);
+      if (WIFEXITED(status)) outcome->status = WEXITSTATUS(status);
+      else outcome->status = WTERMSIG(status) == SIGALRM ? TimedOut : Crashed;
+}
+
+void test(char *program, Outcome *outcomes) {
+      __builtin_cpu_init();
+      for (size_t c = 0; c < CONFIGS; c++) {
+            // A config the cpu can't run counts as agreeing
+            if (configs[c].march == MarchAvx2 && !__builtin_cpu_supports("avx2")) {
+                  outcomes[c] = outcomes[0];
+                  continue;
+            }
+            char binary[256];
+            snprintf(binary, sizeof(binary), "bin/fuzz/%s", configs[c].name);
+            char profile[sizeof(binary) + 16], *use = NULL;
+            if (configs[c].profileUse) {
+                  // A program whose training run writes no profile is still
+                  // compiled, just without one
+                  snprintf(profile, sizeof(profile), "%s.profile", binary);
+                  unlink(profile);
+                  if (compile(program, configs[c], binary, profile, NULL)) execute(binary, &outcomes[c]);
+                  if (!access(profile, R_OK)) use = profile;
+            }
+            if (compile(program, configs[c], binary, NULL, use)) execute(binary, &outcomes[c]);
+            else outcomes[c] = (Outcome){.status = CompileFailed};
+      }
+}
+
+bool sameOutcome(Outcome *a, Outcome *b) {
+      return a->status == b->status && a->outputLength == b->outputLength
+             && !memcmp(a->output, b->output, a->outputLength);
+}
+
+// Returns the first config that disagrees with the reference, or 0
+size_t mismatch(Outcome *outcomes) {
+      for (size_t c = 1; c < CONFIGS; c++) {
+            if (!sameOutcome(&outcomes[0], &outcomes[c])) return c;
+      }
+      return 0;
+}
+
+// Minimization removes whole statements, a line or a block from its opening
+// la to the matching pini, for as long as the configs still disagree.
+
+size_t blockEnd(char **lines, size_t count, size_t start) {
+      size_t length = strlen(lines[start]);
+      if (length < 3 || strcmp(lines[start] + length - 3, " la")) return start + 1;
+      int depth = 0;
+      for (size_t i = start; i < count; i++) {
+            char *line = lines[i] + strspn(lines[i], " ");
+            length = strlen(line);
+            if (length >= 3 && !strcmp(line + length - 3, " la")) depth++;
+            else if (!strcmp(line, "pini") && --depth == 0) return i + 1;
+      }
+      return count;
+}
+
+char *joinLines(char **lines, size_t count, size_t skipFrom, size_t skipTo) {
+      Text text = {0};
+      emit(&text, "");
+      for (size_t i = 0; i < count; i++) {
+            if (i < skipFrom || i >= skipTo) emit(&text, "%s\n", lines[i]);
+      }
+      return text.data;
+}
+
+char *minimize(char *program, size_t *tests) {
+      char *copy = strdup(program);
+      char **lines = malloc(sizeof(char*) * (strlen(program) + 1));
+      size_t count = 0;
+      for (char *line = strtok(copy, "\n"); line; line = strtok(NULL, "\n")) lines[count++] = line;
+      FILE *oldErrors = errors;
+      errors = fopen("/dev/null", "w");
+      bool progress = true;
+      while (progress) {
+            progress = false;
+            for (size_t i = count; i-- > 0;) {
+                  size_t end = blockEnd(lines, count, i);
+                  char *candidate = joinLines(lines, count, i, end);
+                  Outcome outcomes[CONFIGS];
+                  test(candidate, outcomes);
+                  ++*tests;
+                  free(candidate);
+                  if (outcomes[0].status == CompileFailed || !mismatch(outcomes)) continue;
+                  memmove(lines + i, lines + end, (count - end) * sizeof(char*));
+                  count -= end - i;
+                  progress = true;
+            }
+      }
+      fclose(errors);
+      errors = oldErrors;
+      char *result = joinLines(lines, count, 0, 0);
+      free(lines);
+      free(copy);
+      return result;
+}
+
+void report(char *program, Outcome *outcomes, size_t failure) {
+      char path[256];
+      snprintf(path, sizeof(path), "bin/fuzz/fail%zu.ln", failure);
+      FILE *file = fopen(path, "w");
+      if (file) {
+            fputs(program, file);
+            fclose(file);
+      }
+      printf("mismatch, minimized to %s:\n%s", path, program);
+      for (size_t c = 0; c < CONFIGS; c++) {
+            printf("  %-18s status %d, %zu bytes of output\n", configs[c].name, outcomes[c].status, outcomes[c].outputLength);
+      }
+}
+
+int main(int argc, char **argv) {
+      out = stdout;
+      errors = stderr;
+      uint64_t seed = time(NULL);
+      size_t count = 0;
+      double seconds = 0;
+      for (int i = 1; i + 1 < argc; i += 2) {
+            if (!strcmp(argv[i], "--seed")) seed = strtoull(argv[i + 1], NULL, 10);
+            else if (!strcmp(argv[i], "--count")) count = atol(argv[i + 1]);
+            else if (!strcmp(argv[i], "--seconds")) seconds = atof(argv[i + 1]);
+      }
+      if (system("mkdir -p bin/fuzz")) return 1;
+      printf("seed %llu\n", (unsigned long long)seed);
+      fflush(stdout);
+      rng = seed * 2654435761u + 1;
+
+      double start = now(), lastReport = start;
+      size_t programs = 0, failures = 0, invalid = 0, tests = 0;
+      while ((!count || programs < count) && (!seconds || now() - start < seconds)) {
+            char *program = randomProgram();
+            Outcome outcomes[CONFIGS];
+            test(program, outcomes);
+            programs++;
+            if (outcomes[0].status == CompileFailed && !mismatch(outcomes)) {
+                  // Every config rejected it, so the generator is at fault
+                  invalid++;
+                  char path[256];
+                  snprintf(path, sizeof(path), "bin/fuzz/invalid%zu.ln", invalid);
+                  FILE *file = fopen(path, "w");
+                  if (file) {
+                        fputs(program, file);
+                        fclose(file);
+                  }
+                  fprintf(stderr, "generated program doesn't compile, kept in %s\n", path);
+            } else if (mismatch(outcomes)) {
+                  failures++;
+                  char *small = minimize(program, &tests);
+                  test(small, outcomes);
+                  report(small, outcomes, failures);
+                  free(small);
+            }
+            free(program);
+            if (now() - lastReport >= 10) {
+                  lastReport = now();
+                  printf("%zu programs, %.1f programs/s, %zu mismatches\n", programs, programs / (lastReport - start), failures);
+                  fflush(stdout);
+            }
+      }
+      double elapsed = now() - start;
+      printf("%zu programs in %.1f s, %.1f programs/s, %zu mismatches, %zu invalid, %zu minimization runs\n",
+             programs, elapsed, programs / elapsed, failures, invalid, tests);
+      return failures || invalid;
+}
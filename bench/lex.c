@@ -0,0 +1,106 @@
+// Lexing throughput of a generated source with every lexer width the cpu
+// has, then with the widest on 1 to 32 threads, checking that they all give
+// the same tokens. Random bytes are lexed first to compare the widths on
+// input no program would contain.
+// Usage: bin/bench/lex [megabytes]
+#define LPC_LIBRARY
+#include "../main.c"
+#include <time.h>
+
+double now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+char *widths[] = {"", "scalar", "sse2", "avx2"};
+
+bool sameTokens(Tokens *a, Tokens *b) {
+      if (a->size != b->size) return false;
+      for (size_t i = 0; i < a->size; i++) {
+            Token x = a->tokens[i], y = b->tokens[i];
+            if (x.type != y.type || x.line != y.line || x.column != y.column
+                || x.length != y.length || x.offset != y.offset) return false;
+            bool text = x.type == TOKEN_NAME || x.type == TOKEN_NUMBER || x.type == TOKEN_STRING_LITERAL;
+            if (text && strcmp(x.value, y.value)) return false;
+      }
+      return true;
+}
+
+Tokens lex(char *text, int width) {
+      pickLexer(width);
+      diagnostics.size = 0;
+      Tokens tokens = tokenize(text);
+      return tokens;
+}
+
+int main(int argc, char **argv) {
+      out = stdout;
+      errors = stderr;
+      size_t megabytes = argc > 1 ? atol(argv[1]) : 64;
+      pickLexer(0);
+      int best = lexWidth;
+
+      srand(1);
+      char random[4097];
+      char alphabet[] = "  \t\n\"\\/abcxyz019.;=<(\xff\x80";
+      for (int round = 0; round < 2000; round++) {
+            diagnostics.size = 0;
+            size_t length = rand() % 4096;
+            for (size_t i = 0; i < length; i++) random[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+            random[length] = 0;
+            Tokens scalar = lex(random, LexScalar);
+            for (int width = LexSse2; width <= best; width++) {
+                  Tokens tokens = lex(random, width);
+                  if (!sameTokens(&scalar, &tokens)) {
+                        fprintf(stderr, "%s tokens differ from scalar on random input %d\n", widths[width], round);
+                        return 1;
+                  }
+            }
+      }
+
+      size_t capacity = megabytes << 20;
+      char *text = malloc(capacity + 256);
+      size_t length = 0;
+      for (int i = 0; length < capacity; i++) {
+            length += snprintf(text + length, 256,
+                               "// block %d sets a value and prints it\n"
+                               "o value%d li nanpa = %d;\n"
+                               "tenpo value%d > 0 la\n"
+                               "        value%d = value%d - 1;\n"
+                               "pini\n"
+                               "otokis(\"value %d is \\\"%%n\\\"\\n\", value%d);\n\n", i, i, i, i, i, i, i, i);
+      }
+
+      Tokens first = {};
+      for (int width = LexScalar; width <= best; width++) {
+            double start = now();
+            Tokens tokens = lex(text, width);
+            double seconds = (now() - start) / 1e6;
+            printf("%-6s %zu tokens in %6.1f ms, %7.1f MB/s\n", widths[width], tokens.size,
+                   seconds * 1000, length / seconds / (1 << 20));
+            if (width == LexScalar) first = tokens;
+            else if (!sameTokens(&first, &tokens)) {
+                  fprintf(stderr, "%s tokens differ from scalar\n", widths[width]);
+                  return 1;
+            }
+      }
+
+      // Every thread count is compared to the one thread run
+      double serial = 0;
+      for (size_t threads = 1; threads <= 32; threads *= 2) {
+            lexThreads = threads;
+            double start = now();
+            Tokens tokens = lex(text, best);
+            double seconds = (now() - start) / 1e6;
+            if (threads == 1) serial = seconds;
+            printf("%2zu threads %6.1f ms, %7.1f MB/s, %4.2fx\n", threads, seconds * 1000,
+                   length / seconds / (1 << 20), serial / seconds);
+            if (!sameTokens(&first, &tokens)) {
+                  fprintf(stderr, "tokens on %zu threads differ from one thread\n", threads);
+                  return 1;
+            }
+            free(tokens.tokens);
+      }
+      return 0;
+}
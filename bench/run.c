@@ -0,0 +1,295 @@
+// Hardware counters for the code lpc generates: builds every benchmark with
+// bin/main, runs it several times and reports the median cycles,
+// instructions, branch misses and L1 data misses from perf_event_open. A
+// counter the kernel refuses shows as n/a; wall time is always measured.
+// A benchmark is a file and the flags it is compiled with, file.ln:flags on
+// the command line. A file given without flags runs with every flag set it
+// has below. Every build of a file has to exit with the same status, and
+// one that needs avx2 is skipped on a cpu without it.
+// Usage: bin/bench/run [--runs n] [--save file] [--baseline file] [file.ln[:flags]...]
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS_MAX 64
+#define BENCHMARKS_MAX 64
+
+typedef enum {Cycles, Instructions, BranchMisses, L1Misses, Wall, METRICS} Metric;
+char *metricNames[] = {"cycles", "instructions", "branch-misses", "l1d-misses", "wall-ns"};
+
+typedef struct {
+      uint32_t type;
+      uint64_t config;
+} Counter;
+
+Counter counters[] = {
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+};
+
+typedef struct {
+      char *file;
+      char *flags;
+      char *name;
+} Benchmark;
+
+Benchmark defaults[] = {
+      {"examples/fib.ln", "", "fib"},
+      {"bench/arith.ln", "", "arith"},
+      {"bench/branch.ln", "", "branch"},
+      {"bench/matrix.ln", "", "matrix"},
+      {"bench/unroll.ln", "--unroll 1", "unroll-1"},
+      {"bench/unroll.ln", "--unroll 4", "unroll-4"},
+      {"bench/unroll.ln", "--unroll 16", "unroll-16"},
+      {"bench/bounds.ln", "--bounds-checks all", "bounds-all"},
+      {"bench/bounds.ln", "--bounds-checks range", "bounds-range"},
+      {"bench/bounds.ln", "--bounds-checks none", "bounds-none"},
+      {"bench/tail.ln", "", "tail"},
+      {"bench/tail.ln", "--no-tail-calls", "tail-calls"},
+      {"bench/vector.ln", "-O2 --no-vectorize", "vector-scalar"},
+      {"bench/vector.ln", "-O2 -march=sse2", "vector-sse2"},
+      {"bench/vector.ln", "-O2 -march=avx2", "vector-avx2"},
+};
+#define DEFAULTS (sizeof(defaults) / sizeof(*defaults))
+
+// A value of -1 means the metric wasn't available
+typedef struct {
+      char name[64];
+      double values[METRICS];
+      int status;
+} Result;
+
+double now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int compareDoubles(const void *a, const void *b) {
+      double x = *(const double*)a, y = *(const double*)b;
+      return (x > y) - (x < y);
+}
+
+int openCounter(Counter counter, pid_t pid) {
+      struct perf_event_attr attr = {0};
+      attr.size = sizeof(attr);
+      attr.type = counter.type;
+      attr.config = counter.config;
+      attr.disabled = 1;
+      attr.enable_on_exec = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Compiles file with flags to bin/bench/<name>, returning false if any step
+// fails
+bool build(Benchmark benchmark) {
+      char command[1024];
+      char *name = benchmark.name;
+      snprintf(command, sizeof(command),
+               "bin/main %s %s > bin/bench/%s.asm && nasm -felf64 bin/bench/%s.asm -o bin/bench/%s.o && ld bin/bench/%s.o -o bin/bench/%s",
+               benchmark.flags, benchmark.file, name, name, name, name, name);
+      return system(command) == 0;
+}
+
+// Builds that use avx2 only run on a cpu that has it
+bool supported(Benchmark benchmark) {
+      __builtin_cpu_init();
+      return !strstr(benchmark.flags, "avx2") || __builtin_cpu_supports("avx2");
+}
+
+// Benchmarks exit with what they computed, so the status is returned for
+// comparing, and only a signal fails the run. The child waits on a pipe until the counters are attached, so they start
+// counting exactly at exec and never see the fork
+bool measure(char *path, double *values, int *status) {
+      int ready[2];
+      if (pipe(ready)) return false;
+      pid_t pid = fork();
+      if (pid < 0) return false;
+      if (pid == 0) {
+            char go;
+            close(ready[1]);
+            if (read(ready[0], &go, 1) != 1) _exit(127);
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execl(path, path, (char*)NULL);
+            _exit(127);
+      }
+      close(ready[0]);
+      int fds[Wall];
+      for (int m = 0; m < Wall; m++) fds[m] = openCounter(counters[m], pid);
+      double start = now();
+      write(ready[1], "", 1);
+      close(ready[1]);
+      int wait;
+      waitpid(pid, &wait, 0);
+      values[Wall] = now() - start;
+      for (int m = 0; m < Wall; m++) {
+            uint64_t count;
+            values[m] = fds[m] >= 0 && read(fds[m], &count, sizeof(count)) == sizeof(count) ? (double)count : -1;
+            if (fds[m] >= 0) close(fds[m]);
+      }
+      *status = WEXITSTATUS(wait);
+      return WIFEXITED(wait);
+}
+
+bool run(Benchmark benchmark, size_t runs, Result *result) {
+      snprintf(result->name, sizeof(result->name), "%s", benchmark.name);
+      if (!build(benchmark)) {
+            fprintf(stderr, "%s %s: build failed\n", benchmark.file, benchmark.flags);
+            return false;
+      }
+      char path[128];
+      snprintf(path, sizeof(path), "bin/bench/%s", result->name);
+      double samples[METRICS][RUNS_MAX];
+      for (size_t r = 0; r < runs; r++) {
+            double values[METRICS];
+            int status;
+            if (!measure(path, values, &status) || (r > 0 && status != result->status)) {
+                  fprintf(stderr, "%s: run failed\n", path);
+                  return false;
+            }
+            result->status = status;
+            for (int m = 0; m < METRICS; m++) samples[m][r] = values[m];
+      }
+      for (int m = 0; m < METRICS; m++) {
+            qsort(samples[m], runs, sizeof(double), compareDoubles);
+            result->values[m] = samples[m][runs / 2];
+      }
+      return true;
+}
+
+// Baseline files hold one "name metric value" line per measurement
+double baselineValue(FILE *baseline, char *name, int metric) {
+      char line[256], lineName[64], lineMetric[32];
+      double value;
+      rewind(baseline);
+      while (fgets(line, sizeof(line), baseline)) {
+            if (sscanf(line, "%63s %31s %lf", lineName, lineMetric, &value) == 3
+                && !strcmp(lineName, name) && !strcmp(lineMetric, metricNames[metric])) return value;
+      }
+      return -1;
+}
+
+void report(Result *result, FILE *baseline) {
+      printf("%s\n", result->name);
+      for (int m = 0; m < METRICS; m++) {
+            double value = result->values[m];
+            if (value < 0) {
+                  printf("  %-14s %16s\n", metricNames[m], "n/a");
+                  continue;
+            }
+            printf("  %-14s %16.0f", metricNames[m], value);
+            double old = baseline ? baselineValue(baseline, result->name, m) : -1;
+            if (old > 0) printf("   %+7.2f%%", (value - old) * 100 / old);
+            printf("\n");
+      }
+}
+
+// Adds the benchmarks for arg, file.ln:flags or a file with the flag sets
+// it has in defaults, and returns the new count. Names are the file's base
+// name, with the flags after it for ones from the command line.
+size_t addBenchmarks(Benchmark *benchmarks, char names[][64], size_t count, char *arg) {
+      char *colon = strchr(arg, ':');
+      if (colon) *colon = 0;
+      size_t before = count;
+      for (size_t i = 0; i < DEFAULTS && !colon; i++) {
+            if (strcmp(defaults[i].file, arg) || count == BENCHMARKS_MAX) continue;
+            benchmarks[count++] = defaults[i];
+      }
+      if (count > before || count == BENCHMARKS_MAX) return count;
+      char *base = strrchr(arg, '/');
+      base = base ? base + 1 : arg;
+      char *flags = colon ? colon + 1 : "";
+      int length = snprintf(names[count], 64, "%.*s%s", (int)strcspn(base, "."), base, *flags ? "-" : "");
+      for (char *c = flags; *c && length < 63; c++) {
+            if (*c != '-' && *c != ' ') names[count][length++] = *c;
+            else if (*c == ' ' && names[count][length - 1] != '-') names[count][length++] = '-';
+      }
+      names[count][length] = 0;
+      benchmarks[count] = (Benchmark){arg, flags, names[count]};
+      return count + 1;
+}
+
+int main(int argc, char **argv) {
+      size_t runs = 5;
+      char *savePath = NULL, *baselinePath = NULL;
+      Benchmark benchmarks[BENCHMARKS_MAX];
+      char names[BENCHMARKS_MAX][64];
+      size_t count = 0;
+      bool given = false;
+      for (int i = 1; i < argc; i++) {
+            if (!strcmp(argv[i], "--runs") && i + 1 < argc) runs = atol(argv[++i]);
+            else if (!strcmp(argv[i], "--save") && i + 1 < argc) savePath = argv[++i];
+            else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baselinePath = argv[++i];
+            else count = addBenchmarks(benchmarks, names, count, argv[i]), given = true;
+      }
+      if (runs < 1 || runs > RUNS_MAX) {
+            fprintf(stderr, "--runs must be between 1 and %d\n", RUNS_MAX);
+            return 1;
+      }
+      if (!given) {
+            count = DEFAULTS;
+            memcpy(benchmarks, defaults, sizeof(defaults));
+      }
+
+      FILE *baseline = baselinePath ? fopen(baselinePath, "r") : NULL;
+      if (baselinePath && !baseline) fprintf(stderr, "%s: no baseline, %s\n", baselinePath, strerror(errno));
+      FILE *save = savePath ? fopen(savePath, "w") : NULL;
+      if (savePath && !save) {
+            fprintf(stderr, "%s: %s\n", savePath, strerror(errno));
+            return 1;
+      }
+
+      int perf = openCounter(counters[Cycles], 0);
+      if (perf < 0) printf("perf_event_open unavailable (%s), wall time only\n", strerror(errno));
+      else close(perf);
+      printf("median of %zu runs\n", runs);
+      fflush(stdout);
+
+      bool failed = false;
+      Result results[BENCHMARKS_MAX];
+      for (size_t i = 0; i < count; i++) {
+            Result result;
+            if (!supported(benchmarks[i])) {
+                  printf("%s\n  skipped, the cpu has no avx2\n", benchmarks[i].name);
+                  results[i].status = -1;
+                  continue;
+            }
+            if (!run(benchmarks[i], runs, &result)) {
+                  failed = true;
+                  results[i].status = -1;
+                  continue;
+            }
+            results[i] = result;
+            // Other flags mustn't change what the program computes
+            for (size_t j = 0; j < i; j++) {
+                  if (strcmp(benchmarks[j].file, benchmarks[i].file) || results[j].status < 0) continue;
+                  if (results[j].status != result.status) {
+                        fprintf(stderr, "%s: exit status %d, %s exited with %d\n",
+                                result.name, result.status, results[j].name, results[j].status);
+                        failed = true;
+                  }
+                  break;
+            }
+            report(&result, baseline);
+            for (int m = 0; save && m < METRICS; m++) {
+                  if (result.values[m] >= 0) fprintf(save, "%s %s %.0f\n", result.name, metricNames[m], result.values[m]);
+            }
+      }
+      if (baseline) fclose(baseline);
+      if (save) fclose(save);
+      return failed;
+}
@@ -0,0 +1,223 @@
+global _start
+_start:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov qword [rbp-8], 0
+    mov qword [rbp-16], 2000
+.loopin0:
+    mov rcx, qword [rbp-16]
+    test rcx, rcx
+    je .loopout0
+    dec qword [rbp-16]
+    push qword [rbp-8]
+    push 100000
+    push qword [rbp-16]
+    call pali_sum
+    add rsp, 16
+    push rax
+    pop r9
+    pop r8
+    add r8, r9
+    push r8
+    mov r8, 100000
+    add r8, qword [rbp-16]
+    push r8
+    pop qword [rbp-24]
+    ;; inlined pali even
+    mov r8, qword [rbp-24]
+    test r8, r8
+    jne .laout0
+    mov rax, 1
+    jmp .inlineout0
+.laout0:
+    mov r8, qword [rbp-24]
+    sub r8, 1
+    push r8
+    pop qword [rbp-32]
+    ;; inlined pali odd
+    mov r8, qword [rbp-32]
+    test r8, r8
+    jne .laout1
+    mov rax, 0
+    jmp .inlineout1
+.laout1:
+    mov r8, qword [rbp-32]
+    sub r8, 1
+    push r8
+    call pali_even
+    add rsp, 8
+    push rax
+    pop rax
+    jmp .inlineout1
+    mov rax, 0
+.inlineout1:
+    push rax
+    pop rax
+    jmp .inlineout0
+    mov rax, 0
+.inlineout0:
+    push rax
+    pop r9
+    pop r8
+    add r8, r9
+    mov qword [rbp-8], r8
+    jmp .loopin0
+.loopout0:
+    mov r8, qword [rbp-8]
+    mov rax, r8
+    sar rax, 63
+    shr rax, 56
+    add rax, r8
+    sar rax, 8
+    shl rax, 8
+    sub r8, rax
+    mov rdi, r8
+    mov rax, 60
+    syscall
+    mov rdi, 0
+    mov rax, 60
+    syscall
+.frame equ 32
+
+pali_sum:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov r8, qword [rbp+24]
+    test r8, r8
+    jne .laout0
+    mov rax, qword [rbp+16]
+    leave
+    ret
+.laout0:
+    mov r8, qword [rbp+24]
+    sub r8, 1
+    push r8
+    mov r8, qword [rbp+16]
+    add r8, qword [rbp+24]
+    push r8
+    call pali_sum
+    add rsp, 16
+    push rax
+    pop rax
+    leave
+    ret
+    mov rax, 0
+    leave
+    ret
+.frame equ 0
+
+pali_even:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov r8, qword [rbp+16]
+    test r8, r8
+    jne .laout0
+    mov rax, 1
+    leave
+    ret
+.laout0:
+    mov r8, qword [rbp+16]
+    sub r8, 1
+    push r8
+    pop qword [rbp-8]
+    ;; inlined pali odd
+    mov r8, qword [rbp-8]
+    test r8, r8
+    jne .laout1
+    mov rax, 0
+    jmp .inlineout0
+.laout1:
+    mov r8, qword [rbp-8]
+    sub r8, 1
+    push r8
+    pop qword [rbp-16]
+    ;; inlined pali even
+    mov r8, qword [rbp-16]
+    test r8, r8
+    jne .laout2
+    mov rax, 1
+    jmp .inlineout1
+.laout2:
+    mov r8, qword [rbp-16]
+    sub r8, 1
+    push r8
+    call pali_odd
+    add rsp, 8
+    push rax
+    pop rax
+    jmp .inlineout1
+    mov rax, 0
+.inlineout1:
+    push rax
+    pop rax
+    jmp .inlineout0
+    mov rax, 0
+.inlineout0:
+    push rax
+    pop rax
+    leave
+    ret
+    mov rax, 0
+    leave
+    ret
+.frame equ 16
+
+pali_odd:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov r8, qword [rbp+16]
+    test r8, r8
+    jne .laout0
+    mov rax, 0
+    leave
+    ret
+.laout0:
+    mov r8, qword [rbp+16]
+    sub r8, 1
+    push r8
+    pop qword [rbp-8]
+    ;; inlined pali even
+    mov r8, qword [rbp-8]
+    test r8, r8
+    jne .laout1
+    mov rax, 1
+    jmp .inlineout0
+.laout1:
+    mov r8, qword [rbp-8]
+    sub r8, 1
+    push r8
+    pop qword [rbp-16]
+    ;; inlined pali odd
+    mov r8, qword [rbp-16]
+    test r8, r8
+    jne .laout2
+    mov rax, 0
+    jmp .inlineout1
+.laout2:
+    mov r8, qword [rbp-16]
+    sub r8, 1
+    push r8
+    call pali_even
+    add rsp, 8
+    push rax
+    pop rax
+    jmp .inlineout1
+    mov rax, 0
+.inlineout1:
+    push rax
+    pop rax
+    jmp .inlineout0
+    mov rax, 0
+.inlineout0:
+    push rax
+    pop rax
+    leave
+    ret
+    mov rax, 0
+    leave
+    ret
+.frame equ 16
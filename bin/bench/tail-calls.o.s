@@ -0,0 +1,215 @@
+.intel_syntax noprefix
+.globl _start
+_start:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET _start.frame
+mov QWORD PTR [rbp-8], 0
+mov QWORD PTR [rbp-16], 2000
+_start.loopin0:
+mov rcx, QWORD PTR [rbp-16]
+test rcx, rcx
+je _start.loopout0
+dec QWORD PTR [rbp-16]
+push QWORD PTR [rbp-8]
+push 100000
+push QWORD PTR [rbp-16]
+call pali_sum
+add rsp, 16
+push rax
+pop r9
+pop r8
+add r8, r9
+push r8
+mov r8, 100000
+add r8, QWORD PTR [rbp-16]
+push r8
+pop QWORD PTR [rbp-24]
+mov r8, QWORD PTR [rbp-24]
+test r8, r8
+jne _start.laout0
+mov rax, 1
+jmp _start.inlineout0
+_start.laout0:
+mov r8, QWORD PTR [rbp-24]
+sub r8, 1
+push r8
+pop QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-32]
+test r8, r8
+jne _start.laout1
+mov rax, 0
+jmp _start.inlineout1
+_start.laout1:
+mov r8, QWORD PTR [rbp-32]
+sub r8, 1
+push r8
+call pali_even
+add rsp, 8
+push rax
+pop rax
+jmp _start.inlineout1
+mov rax, 0
+_start.inlineout1:
+push rax
+pop rax
+jmp _start.inlineout0
+mov rax, 0
+_start.inlineout0:
+push rax
+pop r9
+pop r8
+add r8, r9
+mov QWORD PTR [rbp-8], r8
+jmp _start.loopin0
+_start.loopout0:
+mov r8, QWORD PTR [rbp-8]
+mov rax, r8
+sar rax, 63
+shr rax, 56
+add rax, r8
+sar rax, 8
+shl rax, 8
+sub r8, rax
+mov rdi, r8
+mov rax, 60
+syscall
+mov rdi, 0
+mov rax, 60
+syscall
+.set _start.frame, 32
+pali_sum:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET pali_sum.frame
+mov r8, QWORD PTR [rbp+24]
+test r8, r8
+jne pali_sum.laout0
+mov rax, QWORD PTR [rbp+16]
+leave
+ret
+pali_sum.laout0:
+mov r8, QWORD PTR [rbp+24]
+sub r8, 1
+push r8
+mov r8, QWORD PTR [rbp+16]
+add r8, QWORD PTR [rbp+24]
+push r8
+call pali_sum
+add rsp, 16
+push rax
+pop rax
+leave
+ret
+mov rax, 0
+leave
+ret
+.set pali_sum.frame, 0
+pali_even:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET pali_even.frame
+mov r8, QWORD PTR [rbp+16]
+test r8, r8
+jne pali_even.laout0
+mov rax, 1
+leave
+ret
+pali_even.laout0:
+mov r8, QWORD PTR [rbp+16]
+sub r8, 1
+push r8
+pop QWORD PTR [rbp-8]
+mov r8, QWORD PTR [rbp-8]
+test r8, r8
+jne pali_even.laout1
+mov rax, 0
+jmp pali_even.inlineout0
+pali_even.laout1:
+mov r8, QWORD PTR [rbp-8]
+sub r8, 1
+push r8
+pop QWORD PTR [rbp-16]
+mov r8, QWORD PTR [rbp-16]
+test r8, r8
+jne pali_even.laout2
+mov rax, 1
+jmp pali_even.inlineout1
+pali_even.laout2:
+mov r8, QWORD PTR [rbp-16]
+sub r8, 1
+push r8
+call pali_odd
+add rsp, 8
+push rax
+pop rax
+jmp pali_even.inlineout1
+mov rax, 0
+pali_even.inlineout1:
+push rax
+pop rax
+jmp pali_even.inlineout0
+mov rax, 0
+pali_even.inlineout0:
+push rax
+pop rax
+leave
+ret
+mov rax, 0
+leave
+ret
+.set pali_even.frame, 16
+pali_odd:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET pali_odd.frame
+mov r8, QWORD PTR [rbp+16]
+test r8, r8
+jne pali_odd.laout0
+mov rax, 0
+leave
+ret
+pali_odd.laout0:
+mov r8, QWORD PTR [rbp+16]
+sub r8, 1
+push r8
+pop QWORD PTR [rbp-8]
+mov r8, QWORD PTR [rbp-8]
+test r8, r8
+jne pali_odd.laout1
+mov rax, 1
+jmp pali_odd.inlineout0
+pali_odd.laout1:
+mov r8, QWORD PTR [rbp-8]
+sub r8, 1
+push r8
+pop QWORD PTR [rbp-16]
+mov r8, QWORD PTR [rbp-16]
+test r8, r8
+jne pali_odd.laout2
+mov rax, 0
+jmp pali_odd.inlineout1
+pali_odd.laout2:
+mov r8, QWORD PTR [rbp-16]
+sub r8, 1
+push r8
+call pali_even
+add rsp, 8
+push rax
+pop rax
+jmp pali_odd.inlineout1
+mov rax, 0
+pali_odd.inlineout1:
+push rax
+pop rax
+jmp pali_odd.inlineout0
+mov rax, 0
+pali_odd.inlineout0:
+push rax
+pop rax
+leave
+ret
+mov rax, 0
+leave
+ret
+.set pali_odd.frame, 16
@@ -0,0 +1,89 @@
+global _start
+_start:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov qword [rbp-8], 0
+    mov qword [rbp-16], 1
+    mov qword [rbp-24], 0
+    mov qword [rbp-32], 200000000
+.unroll0:
+    cmp qword [rbp-32], 8
+    jl .loopin0
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    jmp .unroll0
+.loopin0:
+    mov rcx, qword [rbp-32]
+    test rcx, rcx
+    je .loopout0
+    dec qword [rbp-32]
+    mov r8, qword [rbp-8]
+    mov qword [rbp-24], r8
+    mov r8, qword [rbp-16]
+    add qword [rbp-8], r8
+    mov r8, qword [rbp-24]
+    mov qword [rbp-16], r8
+    jmp .loopin0
+.loopout0:
+    mov rdi, qword [rbp-8]
+    mov rax, 60
+    syscall
+    mov rdi, 0
+    mov rax, 60
+    syscall
+.frame equ 32
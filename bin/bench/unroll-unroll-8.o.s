@@ -0,0 +1,90 @@
+.intel_syntax noprefix
+.globl _start
+_start:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET _start.frame
+mov QWORD PTR [rbp-8], 0
+mov QWORD PTR [rbp-16], 1
+mov QWORD PTR [rbp-24], 0
+mov QWORD PTR [rbp-32], 200000000
+_start.unroll0:
+cmp QWORD PTR [rbp-32], 8
+jl _start.loopin0
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+jmp _start.unroll0
+_start.loopin0:
+mov rcx, QWORD PTR [rbp-32]
+test rcx, rcx
+je _start.loopout0
+dec QWORD PTR [rbp-32]
+mov r8, QWORD PTR [rbp-8]
+mov QWORD PTR [rbp-24], r8
+mov r8, QWORD PTR [rbp-16]
+add QWORD PTR [rbp-8], r8
+mov r8, QWORD PTR [rbp-24]
+mov QWORD PTR [rbp-16], r8
+jmp _start.loopin0
+_start.loopout0:
+mov rdi, QWORD PTR [rbp-8]
+mov rax, 60
+syscall
+mov rdi, 0
+mov rax, 60
+syscall
+.set _start.frame, 32
@@ -0,0 +1,1170 @@
+.intel_syntax noprefix
+.globl _start
+_start:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET _start.frame
+mov QWORD PTR [lpc_stdout+8], 1
+mov QWORD PTR [lpc_stderr+8], 2
+mov QWORD PTR [rbp-8], 1000
+mov rdi, QWORD PTR [rbp-8]
+mov esi, 8
+call lpc_alloc
+mov QWORD PTR [rbp-32], rax
+mov QWORD PTR [rbp-24], rdi
+mov r8, 0x3ff8000000000000
+movq xmm0, r8
+movq rax, xmm0
+mov rdi, QWORD PTR [rbp-32]
+mov rcx, QWORD PTR [rbp-24]
+rep stosq
+mov rdi, QWORD PTR [rbp-8]
+mov esi, 8
+call lpc_alloc
+mov QWORD PTR [rbp-48], rax
+mov QWORD PTR [rbp-40], rdi
+mov r8, 0x4004000000000000
+movq xmm0, r8
+movq rax, xmm0
+mov rdi, QWORD PTR [rbp-48]
+mov rcx, QWORD PTR [rbp-40]
+rep stosq
+mov rdi, QWORD PTR [rbp-8]
+mov esi, 8
+call lpc_alloc
+mov QWORD PTR [rbp-64], rax
+mov QWORD PTR [rbp-56], rdi
+mov r8, 0x3fe0000000000000
+movq xmm0, r8
+movq rax, xmm0
+mov rdi, QWORD PTR [rbp-64]
+mov rcx, QWORD PTR [rbp-56]
+rep stosq
+mov QWORD PTR [rbp-72], 100000
+mov QWORD PTR [rbp-80], 0
+_start.unroll0:
+cmp QWORD PTR [rbp-72], 4
+jl _start.loopin0
+dec QWORD PTR [rbp-72]
+push QWORD PTR [rbp-56]
+pop r8
+mov QWORD PTR [rbp-80], r8
+.p2align 4
+_start.unroll1:
+cmp QWORD PTR [rbp-80], 4
+jl _start.loopin1
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.unroll1
+_start.loopin1:
+mov rcx, QWORD PTR [rbp-80]
+test rcx, rcx
+je _start.loopout1
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.loopin1
+_start.loopout1:
+dec QWORD PTR [rbp-72]
+push QWORD PTR [rbp-56]
+pop r8
+mov QWORD PTR [rbp-80], r8
+.p2align 4
+_start.unroll2:
+cmp QWORD PTR [rbp-80], 4
+jl _start.loopin2
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.unroll2
+_start.loopin2:
+mov rcx, QWORD PTR [rbp-80]
+test rcx, rcx
+je _start.loopout2
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.loopin2
+_start.loopout2:
+dec QWORD PTR [rbp-72]
+push QWORD PTR [rbp-56]
+pop r8
+mov QWORD PTR [rbp-80], r8
+.p2align 4
+_start.unroll3:
+cmp QWORD PTR [rbp-80], 4
+jl _start.loopin3
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.unroll3
+_start.loopin3:
+mov rcx, QWORD PTR [rbp-80]
+test rcx, rcx
+je _start.loopout3
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.loopin3
+_start.loopout3:
+dec QWORD PTR [rbp-72]
+push QWORD PTR [rbp-56]
+pop r8
+mov QWORD PTR [rbp-80], r8
+.p2align 4
+_start.unroll4:
+cmp QWORD PTR [rbp-80], 4
+jl _start.loopin4
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.unroll4
+_start.loopin4:
+mov rcx, QWORD PTR [rbp-80]
+test rcx, rcx
+je _start.unroll0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.loopin4
+_start.loopout4:
+jmp _start.unroll0
+_start.loopin0:
+mov rcx, QWORD PTR [rbp-72]
+test rcx, rcx
+je _start.loopout0
+dec QWORD PTR [rbp-72]
+push QWORD PTR [rbp-56]
+pop r8
+mov QWORD PTR [rbp-80], r8
+.p2align 4
+_start.unroll5:
+cmp QWORD PTR [rbp-80], 4
+jl _start.loopin5
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.unroll5
+_start.loopin5:
+mov rcx, QWORD PTR [rbp-80]
+test rcx, rcx
+je _start.loopin0
+dec QWORD PTR [rbp-80]
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-24]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-32]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+cmp rcx, QWORD PTR [rbp-40]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-48]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+mulsd xmm0, xmm1
+movq r8, xmm0
+push r8
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+movaps xmm1, xmm0
+pop r8
+movq xmm0, r8
+subsd xmm0, xmm1
+mov rcx, QWORD PTR [rbp-80]
+mov r11, QWORD PTR [rbp-64]
+movsd QWORD PTR [r11+rcx*8], xmm0
+jmp _start.loopin5
+_start.loopout5:
+jmp _start.loopin0
+_start.loopout0:
+mov rcx, 0
+cmp rcx, QWORD PTR [rbp-56]
+jae lpc_out_of_range
+mov r11, QWORD PTR [rbp-64]
+movsd xmm0, QWORD PTR [r11+rcx*8]
+lea rdi, [lpc_stdout]
+call lpc_write_telo
+lea rdi, [lpc_stdout]
+lea rsi, [lpc_linjaaf63c74c8601c8dd]
+mov edx, 1
+call lpc_write
+mov rdi, 0
+call lpc_flush_all
+mov rax, 60
+syscall
+mov rdi, 0
+call lpc_flush_all
+mov rax, 60
+syscall
+.set _start.frame, 80
+lpc_write:
+mov rax, [rdi]
+lea rcx, [rax+rdx]
+cmp rcx, 65536
+jbe lpc_write.copy
+push rsi
+push rdx
+call lpc_flush
+pop rdx
+pop rsi
+xor eax, eax
+cmp rdx, 65536
+jbe lpc_write.copy
+push rdi
+mov rdi, [rdi+8]
+call lpc_write_all
+pop rdi
+ret
+lpc_write.copy:
+lea rcx, [rax+rdx]
+mov [rdi], rcx
+push rdi
+lea rdi, [rdi+rax+16]
+mov rcx, rdx
+rep movsb
+pop rdi
+ret
+lpc_write_all:
+test rdx, rdx
+jz lpc_write_all.done
+mov eax, 1
+syscall
+cmp rax, -4
+je lpc_write_all
+test rax, rax
+jle lpc_write_all.done
+add rsi, rax
+sub rdx, rax
+jmp lpc_write_all
+lpc_write_all.done:
+ret
+lpc_flush:
+push rdi
+lea rsi, [rdi+16]
+mov rdx, [rdi]
+mov QWORD PTR [rdi], 0
+mov rdi, [rdi+8]
+call lpc_write_all
+pop rdi
+ret
+lpc_flush_all:
+push rdi
+lea rdi, [lpc_stdout]
+call lpc_flush
+lea rdi, [lpc_stderr]
+call lpc_flush
+pop rdi
+ret
+lpc_digits:
+mov rcx, 0xcccccccccccccccd
+lpc_digits.next:
+mov r11, rax
+mul rcx
+shr rdx, 3
+mov rax, rdx
+lea rdx, [rdx+rdx*4]
+add rdx, rdx
+sub r11, rdx
+add r11d, 48
+dec rsi
+mov [rsi], r11b
+test rax, rax
+jnz lpc_digits.next
+ret
+lpc_write_signed:
+sub rsp, 32
+lea rsi, [rsp+32]
+mov r10, rax
+test rax, rax
+jns lpc_write_signed.digits
+neg rax
+lpc_write_signed.digits:
+call lpc_digits
+test r10, r10
+jns lpc_write_signed.write
+dec rsi
+mov BYTE PTR [rsi], 45
+lpc_write_signed.write:
+lea rdx, [rsp+32]
+sub rdx, rsi
+call lpc_write
+add rsp, 32
+ret
+lpc_write_unsigned:
+sub rsp, 32
+lea rsi, [rsp+32]
+call lpc_digits
+lea rdx, [rsp+32]
+sub rdx, rsi
+call lpc_write
+add rsp, 32
+ret
+lpc_write_telo:
+sub rsp, 64
+movq rax, xmm0
+mov r10, rax
+btr rax, 63
+movq xmm0, rax
+lea r9, [rsp+32]
+mov rcx, 0x7ff0000000000000
+cmp rax, rcx
+jb lpc_write_telo.finite
+mov ecx, 0x666e69
+je lpc_write_telo.special
+mov ecx, 0x6e616e
+lpc_write_telo.special:
+mov [r9], ecx
+lea r8, [r9+3]
+mov rsi, r9
+jmp lpc_write_telo.sign
+lpc_write_telo.finite:
+mov QWORD PTR [rsp+56], 0
+mov rax, 0x43abc16d674ec800
+movq xmm1, rax
+ucomisd xmm0, xmm1
+jb lpc_write_telo.fixed
+mov rax, 0x4024000000000000
+movq xmm1, rax
+lpc_write_telo.scale:
+divsd xmm0, xmm1
+inc QWORD PTR [rsp+56]
+ucomisd xmm0, xmm1
+jae lpc_write_telo.scale
+lpc_write_telo.fixed:
+cvttsd2si rax, xmm0
+cvtsi2sd xmm1, rax
+subsd xmm0, xmm1
+mov rcx, 0x412e848000000000
+movq xmm1, rcx
+mulsd xmm0, xmm1
+cvtsd2si rcx, xmm0
+cmp rcx, 1000000
+jb lpc_write_telo.decimals
+sub rcx, 1000000
+inc rax
+lpc_write_telo.decimals:
+mov [rsp+48], rax
+mov BYTE PTR [r9], 46
+mov DWORD PTR [r9+1], 0x30303030
+mov WORD PTR [r9+5], 0x3030
+mov rax, rcx
+lea rsi, [r9+7]
+call lpc_digits
+lea r8, [r9+7]
+mov rax, [rsp+56]
+test rax, rax
+jz lpc_write_telo.integer
+mov WORD PTR [r8], 0x2b65
+add r8, 4
+cmp rax, 100
+jb lpc_write_telo.exponent
+inc r8
+lpc_write_telo.exponent:
+mov rsi, r8
+call lpc_digits
+lpc_write_telo.integer:
+mov rax, [rsp+48]
+mov rsi, r9
+call lpc_digits
+lpc_write_telo.sign:
+test r10, r10
+jns lpc_write_telo.write
+dec rsi
+mov BYTE PTR [rsi], 45
+lpc_write_telo.write:
+mov rdx, r8
+sub rdx, rsi
+call lpc_write
+add rsp, 64
+ret
+lpc_read_file:
+push rbp
+mov rbp, rsp
+sub rsp, 4272
+cmp rdx, 4095
+ja lpc_read_file.fail
+mov rdi, rsp
+mov rcx, rdx
+rep movsb
+mov BYTE PTR [rdi], 0
+mov eax, 2
+mov rdi, rsp
+xor esi, esi
+syscall
+test rax, rax
+js lpc_read_file.fail
+mov r8, rax
+mov eax, 5
+mov rdi, r8
+lea rsi, [rsp+4096]
+syscall
+mov QWORD PTR [rbp-8], 0
+mov QWORD PTR [rbp-16], 0
+test rax, rax
+js lpc_read_file.close
+mov rsi, [rsp+4144]
+test rsi, rsi
+jle lpc_read_file.close
+mov [rbp-16], rsi
+mov eax, 9
+xor edi, edi
+mov edx, 1
+mov r10d, 2
+xor r9d, r9d
+syscall
+cmp rax, -4096
+ja lpc_read_file.unmapped
+mov [rbp-8], rax
+jmp lpc_read_file.close
+lpc_read_file.unmapped:
+mov QWORD PTR [rbp-16], 0
+lpc_read_file.close:
+mov eax, 3
+mov rdi, r8
+syscall
+mov rax, [rbp-8]
+mov rdx, [rbp-16]
+leave
+ret
+lpc_read_file.fail:
+xor eax, eax
+xor edx, edx
+leave
+ret
+lpc_alloc:
+test rdi, rdi
+js lpc_out_of_range
+mov rax, rdi
+mul rsi
+jo lpc_out_of_memory
+push rdi
+mov rsi, rax
+test rsi, rsi
+jnz lpc_alloc.sized
+mov esi, 1
+lpc_alloc.sized:
+mov eax, 9
+xor edi, edi
+mov edx, 3
+mov r10d, 34
+mov r8, -1
+xor r9d, r9d
+syscall
+pop rdi
+cmp rax, -4096
+ja lpc_out_of_memory
+ret
+lpc_out_of_range:
+lea rsi, [lpc_linja370bfe7393f02d91]
+mov edx, 19
+jmp lpc_fail
+lpc_out_of_memory:
+lea rsi, [lpc_linja74a4acaa69d1346b]
+mov edx, 14
+lpc_fail:
+lea rdi, [lpc_stderr]
+call lpc_write
+mov edi, 1
+call lpc_flush_all
+mov eax, 60
+syscall
+.section .rodata
+.p2align 3
+.quad 1
+lpc_linjaaf63c74c8601c8dd:
+.byte 10
+.byte 0
+.p2align 3
+.quad 14
+lpc_linja74a4acaa69d1346b:
+.ascii "out of memory"
+.byte 10
+.byte 0
+.p2align 3
+.quad 19
+lpc_linja370bfe7393f02d91:
+.ascii "index out of range"
+.byte 10
+.byte 0
+.bss
+.p2align 3
+lpc_stdout:
+.zero 65552
+.p2align 3
+lpc_stderr:
+.zero 65552
@@ -0,0 +1,691 @@
+%use smartalign
+alignmode p6
+global _start
+_start:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov qword [rel lpc_stdout+8], 1
+    mov qword [rel lpc_stderr+8], 2
+    mov qword [rbp-8], 1000
+    mov rdi, qword [rbp-8]
+    mov esi, 8
+    call lpc_alloc
+    mov qword [rbp-32], rax
+    mov qword [rbp-24], rdi
+    mov r8, 0x3ff8000000000000 ; 1.5
+    movq xmm0, r8
+    movq rax, xmm0
+    mov rdi, qword [rbp-32]
+    mov rcx, qword [rbp-24]
+    rep stosq
+    mov rdi, qword [rbp-8]
+    mov esi, 8
+    call lpc_alloc
+    mov qword [rbp-48], rax
+    mov qword [rbp-40], rdi
+    mov r8, 0x4004000000000000 ; 2.5
+    movq xmm0, r8
+    movq rax, xmm0
+    mov rdi, qword [rbp-48]
+    mov rcx, qword [rbp-40]
+    rep stosq
+    mov rdi, qword [rbp-8]
+    mov esi, 8
+    call lpc_alloc
+    mov qword [rbp-64], rax
+    mov qword [rbp-56], rdi
+    mov r8, 0x3fe0000000000000 ; 0.5
+    movq xmm0, r8
+    movq rax, xmm0
+    mov rdi, qword [rbp-64]
+    mov rcx, qword [rbp-56]
+    rep stosq
+    mov qword [rbp-72], 100000
+    mov qword [rbp-80], 0
+.unroll0:
+    cmp qword [rbp-72], 4
+    jl .loopin0
+    dec qword [rbp-72]
+    push qword [rbp-56]
+    pop r8
+    mov qword [rbp-80], r8
+    align 16
+.vector1:
+    cmp qword [rbp-80], 2
+    jl .vectorout1
+    mov rcx, qword [rbp-80]
+    sub rcx, 2
+    mov qword [rbp-80], rcx
+    lea rdx, [rcx+1]
+    cmp rdx, qword [rbp-24]
+    jae lpc_out_of_range
+    cmp rdx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movupd xmm0, [r11+rcx*8]
+    mov r11, qword [rbp-48]
+    movupd xmm1, [r11+rcx*8]
+    mulpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd xmm1, [r11+rcx*8]
+    subpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd [r11+rcx*8], xmm0
+    jmp .vector1
+.vectorout1:
+.loopin1:
+    mov rcx, qword [rbp-80]
+    test rcx, rcx
+    je .loopout1
+    dec qword [rbp-80]
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-24]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movsd xmm0, qword [r11+rcx*8]
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-48]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    mulsd xmm0, xmm1
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    subsd xmm0, xmm1
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd qword [r11+rcx*8], xmm0
+    jmp .loopin1
+.loopout1:
+    dec qword [rbp-72]
+    push qword [rbp-56]
+    pop r8
+    mov qword [rbp-80], r8
+    align 16
+.vector2:
+    cmp qword [rbp-80], 2
+    jl .vectorout2
+    mov rcx, qword [rbp-80]
+    sub rcx, 2
+    mov qword [rbp-80], rcx
+    lea rdx, [rcx+1]
+    cmp rdx, qword [rbp-24]
+    jae lpc_out_of_range
+    cmp rdx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movupd xmm0, [r11+rcx*8]
+    mov r11, qword [rbp-48]
+    movupd xmm1, [r11+rcx*8]
+    mulpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd xmm1, [r11+rcx*8]
+    subpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd [r11+rcx*8], xmm0
+    jmp .vector2
+.vectorout2:
+.loopin2:
+    mov rcx, qword [rbp-80]
+    test rcx, rcx
+    je .loopout2
+    dec qword [rbp-80]
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-24]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movsd xmm0, qword [r11+rcx*8]
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-48]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    mulsd xmm0, xmm1
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    subsd xmm0, xmm1
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd qword [r11+rcx*8], xmm0
+    jmp .loopin2
+.loopout2:
+    dec qword [rbp-72]
+    push qword [rbp-56]
+    pop r8
+    mov qword [rbp-80], r8
+    align 16
+.vector3:
+    cmp qword [rbp-80], 2
+    jl .vectorout3
+    mov rcx, qword [rbp-80]
+    sub rcx, 2
+    mov qword [rbp-80], rcx
+    lea rdx, [rcx+1]
+    cmp rdx, qword [rbp-24]
+    jae lpc_out_of_range
+    cmp rdx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movupd xmm0, [r11+rcx*8]
+    mov r11, qword [rbp-48]
+    movupd xmm1, [r11+rcx*8]
+    mulpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd xmm1, [r11+rcx*8]
+    subpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd [r11+rcx*8], xmm0
+    jmp .vector3
+.vectorout3:
+.loopin3:
+    mov rcx, qword [rbp-80]
+    test rcx, rcx
+    je .loopout3
+    dec qword [rbp-80]
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-24]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movsd xmm0, qword [r11+rcx*8]
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-48]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    mulsd xmm0, xmm1
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    subsd xmm0, xmm1
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd qword [r11+rcx*8], xmm0
+    jmp .loopin3
+.loopout3:
+    dec qword [rbp-72]
+    push qword [rbp-56]
+    pop r8
+    mov qword [rbp-80], r8
+    align 16
+.vector4:
+    cmp qword [rbp-80], 2
+    jl .vectorout4
+    mov rcx, qword [rbp-80]
+    sub rcx, 2
+    mov qword [rbp-80], rcx
+    lea rdx, [rcx+1]
+    cmp rdx, qword [rbp-24]
+    jae lpc_out_of_range
+    cmp rdx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movupd xmm0, [r11+rcx*8]
+    mov r11, qword [rbp-48]
+    movupd xmm1, [r11+rcx*8]
+    mulpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd xmm1, [r11+rcx*8]
+    subpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd [r11+rcx*8], xmm0
+    jmp .vector4
+.vectorout4:
+.loopin4:
+    mov rcx, qword [rbp-80]
+    test rcx, rcx
+    je .unroll0
+    dec qword [rbp-80]
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-24]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movsd xmm0, qword [r11+rcx*8]
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-48]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    mulsd xmm0, xmm1
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    subsd xmm0, xmm1
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd qword [r11+rcx*8], xmm0
+    jmp .loopin4
+.loopout4:
+    jmp .unroll0
+.loopin0:
+    mov rcx, qword [rbp-72]
+    test rcx, rcx
+    je .loopout0
+    dec qword [rbp-72]
+    push qword [rbp-56]
+    pop r8
+    mov qword [rbp-80], r8
+    align 16
+.vector5:
+    cmp qword [rbp-80], 2
+    jl .vectorout5
+    mov rcx, qword [rbp-80]
+    sub rcx, 2
+    mov qword [rbp-80], rcx
+    lea rdx, [rcx+1]
+    cmp rdx, qword [rbp-24]
+    jae lpc_out_of_range
+    cmp rdx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movupd xmm0, [r11+rcx*8]
+    mov r11, qword [rbp-48]
+    movupd xmm1, [r11+rcx*8]
+    mulpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd xmm1, [r11+rcx*8]
+    subpd xmm0, xmm1
+    mov r11, qword [rbp-64]
+    movupd [r11+rcx*8], xmm0
+    jmp .vector5
+.vectorout5:
+.loopin5:
+    mov rcx, qword [rbp-80]
+    test rcx, rcx
+    je .loopin0
+    dec qword [rbp-80]
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-24]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-32]
+    movsd xmm0, qword [r11+rcx*8]
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    cmp rcx, qword [rbp-40]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-48]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    mulsd xmm0, xmm1
+    movq r8, xmm0
+    push r8
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd xmm0, qword [r11+rcx*8]
+    movaps xmm1, xmm0
+    pop r8
+    movq xmm0, r8
+    subsd xmm0, xmm1
+    mov rcx, qword [rbp-80]
+    mov r11, qword [rbp-64]
+    movsd qword [r11+rcx*8], xmm0
+    jmp .loopin5
+.loopout5:
+    jmp .loopin0
+.loopout0:
+    mov rcx, 0
+    cmp rcx, qword [rbp-56]
+    jae lpc_out_of_range
+    mov r11, qword [rbp-64]
+    movsd xmm0, qword [r11+rcx*8]
+    lea rdi, [rel lpc_stdout]
+    call lpc_write_telo
+    lea rdi, [rel lpc_stdout]
+    lea rsi, [rel lpc_linjaaf63c74c8601c8dd]
+    mov edx, 1
+    call lpc_write
+    mov rdi, 0
+    call lpc_flush_all
+    mov rax, 60
+    syscall
+    mov rdi, 0
+    call lpc_flush_all
+    mov rax, 60
+    syscall
+.frame equ 80
+
+lpc_write:
+    mov rax, [rdi]
+    lea rcx, [rax+rdx]
+    cmp rcx, 65536
+    jbe .copy
+    push rsi
+    push rdx
+    call lpc_flush
+    pop rdx
+    pop rsi
+    xor eax, eax
+    cmp rdx, 65536
+    jbe .copy
+    push rdi
+    mov rdi, [rdi+8]
+    call lpc_write_all
+    pop rdi
+    ret
+.copy:
+    lea rcx, [rax+rdx]
+    mov [rdi], rcx
+    push rdi
+    lea rdi, [rdi+rax+16]
+    mov rcx, rdx
+    rep movsb
+    pop rdi
+    ret
+
+lpc_write_all:
+    test rdx, rdx
+    jz .done
+    mov eax, 1
+    syscall
+    cmp rax, -4
+    je lpc_write_all
+    test rax, rax
+    jle .done
+    add rsi, rax
+    sub rdx, rax
+    jmp lpc_write_all
+.done:
+    ret
+
+lpc_flush:
+    push rdi
+    lea rsi, [rdi+16]
+    mov rdx, [rdi]
+    mov qword [rdi], 0
+    mov rdi, [rdi+8]
+    call lpc_write_all
+    pop rdi
+    ret
+
+lpc_flush_all:
+    push rdi
+    lea rdi, [rel lpc_stdout]
+    call lpc_flush
+    lea rdi, [rel lpc_stderr]
+    call lpc_flush
+    pop rdi
+    ret
+
+lpc_digits:
+    mov rcx, 0xcccccccccccccccd
+.next:
+    mov r11, rax
+    mul rcx
+    shr rdx, 3
+    mov rax, rdx
+    lea rdx, [rdx+rdx*4]
+    add rdx, rdx
+    sub r11, rdx
+    add r11d, 48
+    dec rsi
+    mov [rsi], r11b
+    test rax, rax
+    jnz .next
+    ret
+
+lpc_write_signed:
+    sub rsp, 32
+    lea rsi, [rsp+32]
+    mov r10, rax
+    test rax, rax
+    jns .digits
+    neg rax
+.digits:
+    call lpc_digits
+    test r10, r10
+    jns .write
+    dec rsi
+    mov byte [rsi], 45
+.write:
+    lea rdx, [rsp+32]
+    sub rdx, rsi
+    call lpc_write
+    add rsp, 32
+    ret
+
+lpc_write_unsigned:
+    sub rsp, 32
+    lea rsi, [rsp+32]
+    call lpc_digits
+    lea rdx, [rsp+32]
+    sub rdx, rsi
+    call lpc_write
+    add rsp, 32
+    ret
+
+lpc_write_telo:
+    sub rsp, 64
+    movq rax, xmm0
+    mov r10, rax
+    btr rax, 63
+    movq xmm0, rax
+    lea r9, [rsp+32]
+    mov rcx, 0x7ff0000000000000
+    cmp rax, rcx
+    jb .finite
+    mov ecx, 0x666e69
+    je .special
+    mov ecx, 0x6e616e
+.special:
+    mov [r9], ecx
+    lea r8, [r9+3]
+    mov rsi, r9
+    jmp .sign
+.finite:
+    mov qword [rsp+56], 0
+    mov rax, 0x43abc16d674ec800 ; 1e18
+    movq xmm1, rax
+    ucomisd xmm0, xmm1
+    jb .fixed
+    mov rax, 0x4024000000000000 ; 10
+    movq xmm1, rax
+.scale:
+    divsd xmm0, xmm1
+    inc qword [rsp+56]
+    ucomisd xmm0, xmm1
+    jae .scale
+.fixed:
+    cvttsd2si rax, xmm0
+    cvtsi2sd xmm1, rax
+    subsd xmm0, xmm1
+    mov rcx, 0x412e848000000000 ; 1e6
+    movq xmm1, rcx
+    mulsd xmm0, xmm1
+    cvtsd2si rcx, xmm0
+    cmp rcx, 1000000
+    jb .decimals
+    sub rcx, 1000000
+    inc rax
+.decimals:
+    mov [rsp+48], rax
+    mov byte [r9], 46
+    mov dword [r9+1], 0x30303030
+    mov word [r9+5], 0x3030
+    mov rax, rcx
+    lea rsi, [r9+7]
+    call lpc_digits
+    lea r8, [r9+7]
+    mov rax, [rsp+56]
+    test rax, rax
+    jz .integer
+    mov word [r8], 0x2b65
+    add r8, 4
+    cmp rax, 100
+    jb .exponent
+    inc r8
+.exponent:
+    mov rsi, r8
+    call lpc_digits
+.integer:
+    mov rax, [rsp+48]
+    mov rsi, r9
+    call lpc_digits
+.sign:
+    test r10, r10
+    jns .write
+    dec rsi
+    mov byte [rsi], 45
+.write:
+    mov rdx, r8
+    sub rdx, rsi
+    call lpc_write
+    add rsp, 64
+    ret
+
+lpc_read_file:
+    push rbp
+    mov rbp, rsp
+    sub rsp, 4272
+    cmp rdx, 4095
+    ja .fail
+    mov rdi, rsp
+    mov rcx, rdx
+    rep movsb
+    mov byte [rdi], 0
+    mov eax, 2
+    mov rdi, rsp
+    xor esi, esi
+    syscall
+    test rax, rax
+    js .fail
+    mov r8, rax
+    mov eax, 5
+    mov rdi, r8
+    lea rsi, [rsp+4096]
+    syscall
+    mov qword [rbp-8], 0
+    mov qword [rbp-16], 0
+    test rax, rax
+    js .close
+    mov rsi, [rsp+4144]
+    test rsi, rsi
+    jle .close
+    mov [rbp-16], rsi
+    mov eax, 9
+    xor edi, edi
+    mov edx, 1
+    mov r10d, 2
+    xor r9d, r9d
+    syscall
+    cmp rax, -4096
+    ja .unmapped
+    mov [rbp-8], rax
+    jmp .close
+.unmapped:
+    mov qword [rbp-16], 0
+.close:
+    mov eax, 3
+    mov rdi, r8
+    syscall
+    mov rax, [rbp-8]
+    mov rdx, [rbp-16]
+    leave
+    ret
+.fail:
+    xor eax, eax
+    xor edx, edx
+    leave
+    ret
+
+lpc_alloc:
+    test rdi, rdi
+    js lpc_out_of_range
+    mov rax, rdi
+    mul rsi
+    jo lpc_out_of_memory
+    push rdi
+    mov rsi, rax
+    test rsi, rsi
+    jnz .sized
+    mov esi, 1
+.sized:
+    mov eax, 9
+    xor edi, edi
+    mov edx, 3
+    mov r10d, 34
+    mov r8, -1
+    xor r9d, r9d
+    syscall
+    pop rdi
+    cmp rax, -4096
+    ja lpc_out_of_memory
+    ret
+
+lpc_out_of_range:
+    lea rsi, [rel lpc_linja370bfe7393f02d91]
+    mov edx, 19
+    jmp lpc_fail
+
+lpc_out_of_memory:
+    lea rsi, [rel lpc_linja74a4acaa69d1346b]
+    mov edx, 14
+
+lpc_fail:
+    lea rdi, [rel lpc_stderr]
+    call lpc_write
+    mov edi, 1
+    call lpc_flush_all
+    mov eax, 60
+    syscall
+
+section .rodata
+    align 8
+    dq 1
+lpc_linjaaf63c74c8601c8dd: db 10, 0
+    align 8
+    dq 14
+lpc_linja74a4acaa69d1346b: db "out of memory", 10, 0
+    align 8
+    dq 19
+lpc_linja370bfe7393f02d91: db "index out of range", 10, 0
+
+section .bss
+    align 8
+lpc_stdout: resb 65552
+    align 8
+lpc_stderr: resb 65552
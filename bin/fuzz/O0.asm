@@ -0,0 +1,56 @@
+global _start
+_start:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov r8, 97
+    mov rax, r8
+    sar rax, 63
+    shr rax, 62
+    add rax, r8
+    sar rax, 2
+    shl rax, 2
+    sub r8, rax
+    mov qword [rbp-8], r8
+    push qword [rbp-8]
+    push qword [rbp-8]
+    push qword [rbp-8]
+    call pali_p0
+    add rsp, 16
+    push rax
+    call pali_p0
+    add rsp, 16
+    push rax
+    pop r8
+    add r8, qword [rbp-8]
+    push r8
+    mov r8, 7
+    imul r8, qword [rbp-8]
+    push r8
+    pop r9
+    pop r8
+    sub r8, r9
+    mov qword [rbp-8], r8
+    mov rdi, 0
+    mov rax, 60
+    syscall
+.frame equ 8
+
+pali_p0:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov qword [rbp-8], 0
+    mov qword [rbp-8], 6
+.loopin0:
+    cmp qword [rbp-8], 0
+    je .loopout0
+    mov r8, qword [rbp-8]
+    sub r8, 1
+    mov qword [rbp-8], r8
+    jmp .loopin0
+.loopout0:
+    mov rax, 0
+    leave
+    ret
+.frame equ 8
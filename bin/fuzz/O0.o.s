@@ -0,0 +1,56 @@
+.intel_syntax noprefix
+.globl _start
+_start:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET _start.frame
+mov r8, 97
+mov rax, r8
+sar rax, 63
+shr rax, 62
+add rax, r8
+sar rax, 2
+shl rax, 2
+sub r8, rax
+mov QWORD PTR [rbp-8], r8
+push QWORD PTR [rbp-8]
+push QWORD PTR [rbp-8]
+push QWORD PTR [rbp-8]
+call pali_p0
+add rsp, 16
+push rax
+call pali_p0
+add rsp, 16
+push rax
+pop r8
+add r8, QWORD PTR [rbp-8]
+push r8
+mov r8, 7
+imul r8, QWORD PTR [rbp-8]
+push r8
+pop r9
+pop r8
+sub r8, r9
+mov QWORD PTR [rbp-8], r8
+mov rdi, 0
+mov rax, 60
+syscall
+.set _start.frame, 8
+pali_p0:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET pali_p0.frame
+mov QWORD PTR [rbp-8], 0
+mov QWORD PTR [rbp-8], 6
+pali_p0.loopin0:
+cmp QWORD PTR [rbp-8], 0
+je pali_p0.loopout0
+mov r8, QWORD PTR [rbp-8]
+sub r8, 1
+mov QWORD PTR [rbp-8], r8
+jmp pali_p0.loopin0
+pali_p0.loopout0:
+mov rax, 0
+leave
+ret
+.set pali_p0.frame, 8
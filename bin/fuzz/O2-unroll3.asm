@@ -0,0 +1,69 @@
+%use smartalign
+alignmode p6
+global _start
+_start:
+    push rbp
+    mov rbp, rsp
+    sub rsp, .frame
+    mov qword [rbp-8], 1
+    push qword [rbp-8]
+    push qword [rbp-8]
+    push qword [rbp-8]
+    pop qword [rbp-24]
+    pop qword [rbp-16]
+    ;; inlined pali p0
+    mov qword [rbp-32], 0
+    mov qword [rbp-32], 6
+    align 16
+.unroll0:
+    cmp qword [rbp-32], 3
+    jl .loopin0
+    dec qword [rbp-32]
+    dec qword [rbp-32]
+    dec qword [rbp-32]
+    jmp .unroll0
+.loopin0:
+    cmp qword [rbp-32], 0
+    je .loopout0
+    dec qword [rbp-32]
+    jmp .loopin0
+.loopout0:
+    mov rax, 0
+.inlineout0:
+    push rax
+    pop qword [rbp-24]
+    pop qword [rbp-16]
+    ;; inlined pali p0
+    mov qword [rbp-32], 0
+    mov qword [rbp-32], 6
+    align 16
+.unroll1:
+    cmp qword [rbp-32], 3
+    jl .loopin1
+    dec qword [rbp-32]
+    dec qword [rbp-32]
+    dec qword [rbp-32]
+    jmp .unroll1
+.loopin1:
+    cmp qword [rbp-32], 0
+    je .loopout1
+    dec qword [rbp-32]
+    jmp .loopin1
+.loopout1:
+    mov rax, 0
+.inlineout1:
+    push rax
+    pop r8
+    add r8, qword [rbp-8]
+    push r8
+    mov r8, 7
+    imul r8, qword [rbp-8]
+    push r8
+    pop r9
+    pop r8
+    sub r8, r9
+    mov qword [rbp-8], r8
+    mov rdi, 0
+    mov rax, 60
+    syscall
+.frame equ 32
@@ -0,0 +1,66 @@
+.intel_syntax noprefix
+.globl _start
+_start:
+push rbp
+mov rbp, rsp
+sub rsp, OFFSET _start.frame
+mov QWORD PTR [rbp-8], 1
+push QWORD PTR [rbp-8]
+push QWORD PTR [rbp-8]
+push QWORD PTR [rbp-8]
+pop QWORD PTR [rbp-24]
+pop QWORD PTR [rbp-16]
+mov QWORD PTR [rbp-32], 0
+mov QWORD PTR [rbp-32], 6
+.p2align 4
+_start.unroll0:
+cmp QWORD PTR [rbp-32], 3
+jl _start.loopin0
+dec QWORD PTR [rbp-32]
+dec QWORD PTR [rbp-32]
+dec QWORD PTR [rbp-32]
+jmp _start.unroll0
+_start.loopin0:
+cmp QWORD PTR [rbp-32], 0
+je _start.loopout0
+dec QWORD PTR [rbp-32]
+jmp _start.loopin0
+_start.loopout0:
+mov rax, 0
+_start.inlineout0:
+push rax
+pop QWORD PTR [rbp-24]
+pop QWORD PTR [rbp-16]
+mov QWORD PTR [rbp-32], 0
+mov QWORD PTR [rbp-32], 6
+.p2align 4
+_start.unroll1:
+cmp QWORD PTR [rbp-32], 3
+jl _start.loopin1
+dec QWORD PTR [rbp-32]
+dec QWORD PTR [rbp-32]
+dec QWORD PTR [rbp-32]
+jmp _start.unroll1
+_start.loopin1:
+cmp QWORD PTR [rbp-32], 0
+je _start.loopout1
+dec QWORD PTR [rbp-32]
+jmp _start.loopin1
+_start.loopout1:
+mov rax, 0
+_start.inlineout1:
+push rax
+pop r8
+add r8, QWORD PTR [rbp-8]
+push r8
+mov r8, 7
+imul r8, QWORD PTR [rbp-8]
+push r8
+pop r9
+pop r8
+sub r8, r9
+mov QWORD PTR [rbp-8], r8
+mov rdi, 0
+mov rax, 60
+syscall
+.set _start.frame, 32
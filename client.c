@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Sends a single compile request to a running `main --server` and writes the
+// answer to stdout, or the error messages to stderr. With -e it sends an edit
+// of the file instead, the way an editor would on every change.
+
+void usage(char *program) {
+      fprintf(stderr, "Usage: %s [-c] <socket> <file.ln> [options]\n"
+              "       %s -e <socket> <file.ln> <offset> <deleted> [text]\n"
+              "    -c    ask for an object file instead of assembly\n"
+              "    -e    replace deleted bytes at offset with text in the server's copy\n", program, program);
+      exit(1);
+}
+
+void copy(int server, size_t remaining, FILE *to) {
+      char buffer[4096];
+      while (remaining > 0) {
+            ssize_t n = read(server, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer));
+            if (n <= 0) break;
+            fwrite(buffer, 1, n, to);
+            remaining -= n;
+      }
+}
+
+int main(int argc, char **argv) {
+      int arg = 1;
+      bool object = false;
+      bool edit = false;
+      if (arg < argc && !strcmp(argv[arg], "-c")) {
+            object = true;
+            arg++;
+      } else if (arg < argc && !strcmp(argv[arg], "-e")) {
+            edit = true;
+            arg++;
+      }
+      if (argc - arg < (edit ? 4 : 2)) usage(argv[0]);
+      char *socketPath = argv[arg++];
+
+      char path[PATH_MAX];
+      if (!realpath(argv[arg++], path)) {
+            fprintf(stderr, "Unable to find %s\n", argv[arg - 1]);
+            exit(1);
+      }
+
+      char request[8192];
+      int length;
+      if (edit) {
+            char *text = arg + 2 < argc ? argv[arg + 2] : "";
+            length = snprintf(request, sizeof(request), "edit %s %s %s %zu\n%s",
+                              path, argv[arg], argv[arg + 1], strlen(text), text);
+      } else {
+            length = snprintf(request, sizeof(request), "%s %s", object ? "obj" : "asm", path);
+            // The server has its own working directory, so the files options
+            // name are made absolute here. The one --instrument names doesn't
+            // have to exist yet.
+            char cwd[PATH_MAX];
+            if (!getcwd(cwd, sizeof(cwd))) cwd[0] = 0;
+            for (; arg < argc; arg++) {
+                  bool file = arg > 0 && (!strcmp(argv[arg - 1], "--profile-use") || !strcmp(argv[arg - 1], "--instrument"));
+                  if (file && argv[arg][0] != '/') {
+                        length += snprintf(request + length, sizeof(request) - length, " %s/%s", cwd, argv[arg]);
+                  } else {
+                        length += snprintf(request + length, sizeof(request) - length, " %s", argv[arg]);
+                  }
+            }
+            if (length < (int)sizeof(request) - 1) request[length++] = '\n';
+      }
+      if (length >= (int)sizeof(request) - 1) {
+            fprintf(stderr, "Request too long\n");
+            exit(1);
+      }
+
+      int server = socket(AF_UNIX, SOCK_STREAM, 0);
+      struct sockaddr_un address = {.sun_family = AF_UNIX};
+      strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+      if (server < 0 || connect(server, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            fprintf(stderr, "Unable to connect to %s\n", socketPath);
+            exit(1);
+      }
+      if (write(server, request, length) != length) {
+            fprintf(stderr, "Unable to send request\n");
+            exit(1);
+      }
+
+      char header[64];
+      size_t headerLength = 0;
+      while (headerLength < sizeof(header) - 1) {
+            if (read(server, header + headerLength, 1) <= 0) break;
+            if (header[headerLength] == '\n') break;
+            headerLength++;
+      }
+      header[headerLength] = 0;
+
+      bool ok = !strncmp(header, "ok ", 3);
+      if (!ok && strncmp(header, "error ", 6)) {
+            fprintf(stderr, "Bad answer from server\n");
+            exit(1);
+      }
+      // The output, then what the compile printed to stderr
+      char *end;
+      size_t outputLength = strtoul(strchr(header, ' ') + 1, &end, 10);
+      size_t messagesLength = strtoul(end, NULL, 10);
+      copy(server, outputLength, ok ? stdout : stderr);
+      copy(server, messagesLength, stderr);
+      close(server);
+      return ok ? 0 : 1;
+}
@@ -7,6 +7,18 @@
 #include <stdio.h>
 #include <math.h>
 #include <assert.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #ifdef DEBUG
 const int debug = 1;
@@ -14,6 +26,151 @@ const int debug = 1;
 const int debug = 0;
 #endif
 
+// Builds with -DLPC_TRACE time the recursive lexing, parsing and codegen
+// routines in scoped zones and write them when the compiler exits, to the
+// file in LPC_TRACE_FILE (default lpc-trace.json). The file is Chrome
+// trace-event JSON, or folded stacks for flamegraph.pl when its name ends in
+// .folded. Without LPC_TRACE the zones compile to nothing.
+#ifdef LPC_TRACE
+#include <time.h>
+
+#define TRACE_DEPTH_MAX 4096
+#define TRACE_THREADS_MAX 256
+
+typedef struct {
+      const char *name;
+      uint64_t start;
+      uint64_t duration;
+      uint32_t depth;
+} TraceEvent;
+
+// Events are appended when their zone ends, so a zone always comes after
+// the ones inside it
+typedef struct {
+      TraceEvent *events;
+      size_t size;
+      size_t capacity;
+      uint32_t tid;
+} TraceBuffer;
+
+typedef struct {
+      const char *name;
+      void *frame;
+} TraceOpen;
+
+typedef struct {
+      const char *name;
+      uint32_t depth;
+      uint64_t start;
+} TraceZone;
+
+TraceBuffer *traceBuffers[TRACE_THREADS_MAX];
+size_t traceThreads = 0;
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local TraceBuffer *traceBuffer = NULL;
+_Thread_local TraceOpen traceStack[TRACE_DEPTH_MAX];
+_Thread_local uint32_t traceDepth = 0;
+
+uint64_t traceNow() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void traceWriteJson(FILE *file) {
+      fprintf(file, "{\"traceEvents\":[");
+      bool first = true;
+      for (size_t t = 0; t < traceThreads; t++) {
+            TraceBuffer *buffer = traceBuffers[t];
+            for (size_t i = 0; i < buffer->size; i++) {
+                  TraceEvent event = buffer->events[i];
+                  fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                          first ? "" : ",", event.name, buffer->tid, event.start / 1000.0, event.duration / 1000.0);
+                  first = false;
+            }
+      }
+      fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+// One "outer;...;name self-ns" line per zone. The time of the zones inside
+// is summed going forward, and the names of the zones around each one are
+// known going backward, where every zone comes before the ones inside it.
+void traceWriteFolded(FILE *file) {
+      uint64_t *inner = calloc(TRACE_DEPTH_MAX + 1, sizeof(uint64_t));
+      const char **names = malloc(sizeof(char*)*TRACE_DEPTH_MAX);
+      for (size_t t = 0; t < traceThreads; t++) {
+            TraceBuffer *buffer = traceBuffers[t];
+            uint64_t *self = malloc(sizeof(uint64_t)*(buffer->size + 1));
+            memset(inner, 0, sizeof(uint64_t)*(TRACE_DEPTH_MAX + 1));
+            for (size_t i = 0; i < buffer->size; i++) {
+                  TraceEvent event = buffer->events[i];
+                  uint64_t children = inner[event.depth + 1];
+                  self[i] = event.duration > children ? event.duration - children : 0;
+                  inner[event.depth + 1] = 0;
+                  inner[event.depth] += event.duration;
+            }
+            for (size_t i = buffer->size; i > 0; i--) {
+                  TraceEvent event = buffer->events[i-1];
+                  names[event.depth] = event.name;
+                  fprintf(file, "thread %u", buffer->tid);
+                  for (uint32_t d = 0; d <= event.depth; d++) fprintf(file, ";%s", names[d]);
+                  fprintf(file, " %llu\n", (unsigned long long)self[i-1]);
+            }
+            free(self);
+      }
+      free(inner);
+      free(names);
+}
+
+void traceWrite() {
+      char *path = getenv("LPC_TRACE_FILE");
+      if (!path) path = "lpc-trace.json";
+      FILE *file = fopen(path, "w");
+      if (!file) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return;
+      }
+      size_t length = strlen(path);
+      if (length >= 7 && !strcmp(path + length - 7, ".folded")) traceWriteFolded(file);
+      else traceWriteJson(file);
+      fclose(file);
+}
+
+// A fail() or parse error longjmps past the ends of the zones it leaves.
+// Zones of frames below the one beginning can't be around it, so they are
+// dropped, and a zone ending drops whatever was left open inside it.
+TraceZone traceBegin(const char *name, void *frame) {
+      if (!traceBuffer) {
+            traceBuffer = calloc(1, sizeof(TraceBuffer));
+            pthread_mutex_lock(&traceLock);
+            if (traceThreads == 0) atexit(traceWrite);
+            traceBuffer->tid = traceThreads + 1;
+            if (traceThreads < TRACE_THREADS_MAX) traceBuffers[traceThreads++] = traceBuffer;
+            pthread_mutex_unlock(&traceLock);
+      }
+      while (traceDepth > 0 && (char*)traceStack[traceDepth-1].frame <= (char*)frame) traceDepth--;
+      if (traceDepth < TRACE_DEPTH_MAX) traceStack[traceDepth] = (TraceOpen){name, frame};
+      return (TraceZone){name, traceDepth++, traceNow()};
+}
+
+void traceEnd(TraceZone *zone) {
+      uint64_t end = traceNow();
+      traceDepth = zone->depth;
+      if (zone->depth >= TRACE_DEPTH_MAX) return;
+      TraceBuffer *buffer = traceBuffer;
+      if (buffer->size == buffer->capacity) {
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+            buffer->events = realloc(buffer->events, sizeof(TraceEvent)*buffer->capacity);
+      }
+      buffer->events[buffer->size++] = (TraceEvent){zone->name, zone->start, end - zone->start, zone->depth};
+}
+
+#define TRACE_ZONE(name) \
+      TraceZone traceZone __attribute__((cleanup(traceEnd))) = traceBegin(name, __builtin_frame_address(0))
+#else
+#define TRACE_ZONE(name)
+#endif
+
 #define TOKEN_NAME 0
 #define TOKEN_SEMI 1
 #define TOKEN_OPAREN 2
@@ -32,6 +189,12 @@ const int debug = 0;
 #define TOKEN_ASEN 15
 #define TOKEN_TENPO 16
 #define TOKEN_PINI 17
+#define TOKEN_PALI 18
+#define TOKEN_PI 19
+#define TOKEN_PANA 20
+#define TOKEN_DOT 21
+#define TOKEN_OBRACKET 22
+#define TOKEN_CBRACKET 23
 #define TOKEN_SIGNED 98
 #define TOKEN_UNSIGNED 99
 #define TOKEN_NANPA 100
@@ -50,6 +213,7 @@ const int debug = 0;
 #define TOKEN_MINUS 204
 #define TOKEN_STAR 205
 #define TOKEN_FSLASH 206
+#define TOKEN_PERCENT 207
 
 typedef enum {
       Undefined = 0, 
@@ -69,6 +233,7 @@ Precedence getPrecedence (size_t tokenType) {
             return Linear;
       case TOKEN_STAR:
       case TOKEN_FSLASH:
+      case TOKEN_PERCENT:
             return Scaling;
       }
       return Undefined;
@@ -77,9 +242,19 @@ Precedence getPrecedence (size_t tokenType) {
 typedef struct {
       int32_t type;
       void *value;
+      int32_t line;
+      int32_t column;
+      int32_t length;
+      int32_t offset;
 } Token;
 
-int32_t cur = 0;
+// Lexer state, per thread so chunks of a file can be lexed at once
+_Thread_local int32_t cur = 0;
+_Thread_local int32_t line = 1;
+_Thread_local int32_t lineStart = 0;
+_Thread_local int32_t tokenStart = 0;
+_Thread_local int32_t tokenLine = 1;
+_Thread_local int32_t tokenColumn = 1;
 
 typedef struct {
       size_t size;
@@ -100,11 +275,50 @@ typedef struct {
       char *value;
 } NodeAsenpeli;
 
+struct NodeExpression_t;
+typedef struct NodeExpression_t NodeExpression;
+
+typedef struct {
+      bool lon;
+      enum {
+            Nanpa,
+            NanpaLili,
+            NanpaSuli,
+            NanpaLiliLili,
+            Sitelen,
+            Telo,
+            TeloLili,
+            TeloSuli,
+            Pule,
+            Linja,
+      } type;
+      bool awen;
+      bool isUnsigned;
+      // Arrays of type: count elements, or as many as length gives at run
+      // time. Parameters have neither.
+      bool array;
+      int64_t count;
+      NodeExpression *length;
+      // awen values with a constant initializer are this literal and get
+      // no slot
+      NodeExpression *constant;
+} NodeType;
+
+// Literals in the source have no type and take one from where they are
+// used. Literals folded from awen values and constant expressions keep the
+// type they were computed in.
 typedef struct {
       bool lon;
       int64_t value;
+      NodeType type;
 } NodeNanpaExpression;
 
+typedef struct {
+      bool lon;
+      double value;
+      NodeType type;
+} NodeTeloExpression;
+
 typedef struct {
       bool lon;
       char* value;
@@ -115,15 +329,28 @@ typedef struct {
       char *string;
 } NodeLinjaExpression;
 
-struct NodeExpression_t;
-typedef struct NodeExpression_t NodeExpression;
 
 typedef struct {
       bool lon;
       NodeNimiExpression nimi;
+      NodeExpression *index;
       NodeExpression *expr;
 } NodeKamaExpression;
 
+typedef struct {
+      bool lon;
+      NodeNimiExpression nimi;
+      NodeExpression *index;
+} NodeIndexExpression;
+
+typedef struct {
+      bool lon;
+      char *name;
+      size_t argc;
+      NodeExpression **args;
+      bool inlined;
+} NodeCallExpression;
+
 typedef struct {
       bool lon;
       enum {
@@ -131,12 +358,18 @@ typedef struct {
             NimiExpr = 1,
             LinjaExpr,
             KamaExpr,
+            CallExpr,
+            TeloExpr,
+            IndexExpr,
       } type;
       union {
+            NodeIndexExpression index;
             NodeNanpaExpression nanpa;
+            NodeTeloExpression telo;
             NodeNimiExpression nimi;
             NodeLinjaExpression linja;
             NodeKamaExpression kama;
+            NodeCallExpression call;
       } value;
 } NodeTerm;
 
@@ -145,6 +378,7 @@ typedef enum {
       BinMul,
       BinSub,
       BinDiv,
+      BinMod,
       BinGt,
       BinEq,
       BinLt,
@@ -174,20 +408,6 @@ typedef struct {
       NodeExpression *expr;
 } NodeOtawa;
 
-typedef struct {
-      bool lon;
-      enum {
-            Nanpa,
-            NanpaLili,
-            NanpaSuli,
-            Telo,
-            TeloLili,
-            TeloSuli,
-            Pule,
-            Linja,
-      } type;
-      bool awen;
-} NodeType;
 
 typedef struct {
       bool lon;
@@ -202,6 +422,8 @@ typedef struct {
 } NodeKama;
 
 typedef struct NodeTenpo_t NodeTenpo;
+typedef struct NodeLa_t NodeLa;
+typedef struct NodePali_t NodePali;
 
 typedef union {
       NodeExpression *expr;
@@ -210,7 +432,9 @@ typedef union {
       NodeType type;
       NodeAsenpeli asen;
       NodeTenpo *tenpo;
+      NodeLa *la;
       NodeKama kama;
+      NodePali *pali;
 } NodeUnion;
 
 typedef enum {
@@ -220,12 +444,19 @@ typedef enum {
       Type,
       Asen,
       Tenpo,
+      La,
       Kama,
+      Pali,
 } TypeOfNode;
 
+// A node's span and line are relative to the start of the body it is in,
+// so an edit only has to move the nodes behind it in the same body.
 typedef struct {
       TypeOfNode type;
       NodeUnion node;
+      int32_t start;
+      int32_t end;
+      int32_t line;
 } Node;
 
 typedef struct {
@@ -238,8 +469,50 @@ typedef struct NodeTenpo_t {
       bool lon;
       NodeExpression *expr;
       Nodes nodes;
+      size_t id;
+      bool profiled;
+      uint64_t entries;
+      uint64_t iterations;
+      int32_t bodyStart;
+      int32_t bodyLine;
 } NodeTenpo;
 
+// expr la ... ante ... pini. An ante with a condition of its own chains
+// another conditional, which is then the only node of the ante body. La
+// take their profile counters from the numbering of tenpo: how often the
+// conditional is reached and how often the la branch is taken.
+typedef struct NodeLa_t {
+      bool lon;
+      NodeExpression *expr;
+      Nodes nodes;
+      Nodes ante;
+      size_t id;
+      bool profiled;
+      uint64_t entries;
+      uint64_t taken;
+      int32_t bodyStart;
+      int32_t bodyLine;
+      int32_t anteStart;
+      int32_t anteLine;
+} NodeLa;
+
+typedef struct NodePali_t {
+      bool lon;
+      char *name;
+      size_t paramCount;
+      char **params;
+      NodeType *paramTypes;
+      NodeType ret;
+      Nodes nodes;
+      size_t callSites;
+      bool called;
+      bool emitted;
+      int32_t bodyStart;
+      int32_t bodyLine;
+      // Absolute, set again by every collectPalis
+      int32_t line;
+} NodePali;
+
 size_t tenpoNumber;
 
 Nodes nodesNew() {
@@ -250,7 +523,12 @@ Nodes nodesNew() {
       return nodes;
 }; 
 
+// Tokens are stamped with the position the lexer started them at
 void addToken(Tokens *tokens, Token token) {
+      token.line = tokenLine;
+      token.column = tokenColumn;
+      token.length = cur - tokenStart;
+      token.offset = tokenStart;
       tokens->size++;
       if (tokens->size >= tokens->capacity) {
             tokens->capacity *= 2;
@@ -293,6 +571,7 @@ typedef struct {
 typedef struct {
       Arena arena;
       Nodes nodes;
+      size_t tenpoCount;
 } Prog;
 
 Arena arenaNew(size_t size) {
@@ -328,7 +607,7 @@ typedef struct {
       size_t size;
       size_t capacity;
       char **names;
-      size_t *values;
+      int64_t *values;
       NodeType *types;
 } NameMap;
 
@@ -337,17 +616,17 @@ NameMap nameMapNew() {
       map.capacity = 1;
       map.size = 0;
       map.names = calloc(1, sizeof(char*));
-      map.values = calloc(1, sizeof(size_t));
+      map.values = calloc(1, sizeof(int64_t));
       map.types = calloc(1, sizeof(NodeType));
       return map;
 }
 
-void addNameMap(NameMap *map, char *name, size_t value, NodeType type) {
+void addNameMap(NameMap *map, char *name, int64_t value, NodeType type) {
       map->size++;
       if (map->size >= map->capacity) {
             map->capacity *= 2;
             map->names = realloc(map->names, sizeof(char*)*map->capacity);
-            map->values = realloc(map->values, sizeof(size_t)*map->capacity);
+            map->values = realloc(map->values, sizeof(int64_t)*map->capacity);
             map->types = realloc(map->types, sizeof(NodeType)*map->capacity);
       }
       //map->names[size-1] = calloc(strlen(name), sizeof(char));
@@ -356,7 +635,7 @@ void addNameMap(NameMap *map, char *name, size_t value, NodeType type) {
       map->types[map->size-1] = type;      
 }
 
-size_t getNameMap(NameMap *map, char *name) {
+int64_t getNameMap(NameMap *map, char *name) {
       for (size_t i = 0; i < map->size; i++) {
             if(!strcmp(name, map->names[i])) {
                   return map->values[i];
@@ -367,13 +646,17 @@ size_t getNameMap(NameMap *map, char *name) {
 }
 
 
+extern _Thread_local FILE *errors;
+void fail();
+
 NodeType getNameMapType(NameMap *map, char *name) {
       for (size_t i = 0; i < map->size; i++) {
             if(!strcmp(name, map->names[i])) {
                   return map->types[i];
             }
       }
-      assert(false);
+      fprintf(errors, "Undefined identifier %s\n", name);
+      fail();
       return (NodeType){};
 }
 
@@ -386,6 +669,281 @@ bool hasNameMap(NameMap *map, char *name) {
       return false;
 }
 
+typedef struct {
+      size_t size;
+      size_t capacity;
+      NodePali **palis;
+} Palis;
+
+Palis palisNew() {
+      Palis palis;
+      palis.capacity = 1;
+      palis.size = 0;
+      palis.palis = calloc(1, sizeof(NodePali*));
+      return palis;
+}
+
+void addPalis(Palis *palis, NodePali *pali) {
+      palis->size++;
+      if (palis->size >= palis->capacity) {
+            palis->capacity *= 2;
+            palis->palis = realloc(palis->palis, sizeof(NodePali*)*palis->capacity);
+      }
+      palis->palis[palis->size-1] = pali;
+}
+
+NodePali *getPalis(Palis *palis, char *name) {
+      for (size_t i = 0; i < palis->size; i++) {
+            if (!strcmp(name, palis->palis[i]->name)) {
+                  return palis->palis[i];
+            }
+      }
+      return NULL;
+}
+
+typedef struct {
+      int32_t line;
+      int32_t column;
+      int32_t length;
+      char *message;
+} Diagnostic;
+
+typedef struct {
+      size_t size;
+      size_t capacity;
+      Diagnostic *diagnostics;
+} Diagnostics;
+
+_Thread_local Diagnostics diagnostics;
+char *sourceName = "test.ln";
+char *source = NULL;
+
+// Generated assembly goes to out, error messages to errors. Both are the
+// standard streams unless the compile server redirects them. Like the rest
+// of the code generator state they are per thread, pali are generated on
+// several threads at once.
+_Thread_local FILE *out;
+_Thread_local FILE *errors;
+
+// Where fail() jumps to instead of exiting, so a failed compile doesn't take
+// the compile server down with it.
+_Thread_local jmp_buf *failure = NULL;
+
+void fail() {
+      if (failure) longjmp(*failure, 1);
+      exit(1);
+}
+
+// Where a parse error jumps back to, set by parseStatement
+jmp_buf *recovery = NULL;
+
+void addDiagnostic(Diagnostics *diags, Diagnostic diag) {
+      if (diags->size >= diags->capacity) {
+            diags->capacity = diags->capacity ? diags->capacity * 2 : 8;
+            diags->diagnostics = realloc(diags->diagnostics, sizeof(Diagnostic)*diags->capacity);
+      }
+      diags->diagnostics[diags->size++] = diag;
+}
+
+void clearDiagnostics(Diagnostics *diags) {
+      for (size_t i = 0; i < diags->size; i++) free(diags->diagnostics[i].message);
+      diags->size = 0;
+}
+
+void vaddError(int32_t line, int32_t column, int32_t length, char *format, va_list args) {
+      char message[256];
+      vsnprintf(message, sizeof(message), format, args);
+      addDiagnostic(&diagnostics, (Diagnostic){.line = line, .column = column,
+                  .length = length > 0 ? length : 1, .message = strdup(message)});
+}
+
+void lexError(char *format, ...) {
+      va_list args;
+      va_start(args, format);
+      vaddError(tokenLine, tokenColumn, cur - tokenStart, format, args);
+      va_end(args);
+}
+
+void parseError(Token token, char *format, ...) {
+      va_list args;
+      va_start(args, format);
+      vaddError(token.line, token.column, token.length, format, args);
+      va_end(args);
+      if (!recovery) {
+            fprintf(stderr, "ERROR: parse error outside of a statement\n");
+            exit(1);
+      }
+      longjmp(*recovery, 1);
+}
+
+// Prints every diagnostic with the source line it points at and a marker
+// under the offending span.
+int compareDiagnostics(const void *a, const void *b) {
+      const Diagnostic *x = a, *y = b;
+      if (x->line != y->line) return x->line - y->line;
+      return x->column - y->column;
+}
+
+void printDiagnostics() {
+      qsort(diagnostics.diagnostics, diagnostics.size, sizeof(Diagnostic), compareDiagnostics);
+      for (size_t i = 0; i < diagnostics.size; i++) {
+            Diagnostic diag = diagnostics.diagnostics[i];
+            fprintf(errors, "%s:%d:%d: error: %s\n", sourceName, diag.line, diag.column, diag.message);
+            if (!source) continue;
+
+            char *start = source;
+            for (int32_t l = 1; l < diag.line && *start; start++) {
+                  if (*start == '\n') l++;
+            }
+            int32_t width = strcspn(start, "\n");
+            fprintf(errors, "    %.*s\n    ", width, start);
+            for (int32_t c = 1; c < diag.column; c++) fputc(start[c-1] == '\t' ? '\t' : ' ', errors);
+            for (int32_t c = 0; c == 0 || (c < diag.length && diag.column + c <= width); c++) fputc('^', errors);
+            fputc('\n', errors);
+      }
+}
+
+// The runs of bytes the lexer steps over without looking at each one:
+// names and numbers, whitespace, the inside of a linja literal and the
+// rest of a comment, and code up to the next linja or comment. The
+// vector scans classify 16 or 32 bytes at a time.
+// They load from aligned addresses, so a load never reaches into a page
+// behind the terminating 0 of the buffer, and drop the bytes in front of
+// where the scan starts. Every scan stops at the 0, and the ones that
+// stop at EOF in the scalar lexer stop at the 0xff byte peek mistakes for
+// it too, so all of them find the same ends.
+typedef enum {
+      ScanName,
+      ScanSpace,
+      ScanLinja,
+      ScanComment,
+      ScanCode,
+} ScanKind;
+
+enum {LexUnknown, LexScalar, LexSse2, LexAvx2} lexWidth = LexUnknown;
+
+bool scanStops(char c, ScanKind kind) {
+      switch (kind) {
+      case ScanName: return !isalnum(c);
+      case ScanSpace: return !isspace(c);
+      case ScanLinja: return c == '"' || c == '\\' || c == '\n' || c == 0 || c == EOF;
+      case ScanCode: return c == '"' || c == '/' || c == 0 || c == EOF;
+      default: return c == '\n' || c == 0 || c == EOF;
+      }
+}
+
+int32_t scanScalar(char *buffer, int32_t from, ScanKind kind) {
+      while (!scanStops(buffer[from], kind)) from++;
+      return from;
+}
+
+#if defined(__x86_64__)
+static inline uint32_t sse2Stops(__m128i v, ScanKind kind) {
+      __m128i stops;
+      if (kind == ScanName) {
+            __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+            __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+            return ~_mm_movemask_epi8(_mm_or_si128(digit, alpha)) & 0xffff;
+      }
+      if (kind == ScanSpace) {
+            __m128i control = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+            return ~_mm_movemask_epi8(_mm_or_si128(control, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')))) & 0xffff;
+      }
+      stops = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()), _mm_cmpeq_epi8(v, _mm_set1_epi8(-1)));
+      if (kind == ScanCode) {
+            stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+            return _mm_movemask_epi8(_mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8('/'))));
+      }
+      stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+      if (kind == ScanLinja) {
+            stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+            stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+      }
+      return _mm_movemask_epi8(stops);
+}
+
+int32_t scanSse2(char *buffer, int32_t from, ScanKind kind) {
+      char *start = buffer + from;
+      char *block = (char*)((uintptr_t)start & ~(uintptr_t)15);
+      uint32_t mask = sse2Stops(_mm_load_si128((__m128i*)block), kind) >> (start - block);
+      if (mask) return from + __builtin_ctz(mask);
+      for (block += 16;; block += 16) {
+            mask = sse2Stops(_mm_load_si128((__m128i*)block), kind);
+            if (mask) return block - buffer + __builtin_ctz(mask);
+      }
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2Stops(__m256i v, ScanKind kind) {
+      __m256i stops;
+      if (kind == ScanName) {
+            __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+            __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+            return ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha));
+      }
+      if (kind == ScanSpace) {
+            __m256i control = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+            return ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(control, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))));
+      }
+      stops = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(-1)));
+      if (kind == ScanCode) {
+            stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+            return _mm256_movemask_epi8(_mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'))));
+      }
+      stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+      if (kind == ScanLinja) {
+            stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+            stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+      }
+      return _mm256_movemask_epi8(stops);
+}
+
+__attribute__((target("avx2")))
+int32_t scanAvx2(char *buffer, int32_t from, ScanKind kind) {
+      char *start = buffer + from;
+      char *block = (char*)((uintptr_t)start & ~(uintptr_t)31);
+      uint32_t mask = avx2Stops(_mm256_load_si256((__m256i*)block), kind) >> (start - block);
+      if (mask) return from + __builtin_ctz(mask);
+      for (block += 32;; block += 32) {
+            mask = avx2Stops(_mm256_load_si256((__m256i*)block), kind);
+            if (mask) return block - buffer + __builtin_ctz(mask);
+      }
+}
+#endif
+
+// The widest scan the cpu has, or a narrower one --lexer asks for
+void pickLexer(int width) {
+      int best = LexScalar;
+#if defined(__x86_64__)
+      __builtin_cpu_init();
+      best = __builtin_cpu_supports("avx2") ? LexAvx2 : LexSse2;
+#endif
+      lexWidth = width && width < best ? width : best;
+}
+
+// The end of the run of kind starting at from
+int32_t scan(char *buffer, int32_t from, ScanKind kind) {
+#if defined(__x86_64__)
+      if (lexWidth == LexAvx2) return scanAvx2(buffer, from, kind);
+      if (lexWidth == LexSse2) return scanSse2(buffer, from, kind);
+#endif
+      return scanScalar(buffer, from, kind);
+}
+
+// Steps over whitespace up to to, counting the lines it passes
+void skipSpace(char *buffer, int32_t to) {
+      int32_t end = scan(buffer, cur, ScanSpace);
+      if (end > to) end = to;
+      char *newline = buffer + cur;
+      while ((newline = memchr(newline, '\n', buffer + end - newline))) {
+            line++;
+            lineStart = ++newline - buffer;
+      }
+      cur = end;
+}
+
 char peek(char* buffer) {
       //char c = fgetc(buffer);
       //ungetc(c, buffer);
@@ -394,30 +952,41 @@ char peek(char* buffer) {
       return buffer[cur];
 }
 
-NameMap vars;
+_Thread_local NameMap vars;
 Arena arena;
 
 char consume(char* buffer) {
       //return fgetc(buffer);
+      if (buffer[cur] == '\n') {
+            line++;
+            lineStart = cur + 1;
+      }
       return buffer[cur++];
 }
 
-Tokens tokenize(char* buffer) {
+// Lexes buffer from offset from, which is on line firstLine, up to offset to.
+// A token or comment that runs past to is finished, so cur ends up behind to.
+Tokens tokenizeRange(char* buffer, int32_t from, int32_t to, int32_t firstLine) {
       char c;
       Tokens tokens = tokensNew();
       Tokens *tokensptr = &tokens;
-      cur = 0;
-      while ((c = peek(buffer)) != EOF) {
+      if (lexWidth == LexUnknown) pickLexer(0);
+      cur = from;
+      line = firstLine;
+      lineStart = from;
+      while (lineStart > 0 && buffer[lineStart - 1] != '\n') lineStart--;
+      while (cur < to && (c = peek(buffer)) != EOF) {
+            tokenStart = cur;
+            tokenLine = line;
+            tokenColumn = cur - lineStart + 1;
             if (isalpha(c)) {
                   int32_t firstchar = cur;
-                  while(isalnum(c = peek(buffer)) && c != EOF) {
-                        consume(buffer);
-                  }
-                  char *name = calloc(cur - firstchar, sizeof(char));
+                  cur = scan(buffer, cur, ScanName);
+                  char *name = calloc(cur - firstchar + 1, sizeof(char));
                   
                   strncpy(name, buffer+firstchar, cur - firstchar);
                   name[cur - firstchar] = 0;
-                  Token token;
+                  Token token = {};
                   char* prefix = "keyword";
                   // check for keywords
                   if (!strcmp(name, "otawa")) {
@@ -434,6 +1003,8 @@ Tokens tokenize(char* buffer) {
                         token.type = TOKEN_SULI;
                   } else if (!strcmp(name, "lili")) {
                         token.type = TOKEN_LILI;
+                  } else if (!strcmp(name, "telo")) {
+                        token.type = TOKEN_TELO;
                   } else if (!strcmp(name, "telotu")) {
                         token.type = TOKEN_TELOTU;
                   } else if (!strcmp(name, "signed")) {
@@ -450,6 +1021,12 @@ Tokens tokenize(char* buffer) {
                         token.type = TOKEN_PINI;
                   } else if (!strcmp(name, "awen")) {
                         token.type = TOKEN_AWEN;
+                  } else if (!strcmp(name, "pali")) {
+                        token.type = TOKEN_PALI;
+                  } else if (!strcmp(name, "pi")) {
+                        token.type = TOKEN_PI;
+                  } else if (!strcmp(name, "pana")) {
+                        token.type = TOKEN_PANA;
                   } else if (!strcmp(name, "case")) {
                   } else if (!strcmp(name, "default")) {
                   } else if (!strcmp(name, "break")) {
@@ -459,18 +1036,22 @@ Tokens tokenize(char* buffer) {
                         token.type = TOKEN_ASEN;
                   } else {
                         token.type = TOKEN_NAME;
-                        token.value = name;
                         prefix = "name";
                   }
                   if (debug) printf("%s: '%s'\n", prefix, name);
+                  // Only names keep their text
+                  if (token.type == TOKEN_NAME) token.value = name;
+                  else free(name);
                   addToken(tokensptr, token);
             }
             else if (isdigit(c)) {
                   int32_t firstchar = cur;
-                  while(isalnum(c = peek(buffer)) && c != EOF) {
-                        consume(buffer);
+                  cur = scan(buffer, cur, ScanName);
+                  // telo literals: 0.3, 0.3t or 3t
+                  if (peek(buffer) == '.' && isdigit(buffer[cur + 1])) {
+                        cur = scan(buffer, cur + 1, ScanName);
                   }
-                  char *number = calloc(cur - firstchar, sizeof(char));
+                  char *number = calloc(cur - firstchar + 1, sizeof(char));
                   strncpy(number, buffer+firstchar, cur - firstchar);
                   number[cur - firstchar] = 0;
                   
@@ -481,17 +1062,23 @@ Tokens tokenize(char* buffer) {
             else if (c == '"') {
                   consume(buffer);
                   int32_t firstchar = cur;
-                  int32_t stringSize = 0;
                   
-                  while((c = peek(buffer)) && c != '"' && c != EOF) {
+                  // Escapes are decoded when the linja is generated, the lexer
+                  // only has to step over \" so it doesn't end the literal.
+                  // Newlines go through consume to be counted.
+                  while (cur = scan(buffer, cur, ScanLinja), (c = peek(buffer)) != '"' && c != EOF) {
                         c = consume(buffer);
-                        stringSize++;
+                        if (c == '\\' && peek(buffer) != EOF) consume(buffer);
                   }
                   
-                  char *string = calloc(cur - firstchar, sizeof(char));
+                  char *string = calloc(cur - firstchar + 1, sizeof(char));
                   strncpy(string, buffer+firstchar, cur - firstchar);
                   string[cur - firstchar] = 0;
-                  consume(buffer);
+                  if (peek(buffer) == EOF) {
+                        lexError("Unterminated string literal");
+                  } else {
+                        consume(buffer);
+                  }
 
                   Token token = (Token){.type = TOKEN_STRING_LITERAL, .value = string};
                   if (debug) printf("string literal: %s\n", string);
@@ -523,6 +1110,21 @@ Tokens tokenize(char* buffer) {
                   consume(buffer);
                   addToken(&tokens, (Token){.type = TOKEN_CCURLY});
             }
+            else if (c == '[') {
+                  if (debug) printf("obracket\n");
+                  consume(buffer);
+                  addToken(&tokens, (Token){.type = TOKEN_OBRACKET});
+            }
+            else if (c == ']') {
+                  if (debug) printf("cbracket\n");
+                  consume(buffer);
+                  addToken(&tokens, (Token){.type = TOKEN_CBRACKET});
+            }
+            else if (c == '.') {
+                  if (debug) printf("dot\n");
+                  consume(buffer);
+                  addToken(&tokens, (Token){.type = TOKEN_DOT});
+            }
             else if (c == ',') {
                   if (debug) printf("comma\n");
                   consume(buffer);
@@ -532,8 +1134,8 @@ Tokens tokenize(char* buffer) {
                   consume(buffer);
                   if (peek(buffer) == '=') {
                         if (debug) printf("double equals\n");
-                        addToken(&tokens, (Token){.type = TOKEN_DEQ});
                         consume(buffer);
+                        addToken(&tokens, (Token){.type = TOKEN_DEQ});
                         continue;
                   } else {
                         if (debug) printf("equals\n");
@@ -575,38 +1177,178 @@ Tokens tokenize(char* buffer) {
                   if (peek(buffer) == '/') 
                   consume(buffer);
                   if (peek(buffer) == '/') {
-                        while (peek(buffer) != '\n') {
-                              consume(buffer);
-                        }
+                        cur = scan(buffer, cur, ScanComment);
                         continue;
                   }
 
                   addToken(&tokens, (Token){.type = TOKEN_FSLASH});
             }
-            else if (isspace(c)) {
+            else if (c == '%') {
+                  if (debug) printf("percent\n");
                   consume(buffer);
+                  addToken(&tokens, (Token){.type = TOKEN_PERCENT});
+            }
+            else if (isspace(c)) {
+                  skipSpace(buffer, to);
             }
             else {                  
                   if (debug) printf("Unexpected character %c\n", c);
                   consume(buffer);
+                  lexError("Unexpected character '%c'", c);
+            }
+
+      }
+      return tokens;
+}
+
+// Files of at least two chunks of LEX_CHUNK_MIN are lexed by lexThreads
+// threads. The chunks end behind a newline that isn't in a linja or a
+// comment, which the serial lexer also steps over between tokens, so every
+// chunk lexes to the same tokens it would in one piece. Each chunk counts
+// lines from 1, and its tokens and lex errors are moved down by the lines
+// in front of it when they are copied together.
+#define LEX_CHUNK_MIN (1 << 20)
+#define LEX_THREADS_MAX 64
+
+size_t lexThreads = 1;
+
+typedef struct {
+      char *buffer;
+      int32_t from;
+      int32_t to;
+      Tokens tokens;
+      int32_t lines;
+      Diagnostics diagnostics;
+      Tokens *all;
+      size_t at;
+      int32_t baseLine;
+} LexChunk;
+
+// Ends chunks at the first newline in code behind every target offset,
+// up to the 0 or 0xff that ends lexing. Returns the number of chunks.
+size_t splitChunks(char *buffer, size_t length, LexChunk *chunks, size_t count) {
+      size_t chunk = 0;
+      int32_t pos = 0;
+      int32_t target = length / count;
+      chunks[0].from = 0;
+      while (chunk + 1 < count) {
+            int32_t end = scan(buffer, pos, ScanCode);
+            while (chunk + 1 < count && target < end) {
+                  int32_t from = target > pos ? target : pos;
+                  char *newline = memchr(buffer + from, '\n', end - from);
+                  if (!newline) break;
+                  int32_t boundary = newline - buffer + 1;
+                  chunks[chunk].to = chunks[chunk + 1].from = boundary;
+                  chunk++;
+                  target = (int64_t)length * (chunk + 1) / count;
+                  if (target < boundary) target = boundary;
             }
+            char c = buffer[end];
+            if (c == 0 || c == EOF) break;
+            pos = end + 1;
+            if (c == '/' && buffer[pos] == '/') {
+                  pos = scan(buffer, pos + 1, ScanComment);
+            } else if (c == '"') {
+                  while (pos = scan(buffer, pos, ScanLinja), (c = buffer[pos]) != '"' && c != 0 && c != EOF) {
+                        pos++;
+                        if (c == '\\' && buffer[pos] != 0 && buffer[pos] != EOF) pos++;
+                  }
+                  if (c != '"') break;
+                  pos++;
+            }
+      }
+      chunks[chunk].to = INT32_MAX;
+      return chunk + 1;
+}
+
+void *lexChunk(void *arg) {
+      LexChunk *chunk = arg;
+      chunk->tokens = tokenizeRange(chunk->buffer, chunk->from, chunk->to, 1);
+      chunk->lines = line - 1;
+      chunk->diagnostics = diagnostics;
+      return NULL;
+}
+
+void *copyChunk(void *arg) {
+      LexChunk *chunk = arg;
+      Token *to = chunk->all->tokens + chunk->at;
+      for (size_t i = 0; i < chunk->tokens.size; i++) {
+            to[i] = chunk->tokens.tokens[i];
+            to[i].line += chunk->baseLine;
+      }
+      free(chunk->tokens.tokens);
+      return NULL;
+}
+
+void runChunks(void *(*work)(void *), LexChunk *chunks, size_t count) {
+      pthread_t threads[LEX_THREADS_MAX];
+      for (size_t i = 0; i < count; i++) pthread_create(&threads[i], NULL, work, &chunks[i]);
+      for (size_t i = 0; i < count; i++) pthread_join(threads[i], NULL);
+}
 
+Tokens tokenize(char* buffer) {
+      TRACE_ZONE("tokenize");
+      size_t length = strlen(buffer);
+      size_t count = lexThreads < LEX_THREADS_MAX ? lexThreads : LEX_THREADS_MAX;
+      if (count > length / LEX_CHUNK_MIN) count = length / LEX_CHUNK_MIN;
+      if (count < 2) return tokenizeRange(buffer, 0, INT32_MAX, 1);
+
+      if (lexWidth == LexUnknown) pickLexer(0);
+      LexChunk chunks[LEX_THREADS_MAX];
+      count = splitChunks(buffer, length, chunks, count);
+      for (size_t i = 0; i < count; i++) chunks[i].buffer = buffer;
+      runChunks(lexChunk, chunks, count);
+
+      Tokens tokens = {};
+      int32_t baseLine = 0;
+      for (size_t i = 0; i < count; i++) {
+            chunks[i].all = &tokens;
+            chunks[i].at = tokens.size;
+            chunks[i].baseLine = baseLine;
+            tokens.size += chunks[i].tokens.size;
+            for (size_t j = 0; j < chunks[i].diagnostics.size; j++) {
+                  Diagnostic diag = chunks[i].diagnostics.diagnostics[j];
+                  diag.line += baseLine;
+                  addDiagnostic(&diagnostics, diag);
+            }
+            free(chunks[i].diagnostics.diagnostics);
+            baseLine += chunks[i].lines;
       }
+      tokens.capacity = tokens.size + 1;
+      tokens.tokens = malloc(sizeof(Token)*tokens.capacity);
+      runChunks(copyChunk, chunks, count);
       return tokens;
 }
 
 size_t curToken = 0;
 
+// Past the last token, the end of input sits right behind the last token
+Token tokenEnd(Tokens *tokens) {
+      if (tokens->size == 0) return (Token) {.type = -1, .line = 1, .column = 1};
+      Token last = tokens->tokens[tokens->size - 1];
+      return (Token) {.type = -1, .line = last.line, .column = last.column + last.length, .length = 1};
+}
+
 Token tokenPeek(Tokens *tokens) {
-      if (curToken >= tokens->size) return (Token) {.type = -1};
+      if (curToken >= tokens->size) return tokenEnd(tokens);
       return tokens->tokens[curToken];
 }
 
 Token tokenPeekAhead(Tokens *tokens, size_t ahead) {
-      if (curToken + ahead >= tokens->size) return (Token) {.type = -1};
+      if (curToken + ahead >= tokens->size) return tokenEnd(tokens);
       return tokens->tokens[curToken + ahead];
 }
 
+// Errors about something missing point right behind the previous token when
+// the next one is already on another line.
+Token missingToken(Tokens *tokens) {
+      Token next = tokenPeek(tokens);
+      if (curToken == 0 || curToken > tokens->size) return next;
+      Token previous = tokens->tokens[curToken - 1];
+      if (next.type != -1 && next.line == previous.line) return next;
+      return (Token){.type = -1, .line = previous.line, .column = previous.column + previous.length, .length = 1};
+}
+
 Token tokenConsume(Tokens *tokens) {
       return tokens->tokens[curToken++];
 }
@@ -615,9 +1357,31 @@ Token tokenConsume(Tokens *tokens) {
 NodeNanpaExpression parseNanpaExpr(Tokens *tokens, Arena *arena) {
       if(tokenPeek(tokens).type == TOKEN_NUMBER) {
             Token token = tokenConsume(tokens);
-            return (NodeNanpaExpression){.lon = true, .value = atoi(token.value)};
+            // Up to 2^64-1, for unsigned nanpa
+            char *end;
+            errno = 0;
+            uint64_t value = strtoull(token.value, &end, 10);
+            if (*end || errno == ERANGE) {
+                  parseError(token, "Invalid number '%s'", (char*) token.value);
+            }
+            return (NodeNanpaExpression){.lon = true, .value = (int64_t) value};
       }
-      assert(false);
+      parseError(missingToken(tokens), "Expected a number");
+      return (NodeNanpaExpression){};
+}
+
+bool isTeloLiteral(char *number) {
+      return strchr(number, '.') || number[strlen(number) - 1] == 't';
+}
+
+NodeTeloExpression parseTeloExpr(Tokens *tokens, Arena *arena) {
+      Token token = tokenConsume(tokens);
+      char *end;
+      double value = strtod(token.value, &end);
+      if (strcmp(end, "t") && *end) {
+            parseError(token, "Invalid telo '%s'", (char*) token.value);
+      }
+      return (NodeTeloExpression){.lon = true, .value = value};
 }
 
 NodeNimiExpression parseNimiExpr(Tokens *tokens, Arena *arena) {
@@ -625,7 +1389,8 @@ NodeNimiExpression parseNimiExpr(Tokens *tokens, Arena *arena) {
             Token token = tokenConsume(tokens);
             return (NodeNimiExpression){.lon = true, .value = strdup((char*)token.value)};
       }
-      assert (false);
+      parseError(missingToken(tokens), "Expected a name");
+      return (NodeNimiExpression){};
 }
 
 NodeLinjaExpression parseLinjaExpr(Tokens *tokens, Arena *arena) {
@@ -636,36 +1401,48 @@ NodeLinjaExpression parseLinjaExpr(Tokens *tokens, Arena *arena) {
             linja.string = strdup(token.value);
             return linja;
       };
-      assert(false);
+      parseError(missingToken(tokens), "Expected a string literal");
+      return (NodeLinjaExpression){};
 }
 
 NodeExpression *parseExpr(Tokens *tokens, Arena *arena, Precedence minPrec);
 
+// '[' index ']'
+NodeExpression *parseIndex(Tokens *tokens, Arena *arena) {
+      tokenConsume(tokens);
+      NodeExpression *index = parseExpr(tokens, arena, 0);
+      if (tokenPeek(tokens).type != TOKEN_CBRACKET) {
+            parseError(missingToken(tokens), "No ']' after the index");
+      }
+      tokenConsume(tokens);
+      return index;
+}
+
 NodeKamaExpression *parseKamaExpr(Tokens *tokens, Arena *arena) {
       if (tokenPeek(tokens).type == TOKEN_NAME) {
             NodeNimiExpression nimi = parseNimiExpr(tokens, arena);
             if (!nimi.lon) {
-                  fprintf(stderr, "No name given in kama expression\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No name given in kama expression");
             }
+            NodeExpression *index = NULL;
+            if (tokenPeek(tokens).type == TOKEN_OBRACKET) index = parseIndex(tokens, arena);
             
             if (tokenPeek(tokens).type != TOKEN_EQ) {
-                  fprintf(stderr, "No '=' in kama expression\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No '=' in kama expression");
             }
             tokenConsume(tokens);
 
             NodeExpression *expr = parseExpr(tokens, arena, 0);
 
             if (tokenPeek(tokens).type != TOKEN_SEMI) {
-                  fprintf(stderr, "No ';' in kama expression\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No ';' in kama expression");
             }
             
             NodeKamaExpression *node = malloc(sizeof(NodeKamaExpression));
             node->lon = true;
             node->expr = expr;
             node->nimi = nimi;
+            node->index = index;
             return node;
       }
       return NULL;
@@ -674,23 +1451,82 @@ NodeKamaExpression *parseKamaExpr(Tokens *tokens, Arena *arena) {
 NodeKama parseKama(Tokens *tokens, Arena *arena) {
       NodeKamaExpression *expr = parseKamaExpr(tokens, arena);
       if (!expr->lon) {
-            fprintf(stderr, "Invalid kama statement\n");
-            exit(1);
+            parseError(missingToken(tokens), "Invalid kama statement");
       }
       if (tokenPeek(tokens).type != TOKEN_SEMI) {
-            fprintf(stderr, "No ';' after kama statement\n");
-            exit(1);
+            parseError(missingToken(tokens), "No ';' after kama statement");
       }
       tokenConsume(tokens);
       return (NodeKama){.lon = true, .kama = expr};
 }
 
+void parseArguments(Tokens *tokens, Arena *arena, NodeCallExpression *call);
+
+NodeCallExpression parseCallExpr(Tokens *tokens, Arena *arena) {
+      NodeNimiExpression nimi = parseNimiExpr(tokens, arena);
+      if (tokenPeek(tokens).type != TOKEN_OPAREN) {
+            parseError(missingToken(tokens), "No '(' in call to %s", nimi.value);
+      }
+      NodeCallExpression call = {.lon = true, .name = nimi.value};
+      parseArguments(tokens, arena, &call);
+      return call;
+}
+
+// Parses '(' arguments ')' onto the end of call's arguments
+void parseArguments(Tokens *tokens, Arena *arena, NodeCallExpression *call) {
+      tokenConsume(tokens);
+      size_t given = 0;
+      while (tokenPeek(tokens).type != TOKEN_CPAREN) {
+            if (given++ > 0) {
+                  if (tokenPeek(tokens).type != TOKEN_COMMA) {
+                        parseError(missingToken(tokens), "No ',' between arguments to %s", call->name);
+                  }
+                  tokenConsume(tokens);
+            }
+            NodeExpression *arg = parseExpr(tokens, arena, 0);
+            call->args = realloc(call->args, sizeof(NodeExpression*)*(call->argc + 1));
+            call->args[call->argc++] = arg;
+      }
+      tokenConsume(tokens);
+}
+
+// x.f(a) calls f(x, a). suli is a keyword because of nanpa suli, but can
+// still be called this way.
+NodeTerm parseMethodCall(Tokens *tokens, Arena *arena, NodeTerm term) {
+      while (tokenPeek(tokens).type == TOKEN_DOT) {
+            tokenConsume(tokens);
+            Token name = tokenPeek(tokens);
+            if (name.type != TOKEN_NAME && name.type != TOKEN_SULI) {
+                  parseError(missingToken(tokens), "Expected a name after '.'");
+            }
+            tokenConsume(tokens);
+            NodeCallExpression call = {.lon = true, .name = strdup(name.type == TOKEN_SULI ? "suli" : name.value)};
+            if (tokenPeek(tokens).type != TOKEN_OPAREN) {
+                  parseError(missingToken(tokens), "No '(' in call to %s", call.name);
+            }
+            NodeExpression *receiver = malloc(sizeof(NodeExpression));
+            *receiver = (NodeExpression){.lon = true, .type = TermExpr, .value.term = term};
+            call.args = malloc(sizeof(NodeExpression*));
+            call.args[call.argc++] = receiver;
+            parseArguments(tokens, arena, &call);
+            term = (NodeTerm){.lon = true, .type = CallExpr, .value.call = call};
+      }
+      return term;
+}
+
 NodeTerm parseTerm(Tokens *tokens, Arena *arena) {
+      if (tokenPeek(tokens).type == TOKEN_NAME && tokenPeekAhead(tokens, 1).type == TOKEN_OPAREN) {
+            NodeCallExpression call = parseCallExpr(tokens, arena);
+            return (NodeTerm) {.lon = true, .type = CallExpr, .value.call = call};
+      }
+      if (tokenPeek(tokens).type == TOKEN_NUMBER && isTeloLiteral(tokenPeek(tokens).value)) {
+            NodeTeloExpression node = parseTeloExpr(tokens, arena);
+            return (NodeTerm) {.lon = true, .type = TeloExpr, .value.telo = node};
+      }
       if (tokenPeek(tokens).type == TOKEN_NUMBER) {
             NodeNanpaExpression node;
             if (!(node = parseNanpaExpr(tokens, arena)).lon) {
-                  fprintf(stderr, "No number given\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No number given");
             }
             NodeTerm term;
             term.lon = true;
@@ -698,11 +1534,15 @@ NodeTerm parseTerm(Tokens *tokens, Arena *arena) {
             term.value.nanpa = node;
             return term;
       }
+      if (tokenPeek(tokens).type == TOKEN_NAME && tokenPeekAhead(tokens, 1).type == TOKEN_OBRACKET) {
+            NodeNimiExpression nimi = parseNimiExpr(tokens, arena);
+            NodeExpression *index = parseIndex(tokens, arena);
+            return (NodeTerm) {.lon = true, .type = IndexExpr, .value.index = {.lon = true, .nimi = nimi, .index = index}};
+      }
       if (tokenPeek(tokens).type == TOKEN_NAME) {
             NodeNimiExpression node;
             if (!(node = parseNimiExpr(tokens, arena)).lon) {
-                  fprintf(stderr, "No name given\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No name given");
             }
 
             *node.value;
@@ -713,8 +1553,7 @@ NodeTerm parseTerm(Tokens *tokens, Arena *arena) {
       if (tokenPeek(tokens).type == TOKEN_STRING_LITERAL) {
             NodeLinjaExpression node;
             if (!(node = parseLinjaExpr(tokens, arena)).lon) {
-                  fprintf(stderr, "No string literal given\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No string literal given");
             }
             return (NodeTerm){.lon = true, .type = LinjaExpr, .value.linja = node};
       }
@@ -722,12 +1561,13 @@ NodeTerm parseTerm(Tokens *tokens, Arena *arena) {
 }
 
 NodeExpression *parseExpr(Tokens *tokens, Arena *arena, Precedence minPrec) {
+      TRACE_ZONE("parseExpr");
       NodeTerm lhsTerm = parseTerm(tokens, arena);
 
       if (!lhsTerm.lon) {
-            fprintf(stderr, "No term!\n");
-            exit(1);
+            parseError(missingToken(tokens), "No term!");
       }
+      lhsTerm = parseMethodCall(tokens, arena, lhsTerm);
 
       NodeExpression *lhsExpr = malloc(sizeof(NodeExpression));
       lhsExpr->lon = true;
@@ -747,6 +1587,8 @@ NodeExpression *parseExpr(Tokens *tokens, Arena *arena, Precedence minPrec) {
                   type = BinMul;
             } else if (token.type == TOKEN_FSLASH) {
                   type = BinDiv;
+            } else if (token.type == TOKEN_PERCENT) {
+                  type = BinMod;
             } else if (token.type == TOKEN_GT) {
                   type = BinGt;
             } else if (token.type == TOKEN_DEQ) {
@@ -766,8 +1608,7 @@ NodeExpression *parseExpr(Tokens *tokens, Arena *arena, Precedence minPrec) {
             NodeExpression *rhsExpr = parseExpr(tokens, arena, nextMinPrec);
 
             if (!rhsExpr->lon) {
-                  fprintf(stderr, "No second Expression!\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No second Expression!");
             }
 
             NodeBinaryExpression *binExpr = malloc(sizeof(NodeBinaryExpression));
@@ -802,44 +1643,41 @@ NodeExpression *parseExpr(Tokens *tokens, Arena *arena, Precedence minPrec) {
       return lhsExpr;
 }
 
+void freeExpression(NodeExpression *expr);
+
 NodeAsenpeli parseAsenpeli(Tokens *tokens, Arena *arena) {
       if (tokenPeek(tokens).type != TOKEN_ASEN) {
-            fprintf(stderr, "No 'asem' in assembly call\n");
-            exit(1);
+            parseError(missingToken(tokens), "No 'asem' in assembly call");
 
       }
       
       tokenConsume(tokens);
       if (tokenPeek(tokens).type != TOKEN_STRING_LITERAL) {
-            fprintf(stderr, "No assembly instructions given\n");
-            exit(1);
+            parseError(missingToken(tokens), "No assembly instructions given");
       }
       NodeExpression *instructions = parseExpr(tokens, arena, 0);
 
       if (!instructions->lon) {
-            fprintf(stderr, "No expression given after asen\n");
-            exit(1);
+            parseError(missingToken(tokens), "No expression given after asen");
       }
 
       if (instructions->type != TermExpr) {
-            fprintf(stderr, "Not a valid expression after asen\n");
-            exit(1);
+            parseError(missingToken(tokens), "Not a valid expression after asen");
       }
 
       if (instructions->value.term.type != LinjaExpr) {
-            fprintf(stderr, "Not a string literal after asen\n");
-            exit(1);
+            parseError(missingToken(tokens), "Not a string literal after asen");
       }
 
       if (tokenPeek(tokens).type != TOKEN_SEMI) {
-            fprintf(stderr, "No ';' after asen\n");
-            exit(1);
+            parseError(missingToken(tokens), "No ';' after asen");
       }
       tokenConsume(tokens);
       
       NodeAsenpeli node;
       node.lon = true;
       node.value = strdup(instructions->value.term.value.linja.string);
+      freeExpression(instructions);
       
       return node;
 }
@@ -852,13 +1690,11 @@ NodeOtawa *parseOtawa(Tokens *tokens, Arena *arena) {
 
             NodeExpression *expr;
             if ((expr = parseExpr(tokens, arena, 0))->lon == false) {
-                  fprintf(stderr, "No value given after otawa\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No value given after otawa");
             }
 
             if (tokenPeek(tokens).type != TOKEN_SEMI) {
-                  fprintf(stderr, "No ';' after otawa\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No ';' after otawa");
             }
             //printf("Expression is %s\n", expr.value.value);
             //NodeExpression* exprptr = pushArena(arena, &expr, sizeof(expr));
@@ -872,18 +1708,57 @@ NodeOtawa *parseOtawa(Tokens *tokens, Arena *arena) {
       return NULL;
 }
 
+// awen, signed and unsigned can come before or after the type
+bool parseTypeModifier(Tokens *tokens, NodeType *type) {
+      int32_t token = tokenPeek(tokens).type;
+      if (token == TOKEN_AWEN) {
+            type->awen = true;
+      } else if (token == TOKEN_SIGNED) {
+            type->isUnsigned = false;
+      } else if (token == TOKEN_UNSIGNED) {
+            type->isUnsigned = true;
+      } else {
+            return false;
+      }
+      tokenConsume(tokens);
+      return true;
+}
+
 NodeType parseType(Tokens *tokens) {
-      NodeType type;
+      NodeType type = {};
       type.lon = true;
       type.awen = false;
-      if (tokenPeek(tokens).type == TOKEN_AWEN) {
-            tokenConsume(tokens);
-            type.awen = true;
-      }
+      type.isUnsigned = false;
+      while (parseTypeModifier(tokens, &type));
       
+      Token name = tokenPeek(tokens);
       if (tokenPeek(tokens).type == TOKEN_NANPA) {
             tokenConsume(tokens);
             type.type = Nanpa;
+            if (tokenPeek(tokens).type == TOKEN_LILI) {
+                  tokenConsume(tokens);
+                  type.type = NanpaLili;
+                  if (tokenPeek(tokens).type == TOKEN_LILI) {
+                        tokenConsume(tokens);
+                        type.type = NanpaLiliLili;
+                  }
+            } else if (tokenPeek(tokens).type == TOKEN_SULI) {
+                  tokenConsume(tokens);
+                  type.type = NanpaSuli;
+            }
+      } else if (tokenPeek(tokens).type == TOKEN_SITELEN) {
+            tokenConsume(tokens);
+            type.type = Sitelen;
+      } else if (tokenPeek(tokens).type == TOKEN_TELO) {
+            tokenConsume(tokens);
+            type.type = Telo;
+            if (tokenPeek(tokens).type == TOKEN_LILI) {
+                  tokenConsume(tokens);
+                  type.type = TeloLili;
+            } else if (tokenPeek(tokens).type == TOKEN_SULI) {
+                  tokenConsume(tokens);
+                  type.type = TeloSuli;
+            }
       } else if (tokenPeek(tokens).type == TOKEN_LINJA) {
             tokenConsume(tokens);
             type.type = Linja;
@@ -891,9 +1766,31 @@ NodeType parseType(Tokens *tokens) {
             return (NodeType){};
       }
 
-      if (tokenPeek(tokens).type == TOKEN_AWEN) {
+      while (parseTypeModifier(tokens, &type));
+      if (type.isUnsigned && (type.type == Linja || type.type == Telo || type.type == TeloLili || type.type == TeloSuli)) {
+            parseError(name, "Only nanpa and sitelen can be unsigned");
+      }
+
+      if (tokenPeek(tokens).type == TOKEN_OBRACKET) {
+            tokenConsume(tokens);
+            if (type.type == Linja) {
+                  parseError(name, "Arrays can only hold nanpa, sitelen and telo");
+            }
+            type.array = true;
+            type.count = 0;
+            type.length = NULL;
+            Token count = tokenPeek(tokens);
+            if (count.type == TOKEN_NUMBER && !isTeloLiteral(count.value)
+                && tokenPeekAhead(tokens, 1).type == TOKEN_CBRACKET) {
+                  type.count = parseNanpaExpr(tokens, NULL).value;
+                  if (type.count <= 0) parseError(count, "An array needs at least one element");
+            } else if (count.type != TOKEN_CBRACKET) {
+                  type.length = parseExpr(tokens, NULL, 0);
+            }
+            if (tokenPeek(tokens).type != TOKEN_CBRACKET) {
+                  parseError(missingToken(tokens), "No ']' after the array length");
+            }
             tokenConsume(tokens);
-            type.awen = true;
       }
 
       return type;
@@ -903,40 +1800,34 @@ NodeO *parseO(Tokens *tokens, Arena *arena) {
       if (tokenPeek(tokens).type == TOKEN_O) {
             tokenConsume(tokens);
             if (tokenPeek(tokens).type != TOKEN_NAME) {
-                  fprintf(stderr, "No name after o\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No name after o");
             }
             Token name = tokenConsume(tokens);
 
             if (tokenPeek(tokens).type != TOKEN_LI) {
-                  fprintf(stderr, "No li after o\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "No li after o");
             }
             tokenConsume(tokens);
 
             NodeType type = parseType(tokens);
 
             if (!type.lon) {
-                  fprintf(stderr, "No type after o\n");
-                  exit(1);                  
+                  parseError(missingToken(tokens), "No type after o");
             }
 
             if (tokenPeek(tokens).type != TOKEN_EQ) { 
-                  fprintf(stderr, "No '=' after o\n");
-                  exit(1);                  
+                  parseError(missingToken(tokens), "No '=' after o");
             }
             tokenConsume(tokens);
 
             NodeExpression *expr = parseExpr(tokens, arena, 0);
 
             if (!expr->lon) {
-                  fprintf(stderr, "No expression after o\n");
-                  exit(1);                  
+                  parseError(missingToken(tokens), "No expression after o");
             }
 
             if (tokenPeek(tokens).type != TOKEN_SEMI) {
-                  fprintf(stderr, "No ';' after o\n");
-                  exit(1);                  
+                  parseError(missingToken(tokens), "No ';' after o");
             }
             tokenConsume(tokens);
 
@@ -945,6 +1836,7 @@ NodeO *parseO(Tokens *tokens, Arena *arena) {
             node->type = type;
             node->expr = expr;
             node->name = name;
+            node->name.value = strdup(name.value);
             
             return node;
       }
@@ -952,59 +1844,282 @@ NodeO *parseO(Tokens *tokens, Arena *arena) {
 }
 
 void parseStatement(Tokens *tokens, Arena *arena, Nodes *nodes);
-      
+
+// How many tenpo and pali bodies the parser is inside of
+size_t blockDepth = 0;
+
+// Offset and line of the start of the body being parsed, node spans are
+// relative to them
+int32_t spanBase = 0;
+int32_t spanLine = 1;
+
+void enterBody(Token keyword, Token la, int32_t *bodyStart, int32_t *bodyLine) {
+      *bodyStart = la.offset + la.length - keyword.offset;
+      *bodyLine = la.line - keyword.line;
+      spanBase = la.offset + la.length;
+      spanLine = la.line;
+      blockDepth++;
+}
+
 NodeTenpo *parseTenpo(Tokens *tokens, Arena* arena) {
       if (tokenPeek(tokens).type != TOKEN_TENPO) {
             assert(false);
       }
-      tokenConsume(tokens);
+      Token keyword = tokenConsume(tokens);
 
       NodeExpression *expr = parseExpr(tokens, arena, 0);
       if (!expr) {
-            fprintf(stderr, "Invalid expression after tenpo\n");
-            exit(1);
+            parseError(missingToken(tokens), "Invalid expression after tenpo");
       }
 
       if (tokenPeek(tokens).type != TOKEN_LA) {
-            fprintf(stderr, "Expected 'la' after tenpo\n");
-            exit(1);
+            parseError(missingToken(tokens), "Expected 'la' after tenpo");
       }
 
-      tokenConsume(tokens);
+      Token la = tokenConsume(tokens);
      
       NodeTenpo *node = malloc(sizeof(NodeTenpo));
       node->expr = expr;
       node->lon = true;
       node->nodes = nodesNew();
+      node->id = tenpoNumber++;
+      node->profiled = false;
 
+      int32_t base = spanBase, baseLine = spanLine;
+      enterBody(keyword, la, &node->bodyStart, &node->bodyLine);
       while (tokenPeek(tokens).type != TOKEN_PINI) {
             if (tokenPeek(tokens).type == -1) {
-                  fprintf(stderr, "Reached end of the expression while in 'tenpo'\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "Reached end of the expression while in 'tenpo'");
             }
             parseStatement(tokens, arena, &node->nodes);
       }
+      blockDepth--;
+      spanBase = base;
+      spanLine = baseLine;
 
       tokenConsume(tokens);
       
       return node;
 }
 
+// Whether the statement ahead is a conditional, an expression up to 'la'
+bool conditionalAhead(Tokens *tokens) {
+      int32_t first = tokenPeek(tokens).type;
+      if (first != TOKEN_NAME && first != TOKEN_NUMBER && first != TOKEN_STRING_LITERAL) return false;
+      for (size_t i = 0; ; i++) {
+            int32_t type = tokenPeekAhead(tokens, i).type;
+            if (type == TOKEN_LA) return true;
+            if (type == TOKEN_SEMI || type == TOKEN_PINI || type == TOKEN_ANTE || type == -1) return false;
+      }
+}
+
+// Set while the conditional chained behind an ante is parsed, the 'pini'
+// belongs to the first conditional of the chain
+bool chainedLa = false;
+
+NodeLa *parseLa(Tokens *tokens, Arena *arena) {
+      bool chained = chainedLa;
+      chainedLa = false;
+      Token keyword = tokenPeek(tokens);
+      NodeExpression *expr = parseExpr(tokens, arena, 0);
+      if (!expr) {
+            parseError(missingToken(tokens), "Invalid condition before la");
+      }
+      if (tokenPeek(tokens).type != TOKEN_LA) {
+            parseError(missingToken(tokens), "Expected 'la' after the condition");
+      }
+      Token la = tokenConsume(tokens);
+
+      NodeLa *node = calloc(1, sizeof(NodeLa));
+      node->lon = true;
+      node->expr = expr;
+      node->nodes = nodesNew();
+      node->ante = nodesNew();
+      node->id = tenpoNumber++;
+
+      int32_t base = spanBase, baseLine = spanLine;
+      enterBody(keyword, la, &node->bodyStart, &node->bodyLine);
+      while (tokenPeek(tokens).type != TOKEN_PINI && tokenPeek(tokens).type != TOKEN_ANTE) {
+            if (tokenPeek(tokens).type == -1) {
+                  parseError(missingToken(tokens), "Reached end of the expression while in 'la'");
+            }
+            parseStatement(tokens, arena, &node->nodes);
+      }
+      blockDepth--;
+
+      if (tokenPeek(tokens).type == TOKEN_ANTE) {
+            Token ante = tokenConsume(tokens);
+            enterBody(keyword, ante, &node->anteStart, &node->anteLine);
+            if (conditionalAhead(tokens)) {
+                  chainedLa = true;
+                  parseStatement(tokens, arena, &node->ante);
+            }
+            while (tokenPeek(tokens).type != TOKEN_PINI) {
+                  if (tokenPeek(tokens).type == -1) {
+                        parseError(missingToken(tokens), "Reached end of the expression while in 'ante'");
+                  }
+                  parseStatement(tokens, arena, &node->ante);
+            }
+            blockDepth--;
+      }
+      spanBase = base;
+      spanLine = baseLine;
+
+      if (!chained) tokenConsume(tokens);
+      return node;
+}
+
+NodePali *parsePali(Tokens *tokens, Arena *arena) {
+      if (tokenPeek(tokens).type != TOKEN_PALI) {
+            assert(false);
+      }
+      Token keyword = tokenConsume(tokens);
+
+      if (tokenPeek(tokens).type != TOKEN_NAME) {
+            parseError(missingToken(tokens), "No name after pali");
+      }
+      Token name = tokenConsume(tokens);
+
+      NodePali *node = calloc(1, sizeof(NodePali));
+      node->lon = true;
+      node->name = strdup(name.value);
+      node->ret = (NodeType){.lon = true, .type = Nanpa};
+
+      if (tokenPeek(tokens).type == TOKEN_PI) {
+            tokenConsume(tokens);
+            if (tokenPeek(tokens).type != TOKEN_OPAREN) {
+                  parseError(missingToken(tokens), "No '(' after pi in pali %s", node->name);
+            }
+            tokenConsume(tokens);
+
+            while (tokenPeek(tokens).type != TOKEN_CPAREN) {
+                  if (node->paramCount > 0) {
+                        if (tokenPeek(tokens).type != TOKEN_COMMA) {
+                              parseError(missingToken(tokens), "No ',' between parameters of pali %s", node->name);
+                        }
+                        tokenConsume(tokens);
+                  }
+                  if (tokenPeek(tokens).type != TOKEN_NAME) {
+                        parseError(missingToken(tokens), "No parameter name in pali %s", node->name);
+                  }
+                  Token param = tokenConsume(tokens);
+                  if (tokenPeek(tokens).type != TOKEN_LI) {
+                        parseError(missingToken(tokens), "No li after parameter %s", (char*) param.value);
+                  }
+                  tokenConsume(tokens);
+                  NodeType type = parseType(tokens);
+                  if (!type.lon) {
+                        parseError(missingToken(tokens), "No type after parameter %s", (char*) param.value);
+                  }
+                  if (type.array && (type.count || type.length)) {
+                        parseError(param, "Array parameters take any length, like %s li nanpa[]", (char*) param.value);
+                  }
+                  node->params = realloc(node->params, sizeof(char*)*(node->paramCount + 1));
+                  node->paramTypes = realloc(node->paramTypes, sizeof(NodeType)*(node->paramCount + 1));
+                  node->params[node->paramCount] = strdup(param.value);
+                  node->paramTypes[node->paramCount] = type;
+                  node->paramCount++;
+            }
+            tokenConsume(tokens);
+      }
+
+      if (tokenPeek(tokens).type == TOKEN_LI) {
+            tokenConsume(tokens);
+            if (tokenPeek(tokens).type != TOKEN_PANA) {
+                  parseError(missingToken(tokens), "Expected 'pana' after li in pali %s", node->name);
+            }
+            tokenConsume(tokens);
+            Token ret = tokenPeek(tokens);
+            node->ret = parseType(tokens);
+            if (!node->ret.lon) {
+                  parseError(missingToken(tokens), "No return type after pana in pali %s", node->name);
+            }
+            if (node->ret.array && (node->ret.count || node->ret.length)) {
+                  parseError(ret, "pali return arrays of any length, like nanpa[]");
+            }
+      }
+
+      if (tokenPeek(tokens).type != TOKEN_LA) {
+            parseError(missingToken(tokens), "Expected 'la' after pali %s", node->name);
+      }
+      Token la = tokenConsume(tokens);
+
+      node->nodes = nodesNew();
+      int32_t base = spanBase, baseLine = spanLine;
+      enterBody(keyword, la, &node->bodyStart, &node->bodyLine);
+      while (tokenPeek(tokens).type != TOKEN_PINI) {
+            if (tokenPeek(tokens).type == -1) {
+                  parseError(missingToken(tokens), "Reached end of the expression while in 'pali'");
+            }
+            parseStatement(tokens, arena, &node->nodes);
+      }
+      blockDepth--;
+      spanBase = base;
+      spanLine = baseLine;
+      tokenConsume(tokens);
+
+      return node;
+}
+
+// Skips to the start of the next statement after an error: past the next
+// ';', past a whole block whose 'la' was skipped, or up to the 'pini' that
+// closes the enclosing block.
+void synchronize(Tokens *tokens) {
+      size_t nesting = 0;
+      // The 'la' of a conditional chained behind an ante shares its 'pini'
+      bool chained = false;
+      while (tokenPeek(tokens).type != -1) {
+            int32_t type = tokenPeek(tokens).type;
+            if (type == TOKEN_PINI) {
+                  if (nesting == 0 && blockDepth > 0) return;
+                  tokenConsume(tokens);
+                  if (nesting <= 1) return;
+                  nesting--;
+                  continue;
+            }
+            tokenConsume(tokens);
+            if (type == TOKEN_LA && !chained) nesting++;
+            if (type == TOKEN_ANTE) chained = true;
+            else if (type == TOKEN_LA || type == TOKEN_SEMI || type == TOKEN_TENPO) chained = false;
+            if (type == TOKEN_SEMI && nesting == 0) return;
+      }
+}
+
 void parseStatement(Tokens *tokens, Arena *arena, Nodes *nodes) {
+      TRACE_ZONE("parseStatement");
+      jmp_buf here;
+      jmp_buf *outer = recovery;
+      size_t depth = blockDepth;
+      int32_t base = spanBase, baseLine = spanLine;
+      size_t start = curToken;
+      size_t count = nodes->size;
+      if (setjmp(here)) {
+            recovery = outer;
+            blockDepth = depth;
+            spanBase = base;
+            spanLine = baseLine;
+            // Always make progress, even when the error is on the first token
+            if (curToken == start && tokenPeek(tokens).type != -1
+                && (tokenPeek(tokens).type != TOKEN_PINI || blockDepth == 0)) {
+                  if (tokenConsume(tokens).type == TOKEN_SEMI) return;
+            }
+            synchronize(tokens);
+            return;
+      }
+      recovery = &here;
+
       Token token = tokenPeek(tokens);
       if (token.type == TOKEN_OTAWA) {
             NodeOtawa *otawa = parseOtawa(tokens, arena);
             if (!otawa) {
-                  fprintf(stderr, "Unable to parse O-expression\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "Unable to parse O-expression");
             }
                   
             addNode(nodes, (Node) {.type = Otawa, .node.otawa = otawa});
       } else if (token.type == TOKEN_O) {
             NodeO *o = parseO(tokens, arena);
             if (!o) {
-                  fprintf(stderr, "Unable to parse O-expression\n");
-                  exit(1);
+                  parseError(missingToken(tokens), "Unable to parse O-expression");
             }
             addNode(nodes, (Node){.type = O, .node.o = o});
       } else if (token.type == TOKEN_ASEN) {
@@ -1013,12 +2128,37 @@ void parseStatement(Tokens *tokens, Arena *arena, Nodes *nodes) {
       } else if (token.type == TOKEN_TENPO) {
             NodeTenpo *tenpo = parseTenpo(tokens, arena);
             addNode(nodes, (Node){.type = Tenpo, .node.tenpo = tenpo});
+      } else if (conditionalAhead(tokens)) {
+            NodeLa *la = parseLa(tokens, arena);
+            addNode(nodes, (Node){.type = La, .node.la = la});
+      } else if (token.type == TOKEN_NAME && (tokenPeekAhead(tokens, 1).type == TOKEN_OPAREN
+                                              || tokenPeekAhead(tokens, 1).type == TOKEN_DOT)) {
+            NodeExpression *expr = parseExpr(tokens, arena, 0);
+            if (tokenPeek(tokens).type != TOKEN_SEMI) {
+                  parseError(missingToken(tokens), "No ';' after call to %s", (char*) token.value);
+            }
+            tokenConsume(tokens);
+            addNode(nodes, (Node){.type = Expression, .node.expr = expr});
       } else if (token.type == TOKEN_NAME) {
             NodeKama kama = parseKama(tokens, arena);
             addNode(nodes, (Node){.type = Kama, .node.kama = kama});
+      } else if (token.type == TOKEN_PALI) {
+            if (blockDepth > 0) {
+                  parseError(token, "pali is only allowed at the top level");
+            }
+            NodePali *pali = parsePali(tokens, arena);
+            addNode(nodes, (Node){.type = Pali, .node.pali = pali});
       } else {
-            fprintf(stderr, "Unable to parse the expression\n");
-            exit(1);
+            parseError(token, "Unable to parse the expression");
+      }
+      recovery = outer;
+
+      if (nodes->size > count) {
+            Token last = tokens->tokens[curToken - 1];
+            Node *node = &nodes->nodes[nodes->size - 1];
+            node->start = token.offset - spanBase;
+            node->end = last.offset + last.length - spanBase;
+            node->line = token.line - spanLine;
       }
 }
 
@@ -1029,234 +2169,4111 @@ Prog parse(Tokens *tokens) {
       while(tokenPeek(tokens).type != -1) {
             parseStatement(tokens, &program.arena, &program.nodes);
       }
+      program.tenpoCount = tenpoNumber;
       return program;
 }
 
-size_t stackOffset = 0;
-
-void push(size_t i) {
-      printf("    mov r8, %ld\n"
-             "    push r8\n",
-             i);
-      stackOffset++;
+// Names, numbers and linja own the text the lexer copied for them
+void freeTokens(Tokens *tokens) {
+      for (size_t i = 0; i < tokens->size; i++) {
+            int32_t type = tokens->tokens[i].type;
+            if (type == TOKEN_NAME || type == TOKEN_NUMBER || type == TOKEN_STRING_LITERAL) free(tokens->tokens[i].value);
+      }
+      free(tokens->tokens);
 }
 
-void push_str(char *str) {
-      printf("    mov r8, %s\n"
-             "    push r8\n",
-             str);
-      stackOffset++;
+// Frees what the parser allocated for the nodes, for documents that are
+// parsed again while the server keeps running
+void freeNodes(Nodes *nodes);
+
+void freeExpression(NodeExpression *expr) {
+      if (!expr) return;
+      if (expr->type == BinaryExpr) {
+            freeExpression(expr->value.binExpr->lhs);
+            freeExpression(expr->value.binExpr->rhs);
+            free(expr->value.binExpr);
+            free(expr);
+            return;
+      }
+      NodeTerm term = expr->value.term;
+      if (term.type == NimiExpr) free(term.value.nimi.value);
+      else if (term.type == LinjaExpr) free(term.value.linja.string);
+      else if (term.type == IndexExpr) {
+            free(term.value.index.nimi.value);
+            freeExpression(term.value.index.index);
+      } else if (term.type == KamaExpr) {
+            free(term.value.kama.nimi.value);
+            freeExpression(term.value.kama.index);
+            freeExpression(term.value.kama.expr);
+      } else if (term.type == CallExpr) {
+            free(term.value.call.name);
+            for (size_t i = 0; i < term.value.call.argc; i++) freeExpression(term.value.call.args[i]);
+            free(term.value.call.args);
+      }
+      free(expr);
 }
 
-void push_reg(char *str) {
-      printf("    push %s\n",
-             str);
-      stackOffset++;
+void freeNode(Node node) {
+      switch (node.type) {
+      case Expression:
+            freeExpression(node.node.expr);
+            break;
+      case Otawa:
+            freeExpression(node.node.otawa->expr);
+            free(node.node.otawa);
+            break;
+      case O:
+            free(node.node.o->name.value);
+            freeExpression(node.node.o->type.length);
+            freeExpression(node.node.o->expr);
+            free(node.node.o);
+            break;
+      case Type:
+            freeExpression(node.node.type.length);
+            break;
+      case Asen:
+            free(node.node.asen.value);
+            break;
+      case Tenpo:
+            freeExpression(node.node.tenpo->expr);
+            freeNodes(&node.node.tenpo->nodes);
+            free(node.node.tenpo);
+            break;
+      case La:
+            freeExpression(node.node.la->expr);
+            freeNodes(&node.node.la->nodes);
+            freeNodes(&node.node.la->ante);
+            free(node.node.la);
+            break;
+      case Kama:
+            free(node.node.kama.kama->nimi.value);
+            freeExpression(node.node.kama.kama->index);
+            freeExpression(node.node.kama.kama->expr);
+            free(node.node.kama.kama);
+            break;
+      case Pali:
+            free(node.node.pali->name);
+            for (size_t i = 0; i < node.node.pali->paramCount; i++) free(node.node.pali->params[i]);
+            free(node.node.pali->params);
+            free(node.node.pali->paramTypes);
+            freeNodes(&node.node.pali->nodes);
+            free(node.node.pali);
+            break;
+      }
 }
 
-void pop(char* reg) {
-      printf("    pop %s\n",
-             reg);
-      stackOffset--;
+void freeNodes(Nodes *nodes) {
+      for (size_t i = 0; i < nodes->size; i++) freeNode(nodes->nodes[i]);
+      free(nodes->nodes);
+      *nodes = (Nodes){};
 }
 
-void generateAsenpeli(NodeAsenpeli asen) {
-      printf("\n    ;; Start raw assembly instructions\n");
-      printf("%s", asen.value);
-      printf("\n    ;; End raw assebly instructions\n");
-}
+int optLevel = 1;
+bool debugInfo = false;
+size_t inlineThreshold = 16;
+bool inlineReport = false;
+bool tailCalls = true;
+Palis palis;
 
-void generateExpression(NodeExpression expr);
+// Calls to these are generated in place and use the runtime
+char *builtins[] = {"otokis", "pakala", "lukin"};
 
-void generateTerm(NodeTerm term) {
-      if (term.type == NanpaExpr) {
-             push(term.value.nanpa.value);
-      } else if (term.type == NimiExpr) {
-            if (!hasNameMap(&vars, term.value.nimi.value)) {
-                  printf("Undefined identifier %s\n", (char*) term.value.nimi.value);
-                  exit(1);
-            }
-            size_t offset = getNameMap(&vars, term.value.nimi.value);
-            printf("    mov r8, rsp\n"
-                   "    add r8, %ld\n", (stackOffset - offset) * 8);
-            
-            push_str("[r8]");
-      } else if (term.type == KamaExpr) {
-            //printf("kama expression\n");
-            if (!hasNameMap(&vars, term.value.kama.nimi.value)) {
-                  fprintf(stderr, "Undefined identifier %s\n", (char*) term.value.nimi.value);
-                  exit(1);
+bool isBuiltin(char *name) {
+      for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+            if (!strcmp(builtins[i], name)) return true;
+      }
+      return false;
+}
+
+void collectPalis(Prog *prog) {
+      palis = palisNew();
+      for (size_t i = 0; i < prog->nodes.size; i++) {
+            Node node = getNode(&prog->nodes, i);
+            if (node.type != Pali) continue;
+            node.node.pali->callSites = 0;
+            node.node.pali->called = false;
+            node.node.pali->emitted = false;
+            node.node.pali->line = 1 + node.line;
+            if (isBuiltin(node.node.pali->name)) {
+                  fprintf(errors, "%s is built in and can't be declared as a pali\n", node.node.pali->name);
+                  fail();
             }
-            NodeType type = getNameMapType(&vars, term.value.kama.nimi.value);
-            if (type.awen) {
-                  fprintf(stderr, "Trying to change an awen value\n");
-                  exit(1);
+            if (getPalis(&palis, node.node.pali->name)) {
+                  fprintf(errors, "Duplicate pali declaration %s\n", node.node.pali->name);
+                  fail();
             }
-            size_t offset = getNameMap(&vars, term.value.kama.nimi.value);
-            //printf("offset is %ld\n", offset);
-            generateExpression(*term.value.kama.expr);
-
-            pop("r8");
-            printf("    mov r9, rsp\n"
-                   "    add r9, %ld\n"
-                   "    mov [r9], r8\n",
-                   (stackOffset - offset) * 8);
-            push_reg("r8");
+            addPalis(&palis, node.node.pali);
       }
 }
 
-void generateBinaryExpression(NodeBinaryExpression binExpr);
+bool nodesCall(Nodes *nodes, char *name);
 
-void generateExpression(NodeExpression expr) {
-      if (expr.type == TermExpr) {
-            generateTerm(expr.value.term);
-      } else if (expr.type == BinaryExpr) {
-            generateBinaryExpression(*expr.value.binExpr);
+bool expressionCalls(NodeExpression *expr, char *name) {
+      if (expr->type == BinaryExpr) {
+            return expressionCalls(expr->value.binExpr->lhs, name)
+                  || expressionCalls(expr->value.binExpr->rhs, name);
+      }
+      if (expr->value.term.type == IndexExpr) return expressionCalls(expr->value.term.value.index.index, name);
+      if (expr->value.term.type != CallExpr) return false;
+      NodeCallExpression call = expr->value.term.value.call;
+      if (!strcmp(call.name, name)) return true;
+      for (size_t i = 0; i < call.argc; i++) {
+            if (expressionCalls(call.args[i], name)) return true;
       }
+      return false;
 }
 
-void generateKama(NodeKama kama) {
-      NodeTerm term = (NodeTerm){.lon = true, .type = KamaExpr, .value.kama = *kama.kama};
-      generateTerm(term);
-      pop("r8");
+bool nodesCall(Nodes *nodes, char *name) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Expression && expressionCalls(node.node.expr, name)) return true;
+            if (node.type == Otawa && expressionCalls(node.node.otawa->expr, name)) return true;
+            if (node.type == O && expressionCalls(node.node.o->expr, name)) return true;
+            if (node.type == O && node.node.o->type.length
+                && expressionCalls(node.node.o->type.length, name)) return true;
+            if (node.type == Kama && expressionCalls(node.node.kama.kama->expr, name)) return true;
+            if (node.type == Kama && node.node.kama.kama->index
+                && expressionCalls(node.node.kama.kama->index, name)) return true;
+            if (node.type == Tenpo && (expressionCalls(node.node.tenpo->expr, name)
+                                       || nodesCall(&node.node.tenpo->nodes, name))) return true;
+            if (node.type == La && (expressionCalls(node.node.la->expr, name) || nodesCall(&node.node.la->nodes, name)
+                                    || nodesCall(&node.node.la->ante, name))) return true;
+      }
+      return false;
 }
 
-void generateBinaryExpression(NodeBinaryExpression binExpr) {
-      generateExpression(*binExpr.lhs);
-      generateExpression(*binExpr.rhs);
+// Rough size of the code a body expands to, counted in AST nodes.
+size_t costExpression(NodeExpression *expr) {
+      if (expr->type == BinaryExpr) {
+            return 1 + costExpression(expr->value.binExpr->lhs) + costExpression(expr->value.binExpr->rhs);
+      }
+      if (expr->value.term.type == IndexExpr) return 2 + costExpression(expr->value.term.value.index.index);
+      if (expr->value.term.type != CallExpr) return 1;
+      size_t cost = 2;
+      for (size_t i = 0; i < expr->value.term.value.call.argc; i++) {
+            cost += costExpression(expr->value.term.value.call.args[i]);
+      }
+      return cost;
+}
 
-      switch(binExpr.type) {
-      case BinAdd:
-            pop("r9");
-            pop("r8");
-            printf("    add r8, r9\n");
-            push_reg("r8");
-            break;
-      case BinSub:
-            pop("r9");
-            pop("r8");
-            printf("    sub r8, r9\n");
-            push_reg("r8");
-            break;
-      case BinMul:
-            pop("r8");
-            pop("rax");
+size_t costNodes(Nodes *nodes) {
+      size_t cost = 0;
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            cost++;
+            if (node.type == Expression) cost += costExpression(node.node.expr);
+            else if (node.type == Otawa) cost += costExpression(node.node.otawa->expr);
+            else if (node.type == O) {
+                  cost += costExpression(node.node.o->expr);
+                  if (node.node.o->type.length) cost += 2 + costExpression(node.node.o->type.length);
+            }
+            else if (node.type == Kama) {
+                  cost += costExpression(node.node.kama.kama->expr);
+                  if (node.node.kama.kama->index) cost += 1 + costExpression(node.node.kama.kama->index);
+            }
+            else if (node.type == Asen) cost += 8;
+            else if (node.type == Tenpo) {
+                  cost += costExpression(node.node.tenpo->expr) + costNodes(&node.node.tenpo->nodes);
+            }
+            else if (node.type == La) {
+                  cost += costExpression(node.node.la->expr) + costNodes(&node.node.la->nodes) + costNodes(&node.node.la->ante);
+            }
+      }
+      return cost;
+}
 
-            printf("    mov rdx, 0\n"
-                   "    mul r8\n");
-            push_reg("rax");
-            break;
-      case BinDiv:
-            pop("r8");
-            pop("rax");
+void countCallSitesNodes(Nodes *nodes);
 
-            printf("    mov rdx, 0\n"
-                   "    div r8\n");
-            push_reg("rax");
-            break;
-      case BinGt:
-            pop("r9");
-            pop("r8");
-            printf("    push 1\n"
-                   "    cmp r8, r9\n"
-                   "    jg $+6\n"
-                   "    pop r8\n"
-                   "    push 0\n");                   
-            stackOffset++;
-            break;
-      case BinEq:
-            pop("r9");
-            pop("r8");
-            printf("    push 1\n"
-                   "    cmp r8, r9\n"
-                   "    je $+6\n"
-                   "    pop r8\n"
-                   "    push 0\n");
-            stackOffset++;
-            break;
-      case BinLt:
-            pop("r9");
-            pop("r8");
-            printf("    push 1\n"
-                   "    cmp r8, r9\n"
-                   "    jl $+6\n"
-                   "    pop r8\n"
-                   "    push 0\n");
-            stackOffset++;
-                   break;                   
-      default:
+void countCallSites(NodeExpression *expr) {
+      if (expr->type == BinaryExpr) {
+            countCallSites(expr->value.binExpr->lhs);
+            countCallSites(expr->value.binExpr->rhs);
             return;
-            break;
       }
-      
+      if (expr->value.term.type == IndexExpr) countCallSites(expr->value.term.value.index.index);
+      if (expr->value.term.type != CallExpr) return;
+      NodeCallExpression call = expr->value.term.value.call;
+      NodePali *callee = getPalis(&palis, call.name);
+      if (callee) callee->callSites++;
+      for (size_t i = 0; i < call.argc; i++) {
+            countCallSites(call.args[i]);
+      }
 }
 
-void generateO(NodeO o) {
-      int x = 5;
-      if (hasNameMap(&vars, o.name.value)) {
-            fprintf(stderr, "Duplicate variable declaration");
-            exit(1);
+void countCallSitesNodes(Nodes *nodes) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Expression) countCallSites(node.node.expr);
+            else if (node.type == Otawa) countCallSites(node.node.otawa->expr);
+            else if (node.type == O) {
+                  countCallSites(node.node.o->expr);
+                  if (node.node.o->type.length) countCallSites(node.node.o->type.length);
+            }
+            else if (node.type == Kama) {
+                  countCallSites(node.node.kama.kama->expr);
+                  if (node.node.kama.kama->index) countCallSites(node.node.kama.kama->index);
+            }
+            else if (node.type == Pali) countCallSitesNodes(&node.node.pali->nodes);
+            else if (node.type == Tenpo) {
+                  countCallSites(node.node.tenpo->expr);
+                  countCallSitesNodes(&node.node.tenpo->nodes);
+            }
+            else if (node.type == La) {
+                  countCallSites(node.node.la->expr);
+                  countCallSitesNodes(&node.node.la->nodes);
+                  countCallSitesNodes(&node.node.la->ante);
+            }
       }
-      generateExpression(*o.expr);
-     
-      pop("r8");
-      push_reg("r8");
+}
 
-      if (o.name.type != TOKEN_NAME)
-            assert(false);
+void inlineNodes(Nodes *nodes, NodePali *within, NodeTenpo *loop, size_t loopDepth);
 
-      if (!o.type.lon)
-            assert(false);
-      
-      addNameMap(&vars, o.name.value, stackOffset, o.type);
+// How many times more often than straight-line code a site in this loop runs.
+// Without a profile this is guessed from the loop depth, with one it is the
+// measured number of iterations on a log scale.
+size_t loopWeight(NodeTenpo *loop, size_t loopDepth) {
+      if (!loop || !loop->profiled) return 1 + 3*loopDepth;
+      size_t weight = 1;
+      for (uint64_t n = loop->iterations; n > 1; n >>= 2) weight++;
+      return weight;
 }
 
-void generateOtawa(NodeOtawa otawa) {
-      generateExpression(*otawa.expr);
-      pop("rdi");
-      printf("    mov rax, 60\n"
-             "    syscall\n");
-}
+// A call site is inlined when the callee's size fits the budget. Sites inside
+// tenpo loops get a budget that grows with how hot the loop is, and a pali with
+// a single call site gets twice the budget since its body can then be dropped.
+void inlineExpression(NodeExpression *expr, NodePali *within, NodeTenpo *loop, size_t loopDepth) {
+      if (expr->type == BinaryExpr) {
+            inlineExpression(expr->value.binExpr->lhs, within, loop, loopDepth);
+            inlineExpression(expr->value.binExpr->rhs, within, loop, loopDepth);
+            return;
+      }
+      if (expr->value.term.type == IndexExpr) {
+            inlineExpression(expr->value.term.value.index.index, within, loop, loopDepth);
+            return;
+      }
+      if (expr->value.term.type != CallExpr) return;
+      NodeCallExpression *call = &expr->value.term.value.call;
+      for (size_t i = 0; i < call->argc; i++) {
+            inlineExpression(call->args[i], within, loop, loopDepth);
+      }
 
-void generateTenpo(NodeTenpo tenpo);
+      NodePali *callee = getPalis(&palis, call->name);
+      call->inlined = false;
+      if (optLevel < 1 || !callee || callee == within) return;
+      if (nodesCall(&callee->nodes, callee->name)) return;
+
+      size_t cost = costNodes(&callee->nodes);
+      size_t budget = inlineThreshold * loopWeight(loop, loopDepth);
+      if (loop && loop->profiled && loop->iterations == 0) budget /= 2;
+      if (callee->callSites == 1) budget *= 2;
+      call->inlined = cost <= budget;
+      if (!call->inlined) return;
+
+      if (inlineReport) {
+            fprintf(errors, "inline: %s into %s (cost %zu, budget %zu, loop depth %zu)\n",
+                    callee->name, within ? within->name : "_start", cost, budget, loopDepth);
+      }
+}
 
-void generateStatement(Node* node) {
-      if (node->type == Otawa) generateOtawa(*node->node.otawa);
-      else if (node->type == Asen) generateAsenpeli(node->node.asen);
-      else if (node->type == O) generateO(*node->node.o);
-      else if (node->type == Kama) generateKama(node->node.kama);
-      else if (node->type == Tenpo) generateTenpo(*node->node.tenpo);
+void inlineNodes(Nodes *nodes, NodePali *within, NodeTenpo *loop, size_t loopDepth) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Expression) inlineExpression(node.node.expr, within, loop, loopDepth);
+            else if (node.type == Otawa) {
+                  NodeExpression *expr = node.node.otawa->expr;
+                  inlineExpression(expr, within, loop, loopDepth);
+                  // A pali that calls back into this one stays a tail call,
+                  // which runs in constant stack where the expansion wouldn't
+                  if (tailCalls && within && expr->type == TermExpr && expr->value.term.type == CallExpr) {
+                        NodePali *callee = getPalis(&palis, expr->value.term.value.call.name);
+                        if (callee && nodesCall(&callee->nodes, within->name)) expr->value.term.value.call.inlined = false;
+                  }
+            }
+            else if (node.type == O) {
+                  inlineExpression(node.node.o->expr, within, loop, loopDepth);
+                  if (node.node.o->type.length) inlineExpression(node.node.o->type.length, within, loop, loopDepth);
+            }
+            else if (node.type == Kama) {
+                  inlineExpression(node.node.kama.kama->expr, within, loop, loopDepth);
+                  if (node.node.kama.kama->index) inlineExpression(node.node.kama.kama->index, within, loop, loopDepth);
+            }
+            else if (node.type == Pali) inlineNodes(&node.node.pali->nodes, node.node.pali, NULL, 0);
+            else if (node.type == Tenpo) {
+                  inlineExpression(node.node.tenpo->expr, within, node.node.tenpo, loopDepth + 1);
+                  inlineNodes(&node.node.tenpo->nodes, within, node.node.tenpo, loopDepth + 1);
+            }
+            else if (node.type == La) {
+                  inlineExpression(node.node.la->expr, within, loop, loopDepth);
+                  inlineNodes(&node.node.la->nodes, within, loop, loopDepth);
+                  inlineNodes(&node.node.la->ante, within, loop, loopDepth);
+            }
+      }
 }
 
-size_t loopNumber = 0;
+void inlinePass(Prog *prog) {
+      countCallSitesNodes(&prog->nodes);
+      inlineNodes(&prog->nodes, NULL, NULL, 0);
+}
 
-void generateTenpo(NodeTenpo tenpo) {
-      printf(".loopin%ld:\n", loopNumber);
-      size_t oldLoop = loopNumber++;
-      generateExpression(*tenpo.expr);
-      pop("rcx");
-      printf("    cmp rcx, 0\n"
-             "    je .loopout%ld\n",
-             oldLoop);
-      for (size_t i = 0; i < tenpo.nodes.size; i++) {
-            Node node = getNode(&tenpo.nodes, i);
-            generateStatement(&node);
+// Instrumented programs count, for every tenpo, how often it is entered and
+// how many iterations it runs, and for every la how often it is reached and
+// how often its la branch is taken. The counters are written to the profile
+// file on exit. They are indexed by the node's id, its position in the
+// source, so inlined copies of a loop add up into the same counters.
+char *instrumentPath = NULL;
+char *profilePath = NULL;
+
+#define PROFILE_MAGIC "LPCPROF1"
+
+void applyProfileNodes(Nodes *nodes, uint64_t *counters) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Pali) applyProfileNodes(&node.node.pali->nodes, counters);
+            if (node.type == La) {
+                  NodeLa *la = node.node.la;
+                  la->profiled = counters != NULL;
+                  la->entries = counters ? counters[la->id*2] : 0;
+                  la->taken = counters ? counters[la->id*2 + 1] : 0;
+                  applyProfileNodes(&la->nodes, counters);
+                  applyProfileNodes(&la->ante, counters);
+            }
+            if (node.type != Tenpo) continue;
+            NodeTenpo *tenpo = node.node.tenpo;
+            tenpo->profiled = counters != NULL;
+            tenpo->entries = counters ? counters[tenpo->id*2] : 0;
+            tenpo->iterations = counters ? counters[tenpo->id*2 + 1] : 0;
+            applyProfileNodes(&tenpo->nodes, counters);
       }
-      printf("    jmp .loopin%ld\n"
-             ".loopout%ld:\n",
-             oldLoop, oldLoop);
 }
 
-void generate(Prog prog) {
-      printf("global _start\n"
+void applyProfile(Prog *prog, char *path) {
+      FILE *f = fopen(path, "rb");
+      if (!f) {
+            fprintf(errors, "Unable to open profile %s\n", path);
+            fail();
+      }
+      char magic[8];
+      uint64_t count;
+      if (fread(magic, 1, 8, f) != 8 || memcmp(magic, PROFILE_MAGIC, 8)
+          || fread(&count, sizeof(count), 1, f) != 1) {
+            fprintf(errors, "%s is not a profile\n", path);
+            fclose(f);
+            fail();
+      }
+      if (count != tenpoNumber) {
+            fprintf(errors, "WARNING: profile %s is for a different program, ignoring it\n", path);
+            fclose(f);
+            return;
+      }
+      uint64_t *counters = calloc(count*2 + 1, sizeof(uint64_t));
+      if (fread(counters, sizeof(uint64_t), count*2, f) != count*2) {
+            fprintf(errors, "Truncated profile %s\n", path);
+            fclose(f);
+            free(counters);
+            fail();
+      }
+      fclose(f);
+      applyProfileNodes(&prog->nodes, counters);
+      free(counters);
+}
+
+_Thread_local size_t stackOffset = 0;
+
+void push(int64_t i) {
+      if (i >= INT32_MIN && i <= INT32_MAX) {
+            fprintf(out, "    push %ld\n", i);
+      } else {
+            fprintf(out, "    mov r8, %ld\n"
+                   "    push r8\n",
+                   i);
+      }
+      stackOffset++;
+}
+
+void push_str(char *str) {
+      fprintf(out, "    mov r8, %s\n"
+             "    push r8\n",
+             str);
+      stackOffset++;
+}
+
+void push_reg(char *str) {
+      fprintf(out, "    push %s\n",
+             str);
+      stackOffset++;
+}
+
+void pop(char* reg) {
+      fprintf(out, "    pop %s\n",
+             reg);
+      stackOffset--;
+}
+
+// Every o gets a fixed slot below rbp, reserved by a single sub in the
+// prologue. Inlined pali borrow slots from the frame they are expanded in
+// and hand them back afterwards, so the frame is as big as the deepest point.
+// Slots are as big as their type and aligned to their size.
+_Thread_local size_t frameBytes = 0;
+_Thread_local size_t frameMax = 0;
+
+int64_t allocAligned(size_t size, size_t align) {
+      frameBytes = (frameBytes + size + align - 1) / align * align;
+      if (frameBytes > frameMax) frameMax = frameBytes;
+      return -(int64_t)frameBytes;
+}
+
+int64_t allocSlot(size_t size) {
+      return allocAligned(size, size);
+}
+
+// sitelen is 1 byte, nanpa lili lili 2, nanpa lili and telo lili 4, linja
+// and arrays 16 and everything else 8. Values are always 64 bit in registers
+// and on the stack, narrow ones are extended on load and truncated on store.
+size_t typeSize(NodeType type) {
+      if (type.array) return 16;
+      switch (type.type) {
+      case Linja:
+            return 16;
+      case Sitelen:
+            return 1;
+      case NanpaLiliLili:
+            return 2;
+      case NanpaLili:
+      case TeloLili:
+            return 4;
+      default:
+            return 8;
+      }
+}
+
+char *sizeName(size_t size) {
+      return size == 1 ? "byte" : size == 2 ? "word" : size == 4 ? "dword" : "qword";
+}
+
+// The low size bytes of a 64 bit register
+char *subRegister(char *reg, size_t size) {
+      static char *registers[][4] = {
+            {"rax", "eax", "ax", "al"}, {"rcx", "ecx", "cx", "cl"},
+            {"rdx", "edx", "dx", "dl"}, {"rdi", "edi", "di", "dil"},
+            {"r8", "r8d", "r8w", "r8b"}, {"r9", "r9d", "r9w", "r9b"},
+            {"r10", "r10d", "r10w", "r10b"}, {"r11", "r11d", "r11w", "r11b"},
+      };
+      int index = size == 8 ? 0 : size == 4 ? 1 : size == 2 ? 2 : 3;
+      for (size_t i = 0; i < sizeof(registers) / sizeof(registers[0]); i++) {
+            if (!strcmp(registers[i][0], reg)) return registers[i][index];
+      }
+      assert(false);
+      return reg;
+}
+
+typedef struct {
+      bool lon;
+      bool memory;
+      char text[32];
+} Operand;
+
+Operand slotOperand(int64_t displacement) {
+      Operand op = {.lon = true, .memory = true};
+      snprintf(op.text, sizeof(op.text), "qword [rbp%+ld]", displacement);
+      return op;
+}
+
+Operand varOperand(int64_t displacement, NodeType type) {
+      Operand op = {.lon = true, .memory = true};
+      snprintf(op.text, sizeof(op.text), "%s [rbp%+ld]", sizeName(typeSize(type)), displacement);
+      return op;
+}
+
+// Loads a value of type from memory into the 64 bit register reg
+void loadOperand(char *reg, char *operand, NodeType type) {
+      size_t size = typeSize(type);
+      if (size == 8) {
+            fprintf(out, "    mov %s, %s\n", reg, operand);
+      } else if (size == 4 && type.isUnsigned) {
+            fprintf(out, "    mov %s, %s\n", subRegister(reg, 4), operand);
+      } else {
+            fprintf(out, "    %s %s, %s\n", size == 4 ? "movsxd" : type.isUnsigned ? "movzx" : "movsx", reg, operand);
+      }
+}
+
+void loadVar(char *reg, int64_t displacement, NodeType type) {
+      loadOperand(reg, varOperand(displacement, type).text, type);
+}
+
+// Truncates the 64 bit register reg to type, the way storing and loading
+// it again would
+void extendRegister(char *reg, NodeType type) {
+      size_t size = typeSize(type);
+      if (size == 8) return;
+      if (size == 4 && type.isUnsigned) {
+            fprintf(out, "    mov %s, %s\n", subRegister(reg, 4), subRegister(reg, 4));
+      } else {
+            fprintf(out, "    %s %s, %s\n", size == 4 ? "movsxd" : type.isUnsigned ? "movzx" : "movsx", reg, subRegister(reg, size));
+      }
+}
+
+int64_t lookupVar(char *name) {
+      if (!hasNameMap(&vars, name)) {
+            fprintf(errors, "Undefined identifier %s\n", name);
+            fail();
+      }
+      return getNameMap(&vars, name);
+}
+
+// telo lili is a 32 bit float, telo and telo suli are 64 bit doubles. telo
+// values are computed in xmm0, and take up an 8 byte slot or stack entry
+// like everything else.
+bool isTelo(NodeType type) {
+      return type.lon && !type.array && (type.type == Telo || type.type == TeloLili || type.type == TeloSuli);
+}
+
+char *teloSuffix(NodeType type) {
+      return type.type == TeloLili ? "ss" : "sd";
+}
+
+char *teloSize(NodeType type) {
+      return type.type == TeloLili ? "dword" : "qword";
+}
+
+NodeType nanpaType = {.lon = true, .type = Nanpa};
+NodeType teloType = {.lon = true, .type = Telo};
+NodeType linjaType = {.lon = true, .type = Linja};
+
+// A linja is a pointer and a length, in r8 and r9 while it is computed and
+// as two stack entries with the pointer on top. Literals live in .rodata
+// with their length in the qword in front of them.
+bool isLinja(NodeType type) {
+      return type.lon && !type.array && type.type == Linja;
+}
+
+// Arrays are a pointer and a length too, and are passed around like linja.
+// Arrays with a count that fits FRAME_ARRAY_MAX are the exception: their
+// elements are in the frame, the name is bound to the first one and the
+// pointer and length are made up when they are needed.
+#define FRAME_ARRAY_MAX 65536
+
+bool isArray(NodeType type) {
+      return type.lon && type.array;
+}
+
+bool inFrame(NodeType type) {
+      return isArray(type) && type.count && !type.length
+            && type.count <= FRAME_ARRAY_MAX / (int64_t)typeSize((NodeType){.lon = true, .type = type.type});
+}
+
+NodeType elementType(NodeType type) {
+      return (NodeType){.lon = true, .type = type.type, .awen = type.awen, .isUnsigned = type.isUnsigned};
+}
+
+bool isPair(NodeType type) {
+      return isLinja(type) || isArray(type);
+}
+
+// Stack entries a value of type takes up
+size_t stackEntries(NodeType type) {
+      return isPair(type) ? 2 : 1;
+}
+
+char *describeType(NodeType type) {
+      return isArray(type) ? "An array" : isTelo(type) ? "A telo value" : isLinja(type) ? "A linja value" : "A nanpa value";
+}
+
+// nanpa mixed with telo is converted to telo, lili telo mixed with a wider
+// one is widened
+NodeType commonType(NodeType lhs, NodeType rhs) {
+      if (!isTelo(lhs) && !isTelo(rhs)) return nanpaType;
+      if (!isTelo(rhs) || (isTelo(lhs) && rhs.type == TeloLili)) return (NodeType){.lon = true, .type = lhs.type};
+      return (NodeType){.lon = true, .type = rhs.type};
+}
+
+bool isComparison(NodeBinaryExpression binExpr) {
+      return binExpr.type == BinGt || binExpr.type == BinEq || binExpr.type == BinLt;
+}
+
+bool isLiteral(NodeExpression *expr) {
+      if (expr->type != TermExpr) return false;
+      NodeTerm term = expr->value.term;
+      return (term.type == NanpaExpr && !term.value.nanpa.type.lon) || (term.type == TeloExpr && !term.value.telo.type.lon);
+}
+
+NodeType expressionType(NodeExpression *expr);
+
+// The type both operands are computed in. Literals take the type of the
+// other side, so f + 0.1 stays lili when f is.
+NodeType operandType(NodeBinaryExpression binExpr) {
+      NodeType lhs = expressionType(binExpr.lhs);
+      NodeType rhs = expressionType(binExpr.rhs);
+      if (isLiteral(binExpr.lhs) && isTelo(rhs)) return rhs;
+      if (isLiteral(binExpr.rhs) && isTelo(lhs)) return lhs;
+      return commonType(lhs, rhs);
+}
+
+NodeType expressionType(NodeExpression *expr) {
+      if (expr->type == BinaryExpr) {
+            NodeBinaryExpression *binExpr = expr->value.binExpr;
+            if (isComparison(*binExpr)) return nanpaType;
+            return operandType(*binExpr);
+      }
+      NodeTerm term = expr->value.term;
+      char *name = NULL;
+      if (term.type == NanpaExpr && term.value.nanpa.type.lon) return term.value.nanpa.type;
+      if (term.type == TeloExpr) return term.value.telo.type.lon ? term.value.telo.type : teloType;
+      if (term.type == LinjaExpr) return linjaType;
+      if (term.type == IndexExpr) {
+            char *array = term.value.index.nimi.value;
+            if (hasNameMap(&vars, array)) return elementType(getNameMapType(&vars, array));
+            return nanpaType;
+      }
+      if (term.type == NimiExpr) name = term.value.nimi.value;
+      if (term.type == KamaExpr) name = term.value.kama.nimi.value;
+      if (name && hasNameMap(&vars, name)) return getNameMapType(&vars, name);
+      if (term.type == CallExpr && !strcmp(term.value.call.name, "lukin")) return linjaType;
+      if (term.type == CallExpr) {
+            NodePali *callee = getPalis(&palis, term.value.call.name);
+            if (callee) return callee->ret;
+      }
+      return nanpaType;
+}
+
+// There is no implicit conversion from telo, linja or arrays to nanpa
+void checkNanpa(NodeExpression *expr) {
+      NodeType type = expressionType(expr);
+      if (isTelo(type) || isPair(type)) {
+            fprintf(errors, "%s is used where a nanpa is expected\n", describeType(type));
+            fail();
+      }
+}
+
+void checkLinja(NodeExpression *expr) {
+      NodeType type = expressionType(expr);
+      if (!isLinja(type)) {
+            fprintf(errors, "%s is used where a linja is expected\n", describeType(type));
+            fail();
+      }
+}
+
+// Arrays are only passed as arrays of the very same element type
+void checkArray(NodeExpression *expr, NodeType want) {
+      NodeType type = expressionType(expr);
+      if (!isArray(type)) {
+            fprintf(errors, "%s is used where an array is expected\n", describeType(type));
+            fail();
+      }
+      if (type.type != want.type || type.isUnsigned != want.isUnsigned) {
+            fprintf(errors, "An array is used where an array of a different type is expected\n");
+            fail();
+      }
+}
+
+// Terms that can be folded straight into the consuming instruction:
+// variables as memory operands, numbers as imm32.
+Operand simpleOperand(NodeExpression *expr) {
+      if (expr->type != TermExpr) return (Operand){};
+      NodeTerm term = expr->value.term;
+      if (term.type == NanpaExpr) {
+            int64_t value = term.value.nanpa.value;
+            if (value < INT32_MIN || value > INT32_MAX) return (Operand){};
+            Operand op = {.lon = true};
+            snprintf(op.text, sizeof(op.text), "%ld", value);
+            return op;
+      }
+      if (term.type == NimiExpr) {
+            int64_t slot = lookupVar(term.value.nimi.value);
+            NodeType type = getNameMapType(&vars, term.value.nimi.value);
+            if (isTelo(type) || typeSize(type) != 8) return (Operand){};
+            return slotOperand(slot);
+      }
+      return (Operand){};
+}
+
+void generateAsenpeli(NodeAsenpeli asen) {
+      fprintf(out, "\n    ;; Start raw assembly instructions\n");
+      fprintf(out, "%s", asen.value);
+      fprintf(out, "\n    ;; End raw assebly instructions\n");
+}
+
+void generateExpression(NodeExpression expr);
+void generateStatement(Node* node);
+void generateBody(Nodes *nodes);
+
+bool isArithmetic(NodeBinaryExpression binExpr);
+void generateArithmetic(NodeBinaryExpression binExpr);
+bool expressionUnsigned(NodeExpression *expr);
+
+void generateTerm(NodeTerm term);
+void generateExpressionInto(NodeExpression expr, char *reg);
+
+NodeType arrayType(char *name) {
+      lookupVar(name);
+      NodeType type = getNameMapType(&vars, name);
+      if (!isArray(type)) {
+            fprintf(errors, "%s is not an array\n", name);
+            fail();
+      }
+      return type;
+}
+
+// Bounds checks compare the index in rcx unsigned against the length, so
+// negative indices fail too, and jump to lpc_out_of_range. At -O1 and up
+// the checks that the loop ranges below prove can't fail are left out.
+enum {BoundsAll, BoundsRange, BoundsNone} boundsChecks = BoundsRange;
+
+// What is known about the induction variables of the counted tenpo loops
+// being generated: var started at most at entry, a number or the length of
+// array, and goes down by one once per iteration where decremented is set.
+// Inside the body var is never 0 before that and never below it after.
+typedef struct {
+      char *var;
+      int64_t entry;
+      char *array;
+      bool decremented;
+} LoopRange;
+
+#define LOOP_RANGE_MAX 64
+_Thread_local LoopRange loopRanges[LOOP_RANGE_MAX];
+_Thread_local size_t loopRangeCount = 0;
+
+// Splits an index of the form i, i + k or i - k into i and k
+char *indexVar(NodeExpression *index, int64_t *offset) {
+      *offset = 0;
+      if (index->type == TermExpr) {
+            return index->value.term.type == NimiExpr ? index->value.term.value.nimi.value : NULL;
+      }
+      NodeBinaryExpression *binExpr = index->value.binExpr;
+      if ((binExpr->type != BinAdd && binExpr->type != BinSub)
+          || binExpr->lhs->type != TermExpr || binExpr->lhs->value.term.type != NimiExpr
+          || binExpr->rhs->type != TermExpr || binExpr->rhs->value.term.type != NanpaExpr) return NULL;
+      int64_t k = binExpr->rhs->value.term.value.nanpa.value;
+      if (k < INT32_MIN || k > INT32_MAX) return NULL;
+      *offset = binExpr->type == BinAdd ? k : -k;
+      return binExpr->lhs->value.term.value.nimi.value;
+}
+
+bool indexInRange(NodeExpression *index, char *array, NodeType type) {
+      if (optLevel < 1 || boundsChecks == BoundsAll) return false;
+      int64_t offset;
+      char *var = indexVar(index, &offset);
+      if (!var) return false;
+      for (size_t i = loopRangeCount; i > 0; i--) {
+            LoopRange range = loopRanges[i-1];
+            if (strcmp(range.var, var)) continue;
+            int64_t low = (range.decremented ? 0 : 1) + offset;
+            if (low < 0) return false;
+            if (range.array) return !strcmp(range.array, array) && offset < (range.decremented ? 1 : 0);
+            int64_t high = range.entry - (range.decremented ? 1 : 0) + offset;
+            return type.count && !type.length && high < type.count;
+      }
+      return false;
+}
+
+bool isNanpaVar(NodeExpression *expr) {
+      if (expr->type != TermExpr || expr->value.term.type != NimiExpr) return false;
+      char *name = expr->value.term.value.nimi.value;
+      if (!hasNameMap(&vars, name)) return false;
+      NodeType type = getNameMapType(&vars, name);
+      return !isTelo(type) && !isPair(type);
+}
+
+// Numbers, variables and a variable plus or minus a number are computed
+// into rcx without touching any other register.
+bool isSimpleIndex(NodeExpression *index) {
+      int64_t offset;
+      if (index->type == TermExpr && index->value.term.type == NanpaExpr) return true;
+      if (!indexVar(index, &offset)) return false;
+      return isNanpaVar(index->type == TermExpr ? index : index->value.binExpr->lhs);
+}
+
+void generateIndexInto(NodeExpression *index) {
+      int64_t offset;
+      char *var = indexVar(index, &offset);
+      if (!isSimpleIndex(index)) {
+            generateExpressionInto(*index, "rcx");
+      } else if (!var) {
+            fprintf(out, "    mov rcx, %ld\n", index->value.term.value.nanpa.value);
+      } else {
+            loadVar("rcx", lookupVar(var), getNameMapType(&vars, var));
+            if (offset > 0) fprintf(out, "    add rcx, %ld\n", offset);
+            if (offset < 0) fprintf(out, "    sub rcx, %ld\n", -offset);
+      }
+}
+
+// Checks the index in rcx against the length of array. A number is checked
+// right here when the length is known.
+void generateBoundsCheck(NodeExpression *index, char *array, NodeType type) {
+      if (boundsChecks == BoundsNone) return;
+      if (type.count && !type.length && index->type == TermExpr && index->value.term.type == NanpaExpr) {
+            int64_t value = index->value.term.value.nanpa.value;
+            if (value < 0 || value >= type.count) {
+                  fprintf(errors, "Index %ld is out of range for %s, which has %ld elements\n", value, array, type.count);
+                  fail();
+            }
+            return;
+      }
+      if (indexInRange(index, array, type)) return;
+      if (inFrame(type)) {
+            fprintf(out, "    cmp rcx, %ld\n", type.count);
+      } else {
+            fprintf(out, "    cmp rcx, qword [rbp%+ld]\n", lookupVar(array) + 8);
+      }
+      fprintf(out, "    jae lpc_out_of_range\n");
+}
+
+// Numbers index arrays in the frame without going through rcx
+bool fixedElement(NodeExpression *index, NodeType type) {
+      return inFrame(type) && index->type == TermExpr && index->value.term.type == NanpaExpr;
+}
+
+// The operand for element index of array, which is in rcx unless it is
+// fixed. Arrays that aren't in the frame have their pointer loaded into r11
+// first.
+Operand elementOperand(NodeExpression *index, char *array, NodeType type) {
+      int64_t slot = lookupVar(array);
+      size_t size = typeSize(elementType(type));
+      Operand op = {.lon = true, .memory = true};
+      if (fixedElement(index, type)) {
+            snprintf(op.text, sizeof(op.text), "%s [rbp%+ld]", sizeName(size),
+                     slot + index->value.term.value.nanpa.value * (int64_t)size);
+      } else if (inFrame(type)) {
+            snprintf(op.text, sizeof(op.text), "%s [rbp+rcx*%zu%+ld]", sizeName(size), size, slot);
+      } else {
+            fprintf(out, "    mov r11, qword [rbp%+ld]\n", slot);
+            snprintf(op.text, sizeof(op.text), "%s [r11+rcx*%zu]", sizeName(size), size);
+      }
+      return op;
+}
+
+// Computes and checks the index and returns the element it points at
+Operand generateElement(NodeIndexExpression index) {
+      NodeType type = arrayType(index.nimi.value);
+      checkNanpa(index.index);
+      if (!fixedElement(index.index, type)) generateIndexInto(index.index);
+      generateBoundsCheck(index.index, index.nimi.value, type);
+      return elementOperand(index.index, index.nimi.value, type);
+}
+
+_Thread_local size_t teloNumber = 0;
+
+void loadTelo(char *xmm, double value, NodeType type) {
+      if (value == 0 && !signbit(value)) {
+            fprintf(out, "    xorps %s, %s\n", xmm, xmm);
+      } else if (type.type == TeloLili) {
+            float single = value;
+            uint32_t bits;
+            memcpy(&bits, &single, sizeof(bits));
+            fprintf(out, "    mov r8d, 0x%08x ; %g\n"
+                   "    movd %s, r8d\n", bits, value, xmm);
+      } else {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            fprintf(out, "    mov r8, 0x%016lx ; %g\n"
+                   "    movq %s, r8\n", bits, value, xmm);
+      }
+}
+
+void convertTelo(NodeType from, NodeType to) {
+      if (from.type == TeloLili && to.type != TeloLili) fprintf(out, "    cvtss2sd xmm0, xmm0\n");
+      if (from.type != TeloLili && to.type == TeloLili) fprintf(out, "    cvtsd2ss xmm0, xmm0\n");
+}
+
+// Converts the nanpa in r8 to xmm0. cvtsi2sd only takes signed values, so
+// unsigned ones with the top bit set are halved, keeping the low bit for
+// rounding, and doubled after. The xorps breaks the dependency on the old
+// xmm0 that cvtsi2sd has.
+void generateNanpaToTelo(bool isUnsigned, NodeType type) {
+      char *suffix = teloSuffix(type);
+      fprintf(out, "    xorps xmm0, xmm0\n");
+      if (!isUnsigned) {
+            fprintf(out, "    cvtsi2%s xmm0, r8\n", suffix);
+            return;
+      }
+      size_t number = teloNumber++;
+      fprintf(out, "    test r8, r8\n"
+             "    js .telobig%ld\n"
+             "    cvtsi2%s xmm0, r8\n"
+             "    jmp .telodone%ld\n"
+             ".telobig%ld:\n"
+             "    mov r9, r8\n"
+             "    shr r9, 1\n"
+             "    and r8d, 1\n"
+             "    or r9, r8\n"
+             "    cvtsi2%s xmm0, r9\n"
+             "    add%s xmm0, xmm0\n"
+             ".telodone%ld:\n",
+             number, suffix, number, number, suffix, suffix, number);
+}
+
+void generateTeloInto(NodeExpression expr, NodeType type);
+
+// The value of a number literal as a telo
+double literalTelo(NodeTerm term) {
+      if (term.type == TeloExpr) return term.value.telo.value;
+      if (term.value.nanpa.type.isUnsigned) return (double)(uint64_t)term.value.nanpa.value;
+      return term.value.nanpa.value;
+}
+
+// Leaves the lhs in xmm0 and returns the rhs operand: a variable of the same
+// width in place, anything else in xmm1.
+Operand generateTeloOperands(NodeBinaryExpression binExpr, NodeType type) {
+      NodeExpression *rhs = binExpr.rhs;
+      Operand op = {.lon = true, .text = "xmm1"};
+      if (rhs->type == TermExpr && rhs->value.term.type == NimiExpr) {
+            char *name = rhs->value.term.value.nimi.value;
+            int64_t slot = lookupVar(name);
+            NodeType rhsType = getNameMapType(&vars, name);
+            if (isTelo(rhsType) && (rhsType.type == TeloLili) == (type.type == TeloLili)) {
+                  generateTeloInto(*binExpr.lhs, type);
+                  op.memory = true;
+                  snprintf(op.text, sizeof(op.text), "%s [rbp%+ld]", teloSize(type), slot);
+                  return op;
+            }
+      }
+      if (rhs->type == TermExpr && (rhs->value.term.type == TeloExpr || rhs->value.term.type == NanpaExpr)) {
+            generateTeloInto(*binExpr.lhs, type);
+            NodeTerm term = rhs->value.term;
+            loadTelo("xmm1", literalTelo(term), type);
+            return op;
+      }
+      generateTeloInto(*binExpr.lhs, type);
+      fprintf(out, "    movq r8, xmm0\n");
+      push_reg("r8");
+      generateTeloInto(*rhs, type);
+      fprintf(out, "    movaps xmm1, xmm0\n");
+      pop("r8");
+      fprintf(out, "    movq xmm0, r8\n");
+      return op;
+}
+
+void generateTeloArithmetic(NodeBinaryExpression binExpr, NodeType type) {
+      char *instruction = NULL;
+      switch (binExpr.type) {
+      case BinAdd: instruction = "add"; break;
+      case BinSub: instruction = "sub"; break;
+      case BinMul: instruction = "mul"; break;
+      case BinDiv: instruction = "div"; break;
+      default:
+            fprintf(errors, "%% is not defined for telo\n");
+            fail();
+      }
+      Operand rhs = generateTeloOperands(binExpr, type);
+      fprintf(out, "    %s%s xmm0, %s\n", instruction, teloSuffix(type), rhs.text);
+}
+
+// ucomisd sets all of ZF, PF and CF when either side is NaN, so < is tested
+// as > with the sides swapped, and == needs PF clear as well.
+void generateTeloComparison(NodeBinaryExpression binExpr, NodeType type) {
+      Operand rhs = generateTeloOperands(binExpr, type);
+      char *compare = type.type == TeloLili ? "ucomiss" : "ucomisd";
+      switch (binExpr.type) {
+      case BinGt:
+            fprintf(out, "    %s xmm0, %s\n"
+                   "    seta al\n", compare, rhs.text);
+            break;
+      case BinLt:
+            if (rhs.memory) fprintf(out, "    mov%s xmm1, %s\n", teloSuffix(type), rhs.text);
+            fprintf(out, "    %s xmm1, xmm0\n"
+                   "    seta al\n", compare);
+            break;
+      case BinEq:
+            fprintf(out, "    %s xmm0, %s\n"
+                   "    sete al\n"
+                   "    setnp cl\n"
+                   "    and al, cl\n", compare, rhs.text);
+            break;
+      default:
+            assert(false);
+      }
+      fprintf(out, "    movzx r8d, al\n");
+}
+
+// Computes expr as type into xmm0, converting from whatever it is
+void generateTeloInto(NodeExpression expr, NodeType type) {
+      NodeTerm term = expr.value.term;
+      if (expr.type == TermExpr && (term.type == TeloExpr || term.type == NanpaExpr)) {
+            loadTelo("xmm0", literalTelo(term), type);
+            return;
+      }
+
+      NodeType from = expressionType(&expr);
+      if (!isTelo(from)) {
+            generateExpressionInto(expr, "r8");
+            generateNanpaToTelo(expressionUnsigned(&expr), type);
+            return;
+      }
+      if (expr.type == BinaryExpr) {
+            generateTeloArithmetic(*expr.value.binExpr, from);
+      } else if (term.type == IndexExpr) {
+            fprintf(out, "    mov%s xmm0, %s\n", teloSuffix(from), generateElement(term.value.index).text);
+      } else if (term.type == NimiExpr) {
+            fprintf(out, "    mov%s xmm0, %s [rbp%+ld]\n", teloSuffix(from), teloSize(from), lookupVar(term.value.nimi.value));
+      } else {
+            generateTerm(term);
+            pop("r8");
+            fprintf(out, "    movq xmm0, r8\n");
+      }
+      convertTelo(from, type);
+}
+
+// The distinct linja literals used by the code generated on this thread,
+// emitted once each for the whole program. They are labelled with a hash
+// of their bytes, so the code that refers to one doesn't depend on what
+// other threads have seen.
+typedef struct {
+      size_t size;
+      size_t capacity;
+      char **bytes;
+      size_t *lengths;
+      uint64_t *hashes;
+} Linjas;
+
+_Thread_local Linjas linjas;
+
+uint64_t hashBytes(char *bytes, size_t length);
+
+uint64_t addLinja(Linjas *to, char *bytes, size_t length, uint64_t hash) {
+      for (size_t i = 0; i < to->size; i++) {
+            if (to->hashes[i] != hash) continue;
+            if (to->lengths[i] == length && !memcmp(to->bytes[i], bytes, length)) return hash;
+            fprintf(errors, "Two linja literals hash to the same label\n");
+            fail();
+      }
+      if (to->size == to->capacity) {
+            to->capacity = to->capacity ? to->capacity * 2 : 8;
+            to->bytes = realloc(to->bytes, sizeof(char*)*to->capacity);
+            to->lengths = realloc(to->lengths, sizeof(size_t)*to->capacity);
+            to->hashes = realloc(to->hashes, sizeof(uint64_t)*to->capacity);
+      }
+      to->bytes[to->size] = malloc(length + 1);
+      memcpy(to->bytes[to->size], bytes, length);
+      to->lengths[to->size] = length;
+      to->hashes[to->size++] = hash;
+      return hash;
+}
+
+// The label of a literal is lpc_linja followed by what this returns
+uint64_t internLinja(char *bytes, size_t length) {
+      return addLinja(&linjas, bytes, length, hashBytes(bytes, length));
+}
+
+void clearLinjas(Linjas *linjas) {
+      for (size_t i = 0; i < linjas->size; i++) free(linjas->bytes[i]);
+      linjas->size = 0;
+}
+
+// Decodes the escapes \n, \t, \0, \\ and \" of a literal
+char *decodeLinja(char *literal, size_t *length) {
+      char *bytes = malloc(strlen(literal) + 1);
+      size_t n = 0;
+      for (char *c = literal; *c; c++) {
+            if (*c != '\\' || !c[1]) {
+                  bytes[n++] = *c;
+                  continue;
+            }
+            switch (*++c) {
+            case 'n': bytes[n++] = '\n'; break;
+            case 't': bytes[n++] = '\t'; break;
+            case '0': bytes[n++] = 0; break;
+            default: bytes[n++] = *c; break;
+            }
+      }
+      *length = n;
+      return bytes;
+}
+
+// Arrays go where arrays of the same type are expected, linja where linja are
+void checkPair(NodeExpression *expr, NodeType type) {
+      if (isArray(type)) checkArray(expr, type);
+      else checkLinja(expr);
+}
+
+// Computes the linja or array expr of type into the registers pointer and
+// length
+void generatePairInto(NodeExpression expr, NodeType type, char *pointer, char *length) {
+      checkPair(&expr, type);
+      NodeTerm term = expr.value.term;
+      if (term.type == LinjaExpr) {
+            size_t bytesLength;
+            char *bytes = decodeLinja(term.value.linja.string, &bytesLength);
+            fprintf(out, "    lea %s, [rel lpc_linja%016lx]\n"
+                   "    mov %s, %zu\n", pointer, internLinja(bytes, bytesLength), length, bytesLength);
+            free(bytes);
+      } else if (term.type == NimiExpr && inFrame(getNameMapType(&vars, term.value.nimi.value))) {
+            fprintf(out, "    lea %s, [rbp%+ld]\n"
+                   "    mov %s, %ld\n", pointer, lookupVar(term.value.nimi.value),
+                   length, getNameMapType(&vars, term.value.nimi.value).count);
+      } else if (term.type == NimiExpr) {
+            int64_t slot = lookupVar(term.value.nimi.value);
+            fprintf(out, "    mov %s, qword [rbp%+ld]\n"
+                   "    mov %s, qword [rbp%+ld]\n", pointer, slot, length, slot + 8);
+      } else {
+            generateTerm(term);
+            pop(pointer);
+            pop(length);
+      }
+}
+
+// Pushes expr as a value of type, for arguments
+void generateValue(NodeExpression expr, NodeType type) {
+      // Calls and kama already leave the pair on the stack
+      NodeTerm term = expr.value.term;
+      if (isPair(type) && expr.type == TermExpr && (term.type == CallExpr || term.type == KamaExpr)) {
+            checkPair(&expr, type);
+            generateTerm(term);
+            return;
+      }
+      if (isPair(type)) {
+            generatePairInto(expr, type, "r8", "r9");
+            push_reg("r9");
+            push_reg("r8");
+            return;
+      }
+      if (isTelo(type)) {
+            generateTeloInto(expr, type);
+            fprintf(out, "    movq r8, xmm0\n");
+            push_reg("r8");
+            return;
+      }
+      checkNanpa(&expr);
+      generateExpression(expr);
+}
+
+void generateExpressionInto(NodeExpression expr, char *reg) {
+      checkNanpa(&expr);
+      if (expr.type == TermExpr && expr.value.term.type == IndexExpr) {
+            NodeIndexExpression index = expr.value.term.value.index;
+            loadOperand(reg, generateElement(index).text, expressionType(&expr));
+            return;
+      }
+      if (expr.type == TermExpr && expr.value.term.type == NimiExpr) {
+            char *name = expr.value.term.value.nimi.value;
+            loadVar(reg, lookupVar(name), getNameMapType(&vars, name));
+            return;
+      }
+      Operand op = simpleOperand(&expr);
+      if (op.lon) {
+            fprintf(out, "    mov %s, %s\n", reg, op.text);
+            return;
+      }
+      if (expr.type == BinaryExpr && isArithmetic(*expr.value.binExpr)) {
+            generateArithmetic(*expr.value.binExpr);
+            if (strcmp(reg, "r8")) fprintf(out, "    mov %s, r8\n", reg);
+            return;
+      }
+      generateExpression(expr);
+      pop(reg);
+}
+
+// The pali whose body is being generated. Otawa returns from it instead of
+// exiting the program; when the body is inlined it jumps to the end of the
+// expansion instead of returning. Inlined frames point to the one they are
+// expanded in.
+typedef struct Frame_t {
+      NodePali *pali;
+      size_t base;
+      bool inlined;
+      size_t inlineNumber;
+      struct Frame_t *outer;
+} Frame;
+
+_Thread_local Frame frame;
+_Thread_local size_t inlineNumber = 0;
+
+void generateSuli(NodeCallExpression call);
+void generateLukin(NodeCallExpression call);
+
+// A pali inlined into itself is called instead the second time
+bool expanding(NodePali *pali) {
+      for (Frame *f = &frame; f; f = f->outer) {
+            if (f->inlined && f->pali == pali) return true;
+      }
+      return false;
+}
+
+// The pali called from the code being generated, which decides the pali that
+// are written out
+_Thread_local NodePali **unitCalls = NULL;
+_Thread_local size_t unitCallCount = 0;
+_Thread_local size_t unitCallCapacity = 0;
+
+void addUnitCall(NodePali *pali) {
+      if (unitCallCount == unitCallCapacity) {
+            unitCallCapacity = unitCallCapacity ? unitCallCapacity * 2 : 8;
+            unitCalls = realloc(unitCalls, sizeof(NodePali*)*unitCallCapacity);
+      }
+      unitCalls[unitCallCount++] = pali;
+}
+
+void generateCall(NodeCallExpression call) {
+      if (!strcmp(call.name, "suli")) {
+            generateSuli(call);
+            return;
+      }
+      if (!strcmp(call.name, "lukin")) {
+            generateLukin(call);
+            return;
+      }
+      if (!strcmp(call.name, "otokis") || !strcmp(call.name, "pakala")) {
+            fprintf(errors, "%s doesn't give a value\n", call.name);
+            fail();
+      }
+      NodePali *callee = getPalis(&palis, call.name);
+      if (!callee) {
+            fprintf(errors, "Undefined pali %s\n", call.name);
+            fail();
+      }
+      if (call.argc != callee->paramCount) {
+            fprintf(errors, "pali %s takes %zu arguments, %zu given\n",
+                    callee->name, callee->paramCount, call.argc);
+            fail();
+      }
+
+      size_t base = stackOffset;
+      for (size_t i = 0; i < call.argc; i++) {
+            generateValue(*call.args[i], callee->paramTypes[i]);
+      }
+
+      if (!call.inlined || expanding(callee)) {
+            addUnitCall(callee);
+            fprintf(out, "    call pali_%s\n", callee->name);
+            if (stackOffset != base) fprintf(out, "    add rsp, %ld\n", (stackOffset - base) * 8);
+            stackOffset = base;
+            if (isPair(callee->ret)) push_reg("rdx");
+            push_reg("rax");
+            return;
+      }
+
+      NameMap oldVars = vars;
+      Frame oldFrame = frame;
+      size_t oldBytes = frameBytes;
+      vars = nameMapNew();
+      int64_t *slots = calloc(callee->paramCount, sizeof(int64_t));
+      for (size_t i = 0; i < callee->paramCount; i++) {
+            slots[i] = allocSlot(isPair(callee->paramTypes[i]) ? 16 : 8);
+            addNameMap(&vars, callee->params[i], slots[i], callee->paramTypes[i]);
+      }
+      for (size_t i = callee->paramCount; i > 0; i--) {
+            pop(slotOperand(slots[i-1]).text);
+            if (isPair(callee->paramTypes[i-1])) pop(slotOperand(slots[i-1] + 8).text);
+      }
+      free(slots);
+      frame = (Frame){.pali = callee, .base = base, .inlined = true, .inlineNumber = inlineNumber++, .outer = &oldFrame};
+
+      // The loop ranges outside are about variables the body can't see
+      size_t oldRanges = loopRangeCount;
+      loopRangeCount = 0;
+      fprintf(out, "    ;; inlined pali %s\n", callee->name);
+      generateBody(&callee->nodes);
+      loopRangeCount = oldRanges;
+      fprintf(out, "    mov rax, 0\n");
+      if (isPair(callee->ret)) fprintf(out, "    mov rdx, 0\n");
+      fprintf(out, ".inlineout%ld:\n", frame.inlineNumber);
+
+      frame = oldFrame;
+      frameBytes = oldBytes;
+      vars = oldVars;
+      stackOffset = base;
+      if (isPair(callee->ret)) push_reg("rdx");
+      push_reg("rax");
+}
+
+// x.suli() is the length of the linja x
+void generateSuli(NodeCallExpression call) {
+      if (call.argc != 1) {
+            fprintf(errors, "suli takes 1 argument, %zu given\n", call.argc);
+            fail();
+      }
+      NodeExpression *arg = call.args[0];
+      NodeType type = expressionType(arg);
+      if (!isArray(type)) checkLinja(arg);
+      if (arg->type == TermExpr && arg->value.term.type == NimiExpr && inFrame(type)) {
+            push(type.count);
+            return;
+      }
+      if (arg->type == TermExpr && arg->value.term.type == NimiExpr) {
+            push_reg(slotOperand(lookupVar(arg->value.term.value.nimi.value) + 8).text);
+            return;
+      }
+      generatePairInto(*arg, type, "r8", "r9");
+      push_reg("r9");
+}
+
+// The runtime is a handful of routines emitted behind the program when it
+// calls one of the builtins. Output goes through two streams in .bss,
+// a qword of buffered bytes, the file descriptor and the buffer. They are
+// only written out when they fill up and when the program exits, so a
+// program that writes a lot of small pieces makes few write syscalls.
+#define OUTPUT_BUFFER_SIZE 65536
+
+bool usesRuntime = false;
+
+void generateWriteLiteral(char *stream, char *bytes, size_t length) {
+      fprintf(out, "    lea rdi, [rel %s]\n"
+             "    lea rsi, [rel lpc_linja%016lx]\n"
+             "    mov edx, %zu\n"
+             "    call lpc_write\n", stream, internLinja(bytes, length), length);
+}
+
+// Writes expr formatted as l(inja), n(anpa) or t(elo)
+void generateWriteValue(char *stream, NodeExpression expr, char conversion) {
+      if (conversion == 'l') {
+            generatePairInto(expr, linjaType, "rsi", "rdx");
+            fprintf(out, "    lea rdi, [rel %s]\n"
+                   "    call lpc_write\n", stream);
+      } else if (conversion == 'n') {
+            generateExpressionInto(expr, "rax");
+            fprintf(out, "    lea rdi, [rel %s]\n"
+                   "    call lpc_write_%s\n", stream, expressionUnsigned(&expr) ? "unsigned" : "signed");
+      } else {
+            generateTeloInto(expr, teloType);
+            fprintf(out, "    lea rdi, [rel %s]\n"
+                   "    call lpc_write_telo\n", stream);
+      }
+}
+
+// otokis("format", ...) writes to stdout and pakala("format", ...) to
+// stderr. Every %l, %n and %t in the format is replaced by the next argument
+// as a linja, nanpa or telo, and %% by %. The format is split up here, so
+// only the pieces between the arguments are left to copy at run time. A
+// single argument that isn't a literal is written as its type.
+void generateOtokis(NodeCallExpression call) {
+      char *stream = strcmp(call.name, "pakala") ? "lpc_stdout" : "lpc_stderr";
+      if (call.argc == 0) {
+            fprintf(errors, "%s needs something to write\n", call.name);
+            fail();
+      }
+      NodeExpression *format = call.args[0];
+      if (format->type != TermExpr || format->value.term.type != LinjaExpr) {
+            if (call.argc > 1) {
+                  fprintf(errors, "The format given to %s has to be a string literal\n", call.name);
+                  fail();
+            }
+            NodeType type = expressionType(format);
+            generateWriteValue(stream, *format, isLinja(type) ? 'l' : isTelo(type) ? 't' : 'n');
+            return;
+      }
+
+      size_t length;
+      char *text = decodeLinja(format->value.term.value.linja.string, &length);
+      char *piece = malloc(length + 1);
+      size_t pieceLength = 0;
+      size_t arg = 1;
+      for (size_t i = 0; i <= length; i++) {
+            if (i < length && (text[i] != '%' || i + 1 == length)) {
+                  piece[pieceLength++] = text[i];
+                  continue;
+            }
+            if (i < length && text[i + 1] == '%') {
+                  piece[pieceLength++] = '%';
+                  i++;
+                  continue;
+            }
+            if (pieceLength) generateWriteLiteral(stream, piece, pieceLength);
+            pieceLength = 0;
+            if (i == length) break;
+
+            char conversion = text[++i];
+            if (conversion != 'l' && conversion != 'n' && conversion != 't') {
+                  fprintf(errors, "Unknown conversion %%%c in the format given to %s\n", conversion, call.name);
+                  fail();
+            }
+            if (arg == call.argc) {
+                  fprintf(errors, "Not enough arguments for the format given to %s\n", call.name);
+                  fail();
+            }
+            if (conversion == 'l') checkLinja(call.args[arg]);
+            if (conversion == 'n') checkNanpa(call.args[arg]);
+            if (conversion == 't' && isPair(expressionType(call.args[arg]))) checkNanpa(call.args[arg]);
+            generateWriteValue(stream, *call.args[arg++], conversion);
+      }
+      free(piece);
+      free(text);
+      if (arg != call.argc) {
+            fprintf(errors, "%s is given %zu arguments, its format takes %zu\n", call.name, call.argc - 1, arg - 1);
+            fail();
+      }
+}
+
+// lukin("path") maps the whole file and gives its contents as a linja,
+// which is empty when the file can't be read.
+void generateLukin(NodeCallExpression call) {
+      if (call.argc != 1) {
+            fprintf(errors, "lukin takes 1 argument, %zu given\n", call.argc);
+            fail();
+      }
+      generatePairInto(*call.args[0], linjaType, "rsi", "rdx");
+      fprintf(out, "    call lpc_read_file\n");
+      push_reg("rdx");
+      push_reg("rax");
+}
+
+uint64_t doubleBits(double value) {
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      return bits;
+}
+
+// The streams are written with lpc_write, rdi the stream and rdx bytes at
+// rsi. What doesn't fit flushes the buffer first, and what is bigger than
+// the buffer is written directly. Any routine can change rax, rcx, rdx, rsi
+// and r11, which syscall and lpc_digits use. lpc_write_signed also changes
+// r10, lpc_write_telo r8-r10 and xmm0-xmm1, lpc_alloc r8-r10, and
+// lpc_read_file r8-r10 and rdi. The others keep rdi, which lpc_flush_all
+// relies on as it holds the exit status when it is called.
+void generateWriteRuntime() {
+      fprintf(out, "\nlpc_write:\n"
+             "    mov rax, [rdi]\n"
+             "    lea rcx, [rax+rdx]\n"
+             "    cmp rcx, %d\n"
+             "    jbe .copy\n"
+             "    push rsi\n"
+             "    push rdx\n"
+             "    call lpc_flush\n"
+             "    pop rdx\n"
+             "    pop rsi\n"
+             "    xor eax, eax\n"
+             "    cmp rdx, %d\n"
+             "    jbe .copy\n"
+             "    push rdi\n"
+             "    mov rdi, [rdi+8]\n"
+             "    call lpc_write_all\n"
+             "    pop rdi\n"
+             "    ret\n"
+             ".copy:\n"
+             "    lea rcx, [rax+rdx]\n"
+             "    mov [rdi], rcx\n"
+             "    push rdi\n"
+             "    lea rdi, [rdi+rax+16]\n"
+             "    mov rcx, rdx\n"
+             "    rep movsb\n"
+             "    pop rdi\n"
+             "    ret\n",
+             OUTPUT_BUFFER_SIZE, OUTPUT_BUFFER_SIZE);
+      // write can write less than it was asked to, or be interrupted
+      fprintf(out, "\nlpc_write_all:\n"
+             "    test rdx, rdx\n"
+             "    jz .done\n"
+             "    mov eax, 1\n"
+             "    syscall\n"
+             "    cmp rax, -4\n"
+             "    je lpc_write_all\n"
+             "    test rax, rax\n"
+             "    jle .done\n"
+             "    add rsi, rax\n"
+             "    sub rdx, rax\n"
+             "    jmp lpc_write_all\n"
+             ".done:\n"
+             "    ret\n");
+      fprintf(out, "\nlpc_flush:\n"
+             "    push rdi\n"
+             "    lea rsi, [rdi+16]\n"
+             "    mov rdx, [rdi]\n"
+             "    mov qword [rdi], 0\n"
+             "    mov rdi, [rdi+8]\n"
+             "    call lpc_write_all\n"
+             "    pop rdi\n"
+             "    ret\n");
+      fprintf(out, "\nlpc_flush_all:\n"
+             "    push rdi\n"
+             "    lea rdi, [rel lpc_stdout]\n"
+             "    call lpc_flush\n"
+             "    lea rdi, [rel lpc_stderr]\n"
+             "    call lpc_flush\n"
+             "    pop rdi\n"
+             "    ret\n");
+}
+
+// Numbers are formatted backwards into a buffer on the stack. lpc_digits
+// writes the unsigned rax in decimal in front of rsi and leaves rsi on the
+// first digit, dividing by 10 with a multiply high.
+void generateFormatRuntime() {
+      fprintf(out, "\nlpc_digits:\n"
+             "    mov rcx, 0xcccccccccccccccd\n"
+             ".next:\n"
+             "    mov r11, rax\n"
+             "    mul rcx\n"
+             "    shr rdx, 3\n"
+             "    mov rax, rdx\n"
+             "    lea rdx, [rdx+rdx*4]\n"
+             "    add rdx, rdx\n"
+             "    sub r11, rdx\n"
+             "    add r11d, 48\n"
+             "    dec rsi\n"
+             "    mov [rsi], r11b\n"
+             "    test rax, rax\n"
+             "    jnz .next\n"
+             "    ret\n");
+      fprintf(out, "\nlpc_write_signed:\n"
+             "    sub rsp, 32\n"
+             "    lea rsi, [rsp+32]\n"
+             "    mov r10, rax\n"
+             "    test rax, rax\n"
+             "    jns .digits\n"
+             "    neg rax\n"
+             ".digits:\n"
+             "    call lpc_digits\n"
+             "    test r10, r10\n"
+             "    jns .write\n"
+             "    dec rsi\n"
+             "    mov byte [rsi], 45\n"
+             ".write:\n"
+             "    lea rdx, [rsp+32]\n"
+             "    sub rdx, rsi\n"
+             "    call lpc_write\n"
+             "    add rsp, 32\n"
+             "    ret\n");
+      fprintf(out, "\nlpc_write_unsigned:\n"
+             "    sub rsp, 32\n"
+             "    lea rsi, [rsp+32]\n"
+             "    call lpc_digits\n"
+             "    lea rdx, [rsp+32]\n"
+             "    sub rdx, rsi\n"
+             "    call lpc_write\n"
+             "    add rsp, 32\n"
+             "    ret\n");
+      // telo in xmm0 is written with six decimals, values from 1e18 on are
+      // scaled below 10 and get an exponent. The integer part ends at r9,
+      // the decimals and exponent follow it up to r8, the sign is in r10.
+      fprintf(out, "\nlpc_write_telo:\n"
+             "    sub rsp, 64\n"
+             "    movq rax, xmm0\n"
+             "    mov r10, rax\n"
+             "    btr rax, 63\n"
+             "    movq xmm0, rax\n"
+             "    lea r9, [rsp+32]\n"
+             "    mov rcx, 0x7ff0000000000000\n"
+             "    cmp rax, rcx\n"
+             "    jb .finite\n"
+             "    mov ecx, 0x666e69\n"
+             "    je .special\n"
+             "    mov ecx, 0x6e616e\n"
+             ".special:\n"
+             "    mov [r9], ecx\n"
+             "    lea r8, [r9+3]\n"
+             "    mov rsi, r9\n"
+             "    jmp .sign\n"
+             ".finite:\n"
+             "    mov qword [rsp+56], 0\n"
+             "    mov rax, 0x%016lx ; 1e18\n"
+             "    movq xmm1, rax\n"
+             "    ucomisd xmm0, xmm1\n"
+             "    jb .fixed\n"
+             "    mov rax, 0x%016lx ; 10\n"
+             "    movq xmm1, rax\n"
+             ".scale:\n"
+             "    divsd xmm0, xmm1\n"
+             "    inc qword [rsp+56]\n"
+             "    ucomisd xmm0, xmm1\n"
+             "    jae .scale\n"
+             ".fixed:\n"
+             "    cvttsd2si rax, xmm0\n"
+             "    cvtsi2sd xmm1, rax\n"
+             "    subsd xmm0, xmm1\n"
+             "    mov rcx, 0x%016lx ; 1e6\n"
+             "    movq xmm1, rcx\n"
+             "    mulsd xmm0, xmm1\n"
+             "    cvtsd2si rcx, xmm0\n"
+             "    cmp rcx, 1000000\n"
+             "    jb .decimals\n"
+             "    sub rcx, 1000000\n"
+             "    inc rax\n"
+             ".decimals:\n"
+             "    mov [rsp+48], rax\n"
+             "    mov byte [r9], 46\n"
+             "    mov dword [r9+1], 0x30303030\n"
+             "    mov word [r9+5], 0x3030\n"
+             "    mov rax, rcx\n"
+             "    lea rsi, [r9+7]\n"
+             "    call lpc_digits\n"
+             "    lea r8, [r9+7]\n"
+             "    mov rax, [rsp+56]\n"
+             "    test rax, rax\n"
+             "    jz .integer\n"
+             "    mov word [r8], 0x2b65\n"
+             "    add r8, 4\n"
+             "    cmp rax, 100\n"
+             "    jb .exponent\n"
+             "    inc r8\n"
+             ".exponent:\n"
+             "    mov rsi, r8\n"
+             "    call lpc_digits\n"
+             ".integer:\n"
+             "    mov rax, [rsp+48]\n"
+             "    mov rsi, r9\n"
+             "    call lpc_digits\n"
+             ".sign:\n"
+             "    test r10, r10\n"
+             "    jns .write\n"
+             "    dec rsi\n"
+             "    mov byte [rsi], 45\n"
+             ".write:\n"
+             "    mov rdx, r8\n"
+             "    sub rdx, rsi\n"
+             "    call lpc_write\n"
+             "    add rsp, 64\n"
+             "    ret\n",
+             doubleBits(1e18), doubleBits(10), doubleBits(1e6));
+}
+
+// The path is copied behind a zero on the stack for open, the contents come
+// back in rax and the length in rdx. The mapping stays until the program
+// exits.
+void generateReadRuntime() {
+      fprintf(out, "\nlpc_read_file:\n"
+             "    push rbp\n"
+             "    mov rbp, rsp\n"
+             "    sub rsp, 4272\n"
+             "    cmp rdx, 4095\n"
+             "    ja .fail\n"
+             "    mov rdi, rsp\n"
+             "    mov rcx, rdx\n"
+             "    rep movsb\n"
+             "    mov byte [rdi], 0\n"
+             "    mov eax, 2\n"
+             "    mov rdi, rsp\n"
+             "    xor esi, esi\n"
+             "    syscall\n"
+             "    test rax, rax\n"
+             "    js .fail\n"
+             "    mov r8, rax\n"
+             "    mov eax, 5\n"
+             "    mov rdi, r8\n"
+             "    lea rsi, [rsp+4096]\n"
+             "    syscall\n"
+             "    mov qword [rbp-8], 0\n"
+             "    mov qword [rbp-16], 0\n"
+             "    test rax, rax\n"
+             "    js .close\n"
+             "    mov rsi, [rsp+4144]\n"
+             "    test rsi, rsi\n"
+             "    jle .close\n"
+             "    mov [rbp-16], rsi\n"
+             "    mov eax, 9\n"
+             "    xor edi, edi\n"
+             "    mov edx, 1\n"
+             "    mov r10d, 2\n"
+             "    xor r9d, r9d\n"
+             "    syscall\n"
+             "    cmp rax, -4096\n"
+             "    ja .unmapped\n"
+             "    mov [rbp-8], rax\n"
+             "    jmp .close\n"
+             ".unmapped:\n"
+             "    mov qword [rbp-16], 0\n"
+             ".close:\n"
+             "    mov eax, 3\n"
+             "    mov rdi, r8\n"
+             "    syscall\n"
+             "    mov rax, [rbp-8]\n"
+             "    mov rdx, [rbp-16]\n"
+             "    leave\n"
+             "    ret\n"
+             ".fail:\n"
+             "    xor eax, eax\n"
+             "    xor edx, edx\n"
+             "    leave\n"
+             "    ret\n");
+}
+
+// lpc_alloc gets count elements of rsi bytes from mmap, zeroed, and keeps
+// the count in rdi. Bad counts and failed bounds checks end the program with
+// a message on stderr and exit status 1.
+void generateArrayRuntime() {
+      char outOfRange[] = "index out of range\n";
+      char outOfMemory[] = "out of memory\n";
+      fprintf(out, "\nlpc_alloc:\n"
+             "    test rdi, rdi\n"
+             "    js lpc_out_of_range\n"
+             "    mov rax, rdi\n"
+             "    mul rsi\n"
+             "    jo lpc_out_of_memory\n"
+             "    push rdi\n"
+             "    mov rsi, rax\n"
+             "    test rsi, rsi\n"
+             "    jnz .sized\n"
+             "    mov esi, 1\n"
+             ".sized:\n"
+             "    mov eax, 9\n"
+             "    xor edi, edi\n"
+             "    mov edx, 3\n"
+             "    mov r10d, 34\n"
+             "    mov r8, -1\n"
+             "    xor r9d, r9d\n"
+             "    syscall\n"
+             "    pop rdi\n"
+             "    cmp rax, -4096\n"
+             "    ja lpc_out_of_memory\n"
+             "    ret\n"
+             "\nlpc_out_of_range:\n"
+             "    lea rsi, [rel lpc_linja%016lx]\n"
+             "    mov edx, %zu\n"
+             "    jmp lpc_fail\n"
+             "\nlpc_out_of_memory:\n"
+             "    lea rsi, [rel lpc_linja%016lx]\n"
+             "    mov edx, %zu\n"
+             "\nlpc_fail:\n"
+             "    lea rdi, [rel lpc_stderr]\n"
+             "    call lpc_write\n"
+             "    mov edi, 1\n"
+             "    call lpc_flush_all\n"
+             "    mov eax, 60\n"
+             "    syscall\n",
+             internLinja(outOfRange, strlen(outOfRange)), strlen(outOfRange),
+             internLinja(outOfMemory, strlen(outOfMemory)), strlen(outOfMemory));
+}
+
+void generateRuntime() {
+      generateWriteRuntime();
+      generateFormatRuntime();
+      generateReadRuntime();
+      generateArrayRuntime();
+}
+
+// Literals are emitted as quoted runs where they are printable, with a
+// zero behind them for asen code that wants a C string.
+void generateLinjas() {
+      if (linjas.size) fprintf(out, "\nsection .rodata\n");
+      for (size_t i = 0; i < linjas.size; i++) {
+            fprintf(out, "    align 8\n"
+                   "    dq %zu\n"
+                   "lpc_linja%016lx: db ", linjas.lengths[i], linjas.hashes[i]);
+            bool quoted = false;
+            for (size_t j = 0; j < linjas.lengths[i]; j++) {
+                  unsigned char c = linjas.bytes[i][j];
+                  bool printable = c >= ' ' && c <= '~' && c != '"';
+                  if (printable && !quoted) fprintf(out, "%s\"", j ? ", " : "");
+                  if (!printable && quoted) fprintf(out, "\"");
+                  if (printable) fputc(c, out);
+                  else fprintf(out, "%s%d", j ? ", " : "", c);
+                  quoted = printable;
+            }
+            fprintf(out, "%s%s0\n", quoted ? "\"" : "", linjas.lengths[i] ? ", " : "");
+      }
+      if (usesRuntime) {
+            fprintf(out, "\nsection .bss\n"
+                   "    align 8\n"
+                   "lpc_stdout: resb %d\n"
+                   "    align 8\n"
+                   "lpc_stderr: resb %d\n", 16 + OUTPUT_BUFFER_SIZE, 16 + OUTPUT_BUFFER_SIZE);
+      }
+}
+
+int64_t kamaSlot(NodeKamaExpression kama) {
+      int64_t slot = lookupVar(kama.nimi.value);
+      NodeType type = getNameMapType(&vars, kama.nimi.value);
+      if (type.awen) {
+            fprintf(errors, "Trying to change an awen value\n");
+            fail();
+      }
+      if (isArray(type)) {
+            fprintf(errors, "Arrays can't be assigned to, only their elements\n");
+            fail();
+      }
+      return slot;
+}
+
+void generateStore(int64_t slot, NodeExpression expr, NodeType type) {
+      if (isPair(type)) {
+            generatePairInto(expr, type, "r8", "r9");
+            fprintf(out, "    mov qword [rbp%+ld], r8\n"
+                   "    mov qword [rbp%+ld], r9\n", slot, slot + 8);
+            return;
+      }
+      if (isTelo(type)) {
+            generateTeloInto(expr, type);
+            fprintf(out, "    mov%s %s [rbp%+ld], xmm0\n", teloSuffix(type), teloSize(type), slot);
+            return;
+      }
+      checkNanpa(&expr);
+      size_t size = typeSize(type);
+      Operand op = simpleOperand(&expr);
+      if (op.lon && !op.memory) {
+            int64_t value = expr.value.term.value.nanpa.value;
+            if (size < 8) value &= (1LL << size*8) - 1;
+            fprintf(out, "    mov %s, %ld\n", varOperand(slot, type).text, value);
+            return;
+      }
+      generateExpressionInto(expr, "r8");
+      fprintf(out, "    mov %s, %s\n", varOperand(slot, type).text, subRegister("r8", size));
+}
+
+// Stores into an element of an array, pushing the value too when push is
+// set. The value is computed before the index, which needs rcx and r11.
+void generateElementStore(NodeKamaExpression kama, bool push) {
+      NodeType type = arrayType(kama.nimi.value);
+      NodeType element = elementType(type);
+      if (type.awen) {
+            fprintf(errors, "Trying to change an awen value\n");
+            fail();
+      }
+      checkNanpa(kama.index);
+      bool simple = isSimpleIndex(kama.index);
+      if (!simple) generateExpression(*kama.index);
+      Operand value = simpleOperand(kama.expr);
+      bool immediate = !isTelo(element) && value.lon && !value.memory && !push;
+      if (isTelo(element)) generateTeloInto(*kama.expr, element);
+      else if (!immediate) generateExpressionInto(*kama.expr, "r8");
+      if (!simple) pop("rcx");
+      else if (!fixedElement(kama.index, type)) generateIndexInto(kama.index);
+      generateBoundsCheck(kama.index, kama.nimi.value, type);
+      Operand op = elementOperand(kama.index, kama.nimi.value, type);
+      size_t size = typeSize(element);
+      if (isTelo(element)) {
+            fprintf(out, "    mov%s %s, xmm0\n", teloSuffix(element), op.text);
+      } else if (immediate) {
+            int64_t bits = kama.expr->value.term.value.nanpa.value;
+            if (size < 8) bits &= (1LL << size*8) - 1;
+            fprintf(out, "    mov %s, %ld\n", op.text, bits);
+      } else {
+            fprintf(out, "    mov %s, %s\n", op.text, subRegister("r8", size));
+      }
+      if (!push) return;
+      if (isTelo(element)) fprintf(out, "    movq r8, xmm0\n");
+      else extendRegister("r8", element);
+      push_reg("r8");
+}
+
+void generateTerm(NodeTerm term) {
+      if (term.type == NanpaExpr) {
+            push(term.value.nanpa.value);
+      } else if (term.type == NimiExpr) {
+            NodeType type = getNameMapType(&vars, term.value.nimi.value);
+            int64_t slot = lookupVar(term.value.nimi.value);
+            if (isPair(type)) {
+                  generateValue((NodeExpression){.lon = true, .type = TermExpr, .value.term = term}, type);
+            } else if (typeSize(type) == 8) {
+                  push_reg(slotOperand(slot).text);
+            } else if (isTelo(type)) {
+                  fprintf(out, "    movss xmm0, %s\n"
+                         "    movq r8, xmm0\n", varOperand(slot, type).text);
+                  push_reg("r8");
+            } else {
+                  loadVar("r8", slot, type);
+                  push_reg("r8");
+            }
+      } else if (term.type == LinjaExpr) {
+            generateValue((NodeExpression){.lon = true, .type = TermExpr, .value.term = term}, linjaType);
+      } else if (term.type == IndexExpr) {
+            NodeExpression expr = {.lon = true, .type = TermExpr, .value.term = term};
+            NodeType type = expressionType(&expr);
+            if (isTelo(type)) {
+                  generateTeloInto(expr, type);
+                  fprintf(out, "    movq r8, xmm0\n");
+            } else {
+                  generateExpressionInto(expr, "r8");
+            }
+            push_reg("r8");
+      } else if (term.type == KamaExpr && term.value.kama.index) {
+            generateElementStore(term.value.kama, true);
+      } else if (term.type == KamaExpr && isLinja(getNameMapType(&vars, term.value.kama.nimi.value))) {
+            int64_t slot = kamaSlot(term.value.kama);
+            generateStore(slot, *term.value.kama.expr, linjaType);
+            push_reg("r9");
+            push_reg("r8");
+      } else if (term.type == KamaExpr && isTelo(getNameMapType(&vars, term.value.kama.nimi.value))) {
+            int64_t slot = kamaSlot(term.value.kama);
+            generateStore(slot, *term.value.kama.expr, getNameMapType(&vars, term.value.kama.nimi.value));
+            fprintf(out, "    movq r8, xmm0\n");
+            push_reg("r8");
+      } else if (term.type == KamaExpr) {
+            int64_t slot = kamaSlot(term.value.kama);
+            NodeType type = getNameMapType(&vars, term.value.kama.nimi.value);
+            generateExpressionInto(*term.value.kama.expr, "r8");
+            fprintf(out, "    mov %s, %s\n", varOperand(slot, type).text, subRegister("r8", typeSize(type)));
+            extendRegister("r8", type);
+            push_reg("r8");
+      } else if (term.type == CallExpr) {
+            generateCall(term.value.call);
+      }
+}
+
+void generateBinaryExpression(NodeBinaryExpression binExpr);
+
+void generateExpression(NodeExpression expr) {
+      TRACE_ZONE("generateExpression");
+      NodeType type = expressionType(&expr);
+      if (isTelo(type) || isPair(type)) {
+            generateValue(expr, type);
+      } else if (expr.type == TermExpr) {
+            generateTerm(expr.value.term);
+      } else if (expr.type == BinaryExpr) {
+            generateBinaryExpression(*expr.value.binExpr);
+      }
+}
+
+bool isNimi(NodeExpression *expr, char *name);
+size_t expressionWrites(NodeExpression *expr, char *name);
+
+// x = x + y, x = y + x and x = x - y add to or subtract from the slot in
+// place: one instruction with an immediate, inc or dec for 1, and the other
+// side in r8 otherwise. That beats the load, op and store of generateStore
+// as long as y doesn't write x itself.
+bool generateUpdate(NodeKamaExpression kama, int64_t slot, NodeType type) {
+      NodeExpression *expr = kama.expr;
+      char *name = kama.nimi.value;
+      if (optLevel < 1 || isTelo(type) || isPair(type) || isArray(type) || expr->type != BinaryExpr) return false;
+      NodeBinaryExpression *binExpr = expr->value.binExpr;
+      NodeExpression *other;
+      if (binExpr->type == BinAdd && isNimi(binExpr->lhs, name)) other = binExpr->rhs;
+      else if (binExpr->type == BinAdd && isNimi(binExpr->rhs, name)) other = binExpr->lhs;
+      else if (binExpr->type == BinSub && isNimi(binExpr->lhs, name)) other = binExpr->rhs;
+      else return false;
+      if (isTelo(expressionType(other)) || expressionWrites(other, name)) return false;
+      checkNanpa(other);
+
+      size_t size = typeSize(type);
+      Operand target = varOperand(slot, type);
+      bool add = binExpr->type == BinAdd;
+      Operand op = simpleOperand(other);
+      if (op.lon && !op.memory) {
+            int64_t value = other->value.term.value.nanpa.value;
+            if (size < 8) value &= (1LL << size*8) - 1;
+            if (value == 1) fprintf(out, "    %s %s\n", add ? "inc" : "dec", target.text);
+            else fprintf(out, "    %s %s, %ld\n", add ? "add" : "sub", target.text, value);
+            return true;
+      }
+      generateExpressionInto(*other, "r8");
+      fprintf(out, "    %s %s, %s\n", add ? "add" : "sub", target.text, subRegister("r8", size));
+      return true;
+}
+
+void generateKama(NodeKama kama) {
+      if (kama.kama->index) {
+            generateElementStore(*kama.kama, false);
+            return;
+      }
+      int64_t slot = kamaSlot(*kama.kama);
+      NodeType type = getNameMapType(&vars, kama.kama->nimi.value);
+      if (!generateUpdate(*kama.kama, slot, type)) generateStore(slot, *kama.kama->expr, type);
+      for (size_t i = 0; i < loopRangeCount; i++) {
+            if (!strcmp(loopRanges[i].var, kama.kama->nimi.value)) loopRanges[i].decremented = true;
+      }
+}
+
+// A simple right hand side is used in place, otherwise both sides go
+// through the stack. Leaves the lhs in r8 and returns the rhs operand.
+Operand generateOperands(NodeBinaryExpression binExpr) {
+      Operand rhs = simpleOperand(binExpr.rhs);
+      if (rhs.lon) {
+            generateExpressionInto(*binExpr.lhs, "r8");
+            return rhs;
+      }
+      if (binExpr.rhs->type == TermExpr && binExpr.rhs->value.term.type == NimiExpr) {
+            generateExpressionInto(*binExpr.lhs, "r8");
+            generateExpressionInto(*binExpr.rhs, "r9");
+            return (Operand){.lon = true, .text = "r9"};
+      }
+      // Elements with a simple index are used in place when they are 8 bytes
+      if (binExpr.rhs->type == TermExpr && binExpr.rhs->value.term.type == IndexExpr
+          && isSimpleIndex(binExpr.rhs->value.term.value.index.index)) {
+            generateExpressionInto(*binExpr.lhs, "r8");
+            checkNanpa(binExpr.rhs);
+            Operand element = generateElement(binExpr.rhs->value.term.value.index);
+            NodeType type = expressionType(binExpr.rhs);
+            if (typeSize(type) == 8) return element;
+            loadOperand("r9", element.text, type);
+            return (Operand){.lon = true, .text = "r9"};
+      }
+      generateExpression(*binExpr.lhs);
+      generateExpression(*binExpr.rhs);
+      pop("r9");
+      pop("r8");
+      return (Operand){.lon = true, .text = "r9"};
+}
+
+bool isArithmetic(NodeBinaryExpression binExpr) {
+      return binExpr.type == BinAdd || binExpr.type == BinSub || binExpr.type == BinMul
+            || binExpr.type == BinDiv || binExpr.type == BinMod;
+}
+
+// Arithmetic is unsigned as soon as one of the operands is declared
+// unsigned; number literals and comparisons are signed.
+bool expressionUnsigned(NodeExpression *expr) {
+      if (expr->type == BinaryExpr) {
+            NodeBinaryExpression *binExpr = expr->value.binExpr;
+            if (binExpr->type == BinGt || binExpr->type == BinEq || binExpr->type == BinLt) return false;
+            return expressionUnsigned(binExpr->lhs) || expressionUnsigned(binExpr->rhs);
+      }
+      NodeTerm term = expr->value.term;
+      if (term.type == NanpaExpr) return term.value.nanpa.type.isUnsigned;
+      if (term.type == NimiExpr && hasNameMap(&vars, term.value.nimi.value)) {
+            return getNameMapType(&vars, term.value.nimi.value).isUnsigned;
+      }
+      if (term.type == IndexExpr && hasNameMap(&vars, term.value.index.nimi.value)) {
+            return getNameMapType(&vars, term.value.index.nimi.value).isUnsigned;
+      }
+      if (term.type == CallExpr) {
+            NodePali *callee = getPalis(&palis, term.value.call.name);
+            return callee && callee->ret.isUnsigned;
+      }
+      return false;
+}
+
+int log2Exact(uint64_t value) {
+      if (value == 0 || (value & (value - 1))) return -1;
+      return __builtin_ctzll(value);
+}
+
+// Magic numbers for division by constants, from Hacker's Delight chapter 10.
+typedef struct {
+      int64_t multiplier;
+      int shift;
+} SignedMagic;
+
+SignedMagic signedMagic(int64_t d) {
+      const uint64_t two63 = 1ULL << 63;
+      uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+      uint64_t t = two63 + ((uint64_t)d >> 63);
+      uint64_t anc = t - 1 - t % ad;
+      uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+      uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+      uint64_t delta;
+      int p = 63;
+      do {
+            p++;
+            q1 *= 2; r1 *= 2;
+            if (r1 >= anc) { q1++; r1 -= anc; }
+            q2 *= 2; r2 *= 2;
+            if (r2 >= ad) { q2++; r2 -= ad; }
+            delta = ad - r2;
+      } while (q1 < delta || (q1 == delta && r1 == 0));
+      int64_t multiplier = (int64_t)(q2 + 1);
+      return (SignedMagic){.multiplier = d < 0 ? -multiplier : multiplier, .shift = p - 64};
+}
+
+typedef struct {
+      bool lon;
+      uint64_t multiplier;
+      int shift;
+} UnsignedMagic;
+
+// The smallest shift whose multiplier still fits 64 bits, if there is one.
+UnsignedMagic unsignedMagic(uint64_t d) {
+      for (int p = 64; p < 128; p++) {
+            unsigned __int128 power = (unsigned __int128)1 << p;
+            unsigned __int128 m = (power + d - 1) / d;
+            if (m >> 64) break;
+            if (m * d - power <= ((unsigned __int128)1 << (p - 64))) {
+                  return (UnsignedMagic){.lon = true, .multiplier = (uint64_t)m, .shift = p - 64};
+            }
+      }
+      return (UnsignedMagic){};
+}
+
+// rdx = rdx * d, d doesn't always fit an imm32
+void generateMulRdx(int64_t d) {
+      if (d >= INT32_MIN && d <= INT32_MAX) {
+            fprintf(out, "    imul rdx, rdx, %ld\n", d);
+      } else {
+            fprintf(out, "    mov rax, %ld\n"
+                   "    imul rdx, rax\n", d);
+      }
+}
+
+// r8 = r8 / d or r8 % d with the quotient computed by shifts or a multiply
+// high. Returns false for divisors that need a real div.
+bool generateDivConstant(int64_t d, bool isUnsigned, bool mod) {
+      if (d == 0) return false;
+      if (d == 1) {
+            if (mod) fprintf(out, "    mov r8, 0\n");
+            return true;
+      }
+
+      if (isUnsigned) {
+            int k = log2Exact((uint64_t)d);
+            if (k >= 0) {
+                  if (!mod) fprintf(out, "    shr r8, %d\n", k);
+                  else if ((uint64_t)d - 1 <= INT32_MAX) fprintf(out, "    and r8, %ld\n", d - 1);
+                  else fprintf(out, "    mov rax, %ld\n"
+                              "    and r8, rax\n", d - 1);
+                  return true;
+            }
+            UnsignedMagic magic = unsignedMagic((uint64_t)d);
+            if (magic.lon) {
+                  fprintf(out, "    mov rax, %lu\n"
+                         "    mul r8\n", magic.multiplier);
+                  if (magic.shift) fprintf(out, "    shr rdx, %d\n", magic.shift);
+            } else {
+                  // The multiplier needs 65 bits, add the missing bit back in
+                  int l = 64 - __builtin_clzll((uint64_t)d);
+                  unsigned __int128 m = ((((unsigned __int128)1 << l) - (uint64_t)d) << 64) / (uint64_t)d + 1;
+                  fprintf(out, "    mov rax, %lu\n"
+                         "    mul r8\n"
+                         "    mov rax, r8\n"
+                         "    sub rax, rdx\n"
+                         "    shr rax, 1\n"
+                         "    add rdx, rax\n", (uint64_t)m);
+                  if (l > 1) fprintf(out, "    shr rdx, %d\n", l - 1);
+            }
+      } else {
+            if (d == -1) {
+                  fprintf(out, mod ? "    mov r8, 0\n" : "    neg r8\n");
+                  return true;
+            }
+            if (d == INT64_MIN) return false;
+            uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+            int k = log2Exact(ad);
+            if (k >= 0) {
+                  // Round towards zero by adding |d|-1 to negative dividends
+                  fprintf(out, "    mov rax, r8\n"
+                         "    sar rax, 63\n"
+                         "    shr rax, %d\n"
+                         "    add rax, r8\n"
+                         "    sar rax, %d\n", 64 - k, k);
+                  if (mod) {
+                        fprintf(out, "    shl rax, %d\n"
+                               "    sub r8, rax\n", k);
+                  } else {
+                        if (d < 0) fprintf(out, "    neg rax\n");
+                        fprintf(out, "    mov r8, rax\n");
+                  }
+                  return true;
+            }
+            SignedMagic magic = signedMagic(d);
+            fprintf(out, "    mov rax, %ld\n"
+                   "    imul r8\n", magic.multiplier);
+            if (d > 0 && magic.multiplier < 0) fprintf(out, "    add rdx, r8\n");
+            if (d < 0 && magic.multiplier > 0) fprintf(out, "    sub rdx, r8\n");
+            if (magic.shift) fprintf(out, "    sar rdx, %d\n", magic.shift);
+            fprintf(out, "    mov rax, rdx\n"
+                   "    shr rax, 63\n"
+                   "    add rdx, rax\n");
+      }
+
+      if (mod) {
+            generateMulRdx(d);
+            fprintf(out, "    sub r8, rdx\n");
+      } else {
+            fprintf(out, "    mov r8, rdx\n");
+      }
+      return true;
+}
+
+void generateMulConstant(int64_t c) {
+      int k = log2Exact((uint64_t)c);
+      if (c == 0) fprintf(out, "    mov r8, 0\n");
+      else if (k == 0) return;
+      else if (k > 0) fprintf(out, "    shl r8, %d\n", k);
+      else fprintf(out, "    imul r8, r8, %ld\n", c);
+}
+
+// Instruction selection for arithmetic trees. Every pattern covers a node
+// and maybe some of its children with one instruction, and costs about what
+// its instructions take; a tree costs what its cheapest cover does. The
+// default per node code in generateArithmetic is one pattern among them.
+typedef struct {
+      char *name;
+      bool (*matches)(NodeBinaryExpression *binExpr);
+      int (*cost)(NodeBinaryExpression *binExpr);
+      void (*emit)(NodeBinaryExpression *binExpr);
+} Pattern;
+
+int expressionCost(NodeExpression *expr);
+
+int termCost(NodeTerm term) {
+      switch (term.type) {
+      case NanpaExpr:
+      case NimiExpr: return 1;
+      case IndexExpr: return 3;
+      case CallExpr: return 10;
+      default: return 2;
+      }
+}
+
+bool isNanpaLiteral(NodeExpression *expr) {
+      return expr->type == TermExpr && expr->value.term.type == NanpaExpr;
+}
+
+// expr as operand * scale with scale one of the given constants
+bool scaledOperand(NodeExpression *expr, int64_t *scales, NodeExpression **operand, int64_t *scale) {
+      if (expr->type != BinaryExpr || expr->value.binExpr->type != BinMul) return false;
+      NodeBinaryExpression *mul = expr->value.binExpr;
+      NodeExpression *constant = isNanpaLiteral(mul->rhs) ? mul->rhs : isNanpaLiteral(mul->lhs) ? mul->lhs : NULL;
+      if (!constant) return false;
+      for (int64_t *s = scales; *s; s++) {
+            if (constant->value.term.value.nanpa.value != *s) continue;
+            *operand = constant == mul->rhs ? mul->lhs : mul->rhs;
+            *scale = *s;
+            return !isTelo(expressionType(*operand));
+      }
+      return false;
+}
+
+int64_t indexScales[] = {1, 2, 4, 8, 0};
+int64_t offsetScales[] = {2, 4, 8, 0};
+int64_t leaMultipliers[] = {3, 5, 9, 0};
+
+bool isLoadedVar(NodeExpression *expr) {
+      return expr->type == TermExpr && expr->value.term.type == NimiExpr
+            && !isTelo(expressionType(expr));
+}
+
+// a + b*s with b a variable: lea r8, [r8+r9*s]
+bool matchesScaledIndex(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand;
+      int64_t scale;
+      if (binExpr->type != BinAdd) return false;
+      if (scaledOperand(binExpr->rhs, indexScales, &operand, &scale) && isLoadedVar(operand)) return true;
+      return scaledOperand(binExpr->lhs, indexScales, &operand, &scale) && isLoadedVar(operand);
+}
+
+int costScaledIndex(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand;
+      int64_t scale;
+      bool right = scaledOperand(binExpr->rhs, indexScales, &operand, &scale) && isLoadedVar(operand);
+      return expressionCost(right ? binExpr->lhs : binExpr->rhs) + 2;
+}
+
+void emitScaledIndex(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand;
+      int64_t scale;
+      bool right = scaledOperand(binExpr->rhs, indexScales, &operand, &scale) && isLoadedVar(operand);
+      if (!right) scaledOperand(binExpr->lhs, indexScales, &operand, &scale);
+      generateExpressionInto(*(right ? binExpr->lhs : binExpr->rhs), "r8");
+      generateExpressionInto(*operand, "r9");
+      fprintf(out, "    lea r8, [r8+r9*%ld]\n", scale);
+}
+
+// b*s + k and b*s - k: lea r8, [r8*s+k]
+bool matchesScaledOffset(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand;
+      int64_t scale;
+      if ((binExpr->type != BinAdd && binExpr->type != BinSub) || !isNanpaLiteral(binExpr->rhs)) return false;
+      int64_t k = binExpr->rhs->value.term.value.nanpa.value;
+      return k > INT32_MIN && k <= INT32_MAX && scaledOperand(binExpr->lhs, offsetScales, &operand, &scale);
+}
+
+int costScaledOffset(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand;
+      int64_t scale;
+      scaledOperand(binExpr->lhs, offsetScales, &operand, &scale);
+      return expressionCost(operand) + 1;
+}
+
+void emitScaledOffset(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand;
+      int64_t scale;
+      scaledOperand(binExpr->lhs, offsetScales, &operand, &scale);
+      int64_t k = binExpr->rhs->value.term.value.nanpa.value;
+      generateExpressionInto(*operand, "r8");
+      fprintf(out, "    lea r8, [r8*%ld%+ld]\n", scale, binExpr->type == BinAdd ? k : -k);
+}
+
+// b*3, b*5 and b*9: lea r8, [r8+r8*2]
+bool matchesLeaMultiply(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand, expr = {.lon = true, .type = BinaryExpr, .value.binExpr = binExpr};
+      int64_t scale;
+      return scaledOperand(&expr, leaMultipliers, &operand, &scale);
+}
+
+int costLeaMultiply(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand, expr = {.lon = true, .type = BinaryExpr, .value.binExpr = binExpr};
+      int64_t scale;
+      scaledOperand(&expr, leaMultipliers, &operand, &scale);
+      return expressionCost(operand) + 1;
+}
+
+void emitLeaMultiply(NodeBinaryExpression *binExpr) {
+      NodeExpression *operand, expr = {.lon = true, .type = BinaryExpr, .value.binExpr = binExpr};
+      int64_t scale;
+      scaledOperand(&expr, leaMultipliers, &operand, &scale);
+      generateExpressionInto(*operand, "r8");
+      fprintf(out, "    lea r8, [r8+r8*%ld]\n", scale - 1);
+}
+
+// What generateArithmetic does on its own: the lhs into r8 and the rhs as
+// an immediate, a slot or r9, then one instruction for the operator
+int costArithmetic(NodeBinaryExpression *binExpr) {
+      NodeExpression *lhs = binExpr->lhs, *rhs = binExpr->rhs;
+      if (binExpr->type == BinMul && isNanpaLiteral(lhs) && !simpleOperand(rhs).lon) {
+            lhs = binExpr->rhs;
+            rhs = binExpr->lhs;
+      }
+      int cost = expressionCost(lhs);
+      if (simpleOperand(rhs).lon) {
+            // Used in place
+      } else if (rhs->type == TermExpr && rhs->value.term.type == NimiExpr) {
+            cost += 1;
+      } else if (rhs->type == TermExpr && rhs->value.term.type == IndexExpr && isSimpleIndex(rhs->value.term.value.index.index)) {
+            cost += 2;
+      } else {
+            cost += expressionCost(rhs) + 4;
+      }
+      bool constant = isNanpaLiteral(rhs);
+      int64_t value = constant ? rhs->value.term.value.nanpa.value : 0;
+      switch (binExpr->type) {
+      case BinMul: return cost + (constant && (value == 0 || log2Exact(value) >= 0) ? 1 : 3);
+      case BinDiv:
+      case BinMod: return cost + (constant ? 6 : 25);
+      default: return cost + 1;
+      }
+}
+
+Pattern patterns[] = {
+      {"lea scaled index", matchesScaledIndex, costScaledIndex, emitScaledIndex},
+      {"lea scaled offset", matchesScaledOffset, costScaledOffset, emitScaledOffset},
+      {"lea multiply", matchesLeaMultiply, costLeaMultiply, emitLeaMultiply},
+};
+
+// The cheapest pattern for binExpr, or NULL when that's the default code.
+// Costs are computed again at every node, which is quadratic only in how
+// deep one expression nests.
+Pattern *selectPattern(NodeBinaryExpression *binExpr, int *cost) {
+      Pattern *best = NULL;
+      *cost = costArithmetic(binExpr);
+      if (optLevel < 1) return NULL;
+      for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); i++) {
+            if (!patterns[i].matches(binExpr)) continue;
+            int c = patterns[i].cost(binExpr);
+            if (c < *cost) {
+                  *cost = c;
+                  best = &patterns[i];
+            }
+      }
+      return best;
+}
+
+int expressionCost(NodeExpression *expr) {
+      if (expr->type == TermExpr) return termCost(expr->value.term);
+      NodeBinaryExpression *binExpr = expr->value.binExpr;
+      if (!isArithmetic(*binExpr)) return expressionCost(binExpr->lhs) + expressionCost(binExpr->rhs) + 3;
+      int cost;
+      selectPattern(binExpr, &cost);
+      return cost;
+}
+
+// Computes arithmetic into r8 without going through the stack. Division
+// follows the signedness of the operands: cqo and idiv, or a zeroed rdx and
+// div; division by a constant never reaches either.
+void generateArithmetic(NodeBinaryExpression binExpr) {
+      int cost;
+      Pattern *pattern = selectPattern(&binExpr, &cost);
+      if (pattern) {
+            pattern->emit(&binExpr);
+            return;
+      }
+      if (binExpr.type == BinMul && binExpr.lhs->type == TermExpr
+          && binExpr.lhs->value.term.type == NanpaExpr && !simpleOperand(binExpr.rhs).lon) {
+            NodeExpression *lhs = binExpr.lhs;
+            binExpr.lhs = binExpr.rhs;
+            binExpr.rhs = lhs;
+      }
+
+      Operand rhs = generateOperands(binExpr);
+      bool constant = !rhs.memory && strcmp(rhs.text, "r9");
+      int64_t value = constant ? binExpr.rhs->value.term.value.nanpa.value : 0;
+      bool isUnsigned = expressionUnsigned(binExpr.lhs) || expressionUnsigned(binExpr.rhs);
+
+      switch (binExpr.type) {
+      case BinAdd:
+            fprintf(out, "    add r8, %s\n", rhs.text);
+            break;
+      case BinSub:
+            fprintf(out, "    sub r8, %s\n", rhs.text);
+            break;
+      case BinMul:
+            if (constant) generateMulConstant(value);
+            else fprintf(out, "    imul r8, %s\n", rhs.text);
+            break;
+      case BinDiv:
+      case BinMod:
+            if (constant && generateDivConstant(value, isUnsigned, binExpr.type == BinMod)) break;
+            if (constant) {
+                  fprintf(out, "    mov r9, %s\n", rhs.text);
+                  strcpy(rhs.text, "r9");
+            }
+            fprintf(out, "    mov rax, r8\n"
+                   "    %s\n"
+                   "    %s %s\n"
+                   "    mov r8, %s\n",
+                   isUnsigned ? "xor edx, edx" : "cqo",
+                   isUnsigned ? "div" : "idiv", rhs.text,
+                   binExpr.type == BinMod ? "rdx" : "rax");
+            break;
+      default:
+            assert(false);
+      }
+}
+
+// Comparing a register with 0 is test, which is shorter and fuses with the
+// jump the same way
+void generateCompare(char *reg, char *rhs) {
+      if (!strcmp(rhs, "0")) fprintf(out, "    test %s, %s\n", reg, reg);
+      else fprintf(out, "    cmp %s, %s\n", reg, rhs);
+}
+
+void generateBinaryExpression(NodeBinaryExpression binExpr) {
+      NodeType type = operandType(binExpr);
+      if (isTelo(type) && isComparison(binExpr)) {
+            generateTeloComparison(binExpr, type);
+            push_reg("r8");
+            return;
+      }
+      if (isArithmetic(binExpr)) {
+            generateArithmetic(binExpr);
+            push_reg("r8");
+            return;
+      }
+
+      // setcc rather than a jump over a push, so there's no branch to
+      // mispredict and nothing depends on how the jump is encoded
+      bool isUnsigned = expressionUnsigned(binExpr.lhs) || expressionUnsigned(binExpr.rhs);
+      char *set;
+      switch (binExpr.type) {
+      case BinGt: set = isUnsigned ? "seta" : "setg"; break;
+      case BinEq: set = "sete"; break;
+      case BinLt: set = isUnsigned ? "setb" : "setl"; break;
+      default: return;
+      }
+      Operand rhs = generateOperands(binExpr);
+      generateCompare("r8", rhs.text);
+      fprintf(out, "    %s al\n"
+             "    movzx r8d, al\n", set);
+      push_reg("r8");
+}
+
+bool isNimi(NodeExpression *expr, char *name) {
+      return expr->type == TermExpr && expr->value.term.type == NimiExpr
+            && !strcmp(expr->value.term.value.nimi.value, name);
+}
+
+bool isNanpa(NodeExpression *expr, int64_t value) {
+      return expr->type == TermExpr && expr->value.term.type == NanpaExpr
+            && expr->value.term.value.nanpa.value == value;
+}
+
+// Constant folding works on copies: a folded expression is a new node
+// wherever something under it changed, so the parsed program stays as it
+// was written for documents and the next generate. The copies live until
+// the end of generateProgram.
+_Thread_local void **folds = NULL;
+_Thread_local size_t foldCount = 0;
+_Thread_local size_t foldCapacity = 0;
+
+void *foldAlloc(size_t size) {
+      if (foldCount == foldCapacity) {
+            foldCapacity = foldCapacity ? foldCapacity * 2 : 64;
+            folds = realloc(folds, sizeof(void*)*foldCapacity);
+      }
+      return folds[foldCount++] = calloc(1, size);
+}
+
+void clearFolds() {
+      for (size_t i = 0; i < foldCount; i++) free(folds[i]);
+      foldCount = 0;
+}
+
+NodeExpression *foldedNanpa(int64_t value, NodeType type) {
+      NodeExpression *expr = foldAlloc(sizeof(NodeExpression));
+      *expr = (NodeExpression){.lon = true, .type = TermExpr, .value.term = {.lon = true, .type = NanpaExpr,
+                  .value.nanpa = {.lon = true, .value = value, .type = type}}};
+      return expr;
+}
+
+NodeExpression *foldedTelo(double value, NodeType type) {
+      NodeExpression *expr = foldAlloc(sizeof(NodeExpression));
+      *expr = (NodeExpression){.lon = true, .type = TermExpr, .value.term = {.lon = true, .type = TeloExpr,
+                  .value.telo = {.lon = true, .value = value, .type = type}}};
+      return expr;
+}
+
+bool isNumber(NodeExpression *expr) {
+      return expr->type == TermExpr && (expr->value.term.type == NanpaExpr || expr->value.term.type == TeloExpr);
+}
+
+// Nanpa arithmetic wraps like the registers do. Division by zero and
+// INT64_MIN / -1 are left for run time.
+NodeExpression *foldNanpa(NodeBinaryExpression binExpr, bool isUnsigned) {
+      uint64_t lhs = binExpr.lhs->value.term.value.nanpa.value;
+      uint64_t rhs = binExpr.rhs->value.term.value.nanpa.value;
+      NodeType type = {.lon = true, .type = Nanpa, .isUnsigned = isUnsigned};
+      if ((binExpr.type == BinDiv || binExpr.type == BinMod)
+          && (rhs == 0 || (!isUnsigned && (int64_t)lhs == INT64_MIN && (int64_t)rhs == -1))) return NULL;
+      switch (binExpr.type) {
+      case BinAdd: return foldedNanpa(lhs + rhs, type);
+      case BinSub: return foldedNanpa(lhs - rhs, type);
+      case BinMul: return foldedNanpa(lhs * rhs, type);
+      case BinDiv: return foldedNanpa(isUnsigned ? lhs / rhs : (uint64_t)((int64_t)lhs / (int64_t)rhs), type);
+      case BinMod: return foldedNanpa(isUnsigned ? lhs % rhs : (uint64_t)((int64_t)lhs % (int64_t)rhs), type);
+      case BinGt: return foldedNanpa(isUnsigned ? lhs > rhs : (int64_t)lhs > (int64_t)rhs, nanpaType);
+      case BinLt: return foldedNanpa(isUnsigned ? lhs < rhs : (int64_t)lhs < (int64_t)rhs, nanpaType);
+      case BinEq: return foldedNanpa(lhs == rhs, nanpaType);
+      }
+      return NULL;
+}
+
+// telo lili is folded in float, so the result is the one the program
+// would have computed
+NodeExpression *foldTelo(NodeBinaryExpression binExpr, NodeType type) {
+      double lhs = literalTelo(binExpr.lhs->value.term);
+      double rhs = literalTelo(binExpr.rhs->value.term);
+      bool lili = type.type == TeloLili;
+      if (lili) {
+            lhs = (float)lhs;
+            rhs = (float)rhs;
+      }
+      double value;
+      switch (binExpr.type) {
+      case BinAdd: value = lhs + rhs; break;
+      case BinSub: value = lhs - rhs; break;
+      case BinMul: value = lhs * rhs; break;
+      case BinDiv: value = lhs / rhs; break;
+      case BinGt: return foldedNanpa(lhs > rhs, nanpaType);
+      case BinLt: return foldedNanpa(lhs < rhs, nanpaType);
+      case BinEq: return foldedNanpa(lhs == rhs, nanpaType);
+      default: return NULL;
+      }
+      return foldedTelo(lili ? (float)value : value, (NodeType){.lon = true, .type = type.type});
+}
+
+// Replaces awen values that are constants with their literal and computes
+// what only depends on literals
+NodeExpression *foldExpression(NodeExpression *expr) {
+      if (!expr || optLevel < 1) return expr;
+      if (expr->type == BinaryExpr) {
+            NodeBinaryExpression binExpr = *expr->value.binExpr;
+            binExpr.lhs = foldExpression(binExpr.lhs);
+            binExpr.rhs = foldExpression(binExpr.rhs);
+            if (isNumber(binExpr.lhs) && isNumber(binExpr.rhs)) {
+                  NodeType type = operandType(binExpr);
+                  NodeExpression *folded = isTelo(type) ? foldTelo(binExpr, type)
+                        : foldNanpa(binExpr, expressionUnsigned(binExpr.lhs) || expressionUnsigned(binExpr.rhs));
+                  if (folded) return folded;
+            }
+            if (binExpr.lhs == expr->value.binExpr->lhs && binExpr.rhs == expr->value.binExpr->rhs) return expr;
+            NodeExpression *copy = foldAlloc(sizeof(NodeExpression));
+            *copy = *expr;
+            copy->value.binExpr = foldAlloc(sizeof(NodeBinaryExpression));
+            *copy->value.binExpr = binExpr;
+            return copy;
+      }
+      NodeTerm term = expr->value.term;
+      if (term.type == NimiExpr && hasNameMap(&vars, term.value.nimi.value)) {
+            NodeType type = getNameMapType(&vars, term.value.nimi.value);
+            return type.constant ? type.constant : expr;
+      }
+      if (term.type != IndexExpr && term.type != KamaExpr && term.type != CallExpr) return expr;
+      NodeExpression *copy = foldAlloc(sizeof(NodeExpression));
+      *copy = *expr;
+      bool changed = false;
+      if (term.type == IndexExpr) {
+            copy->value.term.value.index.index = foldExpression(term.value.index.index);
+            changed = copy->value.term.value.index.index != term.value.index.index;
+      } else if (term.type == KamaExpr) {
+            copy->value.term.value.kama.index = foldExpression(term.value.kama.index);
+            copy->value.term.value.kama.expr = foldExpression(term.value.kama.expr);
+            changed = copy->value.term.value.kama.index != term.value.kama.index
+                  || copy->value.term.value.kama.expr != term.value.kama.expr;
+      } else if (term.type == CallExpr && term.value.call.argc) {
+            NodeExpression **args = foldAlloc(sizeof(NodeExpression*)*term.value.call.argc);
+            for (size_t i = 0; i < term.value.call.argc; i++) {
+                  args[i] = foldExpression(term.value.call.args[i]);
+                  changed |= args[i] != term.value.call.args[i];
+            }
+            copy->value.term.value.call.args = args;
+      }
+      return changed ? copy : expr;
+}
+
+// The statement node generate works from, with its expressions folded
+Node foldNode(Node node) {
+      if (optLevel < 1) return node;
+      switch (node.type) {
+      case Expression:
+            node.node.expr = foldExpression(node.node.expr);
+            break;
+      case Otawa: {
+            NodeOtawa *otawa = foldAlloc(sizeof(NodeOtawa));
+            *otawa = *node.node.otawa;
+            otawa->expr = foldExpression(otawa->expr);
+            node.node.otawa = otawa;
+            break;
+      }
+      case O: {
+            NodeO *o = foldAlloc(sizeof(NodeO));
+            *o = *node.node.o;
+            o->expr = foldExpression(o->expr);
+            o->type.length = foldExpression(o->type.length);
+            if (o->type.length && o->type.length->type == TermExpr && o->type.length->value.term.type == NanpaExpr
+                && o->type.length->value.term.value.nanpa.value > 0) {
+                  o->type.count = o->type.length->value.term.value.nanpa.value;
+                  o->type.length = NULL;
+            }
+            node.node.o = o;
+            break;
+      }
+      case Kama: {
+            NodeKamaExpression *kama = foldAlloc(sizeof(NodeKamaExpression));
+            *kama = *node.node.kama.kama;
+            kama->index = foldExpression(kama->index);
+            kama->expr = foldExpression(kama->expr);
+            node.node.kama.kama = kama;
+            break;
+      }
+      case Tenpo: {
+            NodeTenpo *tenpo = foldAlloc(sizeof(NodeTenpo));
+            *tenpo = *node.node.tenpo;
+            tenpo->expr = foldExpression(tenpo->expr);
+            node.node.tenpo = tenpo;
+            break;
+      }
+      case La: {
+            NodeLa *la = foldAlloc(sizeof(NodeLa));
+            *la = *node.node.la;
+            la->expr = foldExpression(la->expr);
+            node.node.la = la;
+            break;
+      }
+      default:
+            break;
+      }
+      return node;
+}
+
+// An awen value that starts out as a literal, or as something that folds
+// to one, is that literal from here on and takes no slot. Nothing can take
+// the address of a value, so it never needs storage.
+bool bindConstant(NodeO o) {
+      NodeExpression *expr = o.expr;
+      if (optLevel < 1 || !o.type.awen || isArray(o.type) || expr->type != TermExpr) return false;
+      NodeTerm term = expr->value.term;
+      NodeType type = o.type;
+      type.awen = false;
+      if (isLinja(o.type) && term.type == LinjaExpr) {
+            o.type.constant = expr;
+      } else if (isTelo(o.type) && isNumber(expr)) {
+            double value = literalTelo(term);
+            o.type.constant = foldedTelo(type.type == TeloLili ? (float)value : value, type);
+      } else if (!isTelo(o.type) && !isPair(o.type) && term.type == NanpaExpr) {
+            int64_t value = term.value.nanpa.value;
+            size_t bits = typeSize(type) * 8;
+            if (bits < 64 && type.isUnsigned) value &= (1LL << bits) - 1;
+            else if (bits < 64) value = (int64_t)((uint64_t)value << (64 - bits)) >> (64 - bits);
+            o.type.constant = foldedNanpa(value, type);
+      } else {
+            return false;
+      }
+      addNameMap(&vars, o.name.value, 0, o.type);
+      return true;
+}
+
+// Arrays without a length are bound to the array they are declared with.
+// The others are filled with the value they are declared with, either in
+// the frame or in memory from lpc_alloc, which comes zeroed.
+void generateArray(NodeO o) {
+      NodeType type = o.type;
+      NodeType element = elementType(type);
+      size_t size = typeSize(element);
+      if (!type.count && !type.length) {
+            int64_t slot = allocSlot(16);
+            generateStore(slot, *o.expr, type);
+            addNameMap(&vars, o.name.value, slot, type);
+            return;
+      }
+      int64_t slot;
+      if (inFrame(type)) {
+            slot = allocAligned(type.count * size, size < 8 ? size : 8);
+      } else {
+            slot = allocSlot(16);
+            if (type.length) {
+                  generateExpressionInto(*type.length, "rdi");
+            } else {
+                  fprintf(out, "    mov rdi, %ld\n", type.count);
+            }
+            fprintf(out, "    mov esi, %zu\n"
+                   "    call lpc_alloc\n"
+                   "    mov qword [rbp%+ld], rax\n"
+                   "    mov qword [rbp%+ld], rdi\n", size, slot, slot + 8);
+      }
+      if (isTelo(element)) {
+            generateTeloInto(*o.expr, element);
+            fprintf(out, "    movq rax, xmm0\n");
+      } else if (!inFrame(type) && isNanpa(o.expr, 0)) {
+            addNameMap(&vars, o.name.value, slot, type);
+            return;
+      } else {
+            generateExpressionInto(*o.expr, "rax");
+      }
+      if (inFrame(type)) {
+            fprintf(out, "    lea rdi, [rbp%+ld]\n"
+                   "    mov rcx, %ld\n", slot, type.count);
+      } else {
+            fprintf(out, "    mov rdi, qword [rbp%+ld]\n"
+                   "    mov rcx, qword [rbp%+ld]\n", slot, slot + 8);
+      }
+      fprintf(out, "    rep stos%c\n", size == 1 ? 'b' : size == 2 ? 'w' : size == 4 ? 'd' : 'q');
+      addNameMap(&vars, o.name.value, slot, type);
+}
+
+// nasm's DWARF has no variables, so -g notes the slot of each next to the
+// code that declares it
+void generateVarLocation(char *name) {
+      fprintf(out, "    ;; %s at [rbp%+ld]\n", name, getNameMap(&vars, name));
+}
+
+void generateO(NodeO o) {
+      if (hasNameMap(&vars, o.name.value)) {
+            fprintf(errors, "Duplicate variable declaration");
+            fail();
+      }
+
+      if (o.name.type != TOKEN_NAME)
+            assert(false);
+
+      if (!o.type.lon)
+            assert(false);
+
+      if (isArray(o.type)) {
+            generateArray(o);
+            if (debugInfo) generateVarLocation(o.name.value);
+            return;
+      }
+      if (bindConstant(o)) return;
+
+      int64_t slot = allocSlot(typeSize(o.type));
+      generateStore(slot, *o.expr, o.type);
+      addNameMap(&vars, o.name.value, slot, o.type);
+      if (debugInfo) generateVarLocation(o.name.value);
+}
+
+bool isCallTo(NodeExpression *expr, char *name) {
+      return expr->type == TermExpr && expr->value.term.type == CallExpr
+            && !strcmp(expr->value.term.value.call.name, name);
+}
+
+// otawa g(...) in a pali doesn't need a frame of its own for g. The
+// arguments are computed and moved to where the caller of this pali pushed
+// its own, right above the return address, and the pali jumps to .tailcall
+// behind its prologue when g is itself, or leaves its frame and jumps to g,
+// which returns straight to that caller. The caller pops as many entries as
+// it pushed, so g can't take more than this pali does, and it has to give
+// back the same type as nothing converts it on the way. Arrays in the frame
+// would be gone or overwritten by the time g reads them, and a [] view can
+// point at one, so pairs are only passed on when they are parameters of this
+// pali, which live above its frame.
+
+size_t paramEntries(NodePali *pali) {
+      size_t entries = 0;
+      for (size_t i = 0; i < pali->paramCount; i++) entries += stackEntries(pali->paramTypes[i]);
+      return entries;
+}
+
+bool generateTailCall(NodeExpression *expr) {
+      if (!tailCalls || optLevel < 1 || !frame.pali || frame.inlined || stackOffset != 0) return false;
+      if (expr->type != TermExpr || expr->value.term.type != CallExpr) return false;
+      NodeCallExpression call = expr->value.term.value.call;
+      NodePali *callee = getPalis(&palis, call.name);
+      if (!callee || call.argc != callee->paramCount) return false;
+      bool self = callee == frame.pali;
+      if (!self && call.inlined && !expanding(callee)) return false;
+      NodeType ret = callee->ret, own = frame.pali->ret;
+      if (ret.type != own.type || ret.isUnsigned != own.isUnsigned || ret.array != own.array) return false;
+      if (paramEntries(callee) > paramEntries(frame.pali)) return false;
+      for (size_t i = 0; i < call.argc; i++) {
+            NodeExpression *arg = call.args[i];
+            if (!isPair(expressionType(arg))) continue;
+            if (arg->type != TermExpr || arg->value.term.type != NimiExpr || lookupVar(arg->value.term.value.nimi.value) < 16) return false;
+      }
+
+      for (size_t i = 0; i < call.argc; i++) generateValue(*call.args[i], callee->paramTypes[i]);
+      for (int64_t displacement = 16; stackOffset > 0; displacement += 8) {
+            pop(slotOperand(displacement).text);
+      }
+      if (self) {
+            fprintf(out, "    jmp .tailcall\n");
+      } else {
+            addUnitCall(callee);
+            fprintf(out, "    leave\n"
+                   "    jmp pali_%s\n", callee->name);
+      }
+      return true;
+}
+
+bool nodesTailCall(Nodes *nodes, char *name) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Otawa && isCallTo(node.node.otawa->expr, name)) return true;
+            if (node.type == Tenpo && nodesTailCall(&node.node.tenpo->nodes, name)) return true;
+            if (node.type == La && (nodesTailCall(&node.node.la->nodes, name) || nodesTailCall(&node.node.la->ante, name))) return true;
+      }
+      return false;
+}
+
+void generateOtawa(NodeOtawa otawa) {
+      if (frame.pali) {
+            if (isArray(frame.pali->ret) && otawa.expr->type == TermExpr && otawa.expr->value.term.type == NimiExpr
+                && inFrame(getNameMapType(&vars, otawa.expr->value.term.value.nimi.value))) {
+                  fprintf(errors, "%s lives in the frame of %s and can't be given back from it\n",
+                          otawa.expr->value.term.value.nimi.value, frame.pali->name);
+                  fail();
+            }
+            if (generateTailCall(otawa.expr)) return;
+            if (isPair(frame.pali->ret)) {
+                  generatePairInto(*otawa.expr, frame.pali->ret, "rax", "rdx");
+            } else if (isTelo(frame.pali->ret)) {
+                  generateTeloInto(*otawa.expr, frame.pali->ret);
+                  fprintf(out, "    movq rax, xmm0\n");
+            } else {
+                  generateExpressionInto(*otawa.expr, "rax");
+                  extendRegister("rax", frame.pali->ret);
+            }
+            if (frame.inlined) {
+                  if (stackOffset != frame.base) {
+                        fprintf(out, "    add rsp, %ld\n", (stackOffset - frame.base) * 8);
+                  }
+                  fprintf(out, "    jmp .inlineout%ld\n", frame.inlineNumber);
+            } else {
+                  fprintf(out, "    leave\n"
+                         "    ret\n");
+            }
+            return;
+      }
+      generateExpressionInto(*otawa.expr, "rdi");
+      if (instrumentPath) fprintf(out, "    call lpc_profile_dump\n");
+      if (usesRuntime) fprintf(out, "    call lpc_flush_all\n");
+      fprintf(out, "    mov rax, 60\n"
+             "    syscall\n");
+}
+
+void generateTenpo(NodeTenpo tenpo);
+void generateLa(NodeLa *la);
+
+void generateStatement(Node* statement) {
+      TRACE_ZONE("generateStatement");
+      Node folded = foldNode(*statement);
+      Node *node = &folded;
+      if (node->type == Expression && (isCallTo(node->node.expr, "otokis") || isCallTo(node->node.expr, "pakala"))) {
+            generateOtokis(node->node.expr->value.term.value.call);
+      } else if (node->type == Expression) {
+            NodeType type = expressionType(node->node.expr);
+            generateExpression(*node->node.expr);
+            for (size_t i = 0; i < stackEntries(type); i++) pop("r8");
+      }
+      else if (node->type == Otawa) generateOtawa(*node->node.otawa);
+      else if (node->type == Asen) generateAsenpeli(node->node.asen);
+      else if (node->type == O) generateO(*node->node.o);
+      else if (node->type == Kama) generateKama(node->node.kama);
+      else if (node->type == Tenpo) generateTenpo(*node->node.tenpo);
+      else if (node->type == La) generateLa(node->node.la);
+}
+
+_Thread_local size_t loopNumber = 0;
+
+// Sets the flags for a nanpa condition, which is true when it isn't zero
+void generateCondition(NodeExpression *expr) {
+      if (expr->type == TermExpr && expr->value.term.type == NimiExpr) checkNanpa(expr);
+      generateExpressionInto(*expr, "rcx");
+      generateCompare("rcx", "0");
+}
+
+// Jumps to target when expr is true, or when it is false with onTrue unset.
+// Comparisons jump on the flags of their cmp or ucomis instead of computing
+// a 0 or 1 and testing that.
+char *conditionCode(NodeBinaryExpression binExpr, bool isUnsigned, bool negate) {
+      switch (binExpr.type) {
+      case BinGt:
+            return negate ? (isUnsigned ? "be" : "le") : (isUnsigned ? "a" : "g");
+      case BinLt:
+            return negate ? (isUnsigned ? "ae" : "ge") : (isUnsigned ? "b" : "l");
+      case BinEq:
+            return negate ? "ne" : "e";
+      default:
+            assert(false);
+            return "";
+      }
+}
+
+typedef struct {
+      char text[32];
+} Label;
+
+Label label(char *name, int64_t number) {
+      Label l;
+      snprintf(l.text, sizeof(l.text), "%s%ld", name, number);
+      return l;
+}
+
+_Thread_local size_t branchNumber = 0;
+
+// NaN compares false, so only ja, jbe and the parity flag are used
+void generateTeloBranch(NodeBinaryExpression binExpr, NodeType type, bool onTrue, Label target) {
+      Operand rhs = generateTeloOperands(binExpr, type);
+      char *compare = type.type == TeloLili ? "ucomiss" : "ucomisd";
+      if (binExpr.type == BinLt) {
+            if (rhs.memory) fprintf(out, "    mov%s xmm1, %s\n", teloSuffix(type), rhs.text);
+            fprintf(out, "    %s xmm1, xmm0\n", compare);
+      } else {
+            fprintf(out, "    %s xmm0, %s\n", compare, rhs.text);
+      }
+      if (binExpr.type != BinEq) {
+            fprintf(out, "    j%s %s\n", onTrue ? "a" : "be", target.text);
+      } else if (onTrue) {
+            size_t number = branchNumber++;
+            fprintf(out, "    jp .unordered%ld\n"
+                   "    je %s\n"
+                   ".unordered%ld:\n", number, target.text, number);
+      } else {
+            fprintf(out, "    jne %s\n"
+                   "    jp %s\n", target.text, target.text);
+      }
+}
+
+void generateBranch(NodeExpression *expr, bool onTrue, Label target) {
+      if (expr->type == BinaryExpr && isComparison(*expr->value.binExpr)) {
+            NodeBinaryExpression binExpr = *expr->value.binExpr;
+            NodeType type = operandType(binExpr);
+            if (isTelo(type)) {
+                  generateTeloBranch(binExpr, type, onTrue, target);
+                  return;
+            }
+            bool isUnsigned = expressionUnsigned(binExpr.lhs) || expressionUnsigned(binExpr.rhs);
+            Operand rhs = generateOperands(binExpr);
+            generateCompare("r8", rhs.text);
+            fprintf(out, "    j%s %s\n", conditionCode(binExpr, isUnsigned, !onTrue), target.text);
+            return;
+      }
+      if (expr->type == TermExpr && expr->value.term.type == NanpaExpr) {
+            if ((expr->value.term.value.nanpa.value != 0) == onTrue) fprintf(out, "    jmp %s\n", target.text);
+            return;
+      }
+      NodeType type = expressionType(expr);
+      if (isTelo(type)) {
+            // NaN counts as true, like any other value that isn't zero
+            generateTeloInto(*expr, type);
+            fprintf(out, "    xorps xmm1, xmm1\n"
+                   "    ucomi%s xmm0, xmm1\n", teloSuffix(type));
+            if (onTrue) {
+                  fprintf(out, "    jne %s\n"
+                         "    jp %s\n", target.text, target.text);
+            } else {
+                  size_t number = branchNumber++;
+                  fprintf(out, "    jp .unordered%ld\n"
+                         "    je %s\n"
+                         ".unordered%ld:\n", number, target.text, number);
+            }
+            return;
+      }
+      generateCondition(expr);
+      fprintf(out, "    j%s %s\n", onTrue ? "ne" : "e", target.text);
+}
+
+size_t unrollFactor = 0;
+
+// Counts the kama to name used as values inside expr
+size_t expressionWrites(NodeExpression *expr, char *name) {
+      if (expr->type == BinaryExpr) {
+            return expressionWrites(expr->value.binExpr->lhs, name) + expressionWrites(expr->value.binExpr->rhs, name);
+      }
+      NodeTerm term = expr->value.term;
+      if (term.type == IndexExpr) return expressionWrites(term.value.index.index, name);
+      size_t writes = 0;
+      if (term.type == KamaExpr) {
+            writes += !term.value.kama.index && !strcmp(term.value.kama.nimi.value, name);
+            writes += expressionWrites(term.value.kama.expr, name);
+            if (term.value.kama.index) writes += expressionWrites(term.value.kama.index, name);
+      }
+      if (term.type == CallExpr) {
+            for (size_t i = 0; i < term.value.call.argc; i++) writes += expressionWrites(term.value.call.args[i], name);
+      }
+      return writes;
+}
+
+size_t countWrites(Nodes *nodes, char *name);
+
+size_t nodeWrites(Node node, char *name) {
+      if (node.type == Expression) return expressionWrites(node.node.expr, name);
+      if (node.type == Otawa) return expressionWrites(node.node.otawa->expr, name);
+      if (node.type == O) {
+            return expressionWrites(node.node.o->expr, name)
+                  + (node.node.o->type.length ? expressionWrites(node.node.o->type.length, name) : 0);
+      }
+      if (node.type == Kama) {
+            NodeKamaExpression *kama = node.node.kama.kama;
+            return (!kama->index && !strcmp(kama->nimi.value, name)) + expressionWrites(kama->expr, name)
+                  + (kama->index ? expressionWrites(kama->index, name) : 0);
+      }
+      if (node.type == Tenpo) return expressionWrites(node.node.tenpo->expr, name) + countWrites(&node.node.tenpo->nodes, name);
+      if (node.type == La) {
+            return expressionWrites(node.node.la->expr, name) + countWrites(&node.node.la->nodes, name)
+                  + countWrites(&node.node.la->ante, name);
+      }
+      return 0;
+}
+
+// Counts the kama to name in nodes. Bodies with an o or asen are reported as
+// writing it, since they can't be copied or reasoned about.
+size_t countWrites(Nodes *nodes, char *name) {
+      size_t writes = 0;
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == O || node.type == Asen) return SIZE_MAX / 2;
+            writes += nodeWrites(node, name);
+      }
+      return writes;
+}
+
+// The induction variable of a counted loop: tenpo i la or tenpo i > 0 la,
+// with a single i = i - 1 directly in the body and no other write to i.
+char *countedLoopVar(NodeTenpo *tenpo) {
+      NodeExpression *cond = tenpo->expr;
+      if (cond->type == BinaryExpr && cond->value.binExpr->type == BinGt
+          && isNanpa(cond->value.binExpr->rhs, 0)) {
+            cond = cond->value.binExpr->lhs;
+      }
+      if (cond->type != TermExpr || cond->value.term.type != NimiExpr) return NULL;
+      char *name = cond->value.term.value.nimi.value;
+
+      if (countWrites(&tenpo->nodes, name) != 1) return NULL;
+      for (size_t i = 0; i < tenpo->nodes.size; i++) {
+            Node node = getNode(&tenpo->nodes, i);
+            if (node.type != Kama || node.node.kama.kama->index || strcmp(node.node.kama.kama->nimi.value, name)) continue;
+            NodeExpression *expr = node.node.kama.kama->expr;
+            if (expr->type == BinaryExpr && expr->value.binExpr->type == BinSub
+                && isNimi(expr->value.binExpr->lhs, name) && isNanpa(expr->value.binExpr->rhs, 1)) {
+                  return name;
+            }
+      }
+      return NULL;
+}
+
+// The unroll factor for a loop, 1 when it is left alone. Bodies are only
+// copied while they stay small, and a profile that shows fewer than two
+// unrolled trips per entry turns unrolling off for that loop.
+size_t loopUnroll(NodeTenpo *tenpo) {
+      size_t factor = unrollFactor ? unrollFactor : (optLevel >= 2 ? 4 : 1);
+      char *var = countedLoopVar(tenpo);
+      if (factor < 2 || !var || isTelo(getNameMapType(&vars, var))) return 1;
+      size_t cost = costNodes(&tenpo->nodes);
+      while (factor > 1 && cost * factor > 256) factor /= 2;
+      if (tenpo->profiled && tenpo->iterations < 2 * factor * tenpo->entries) return 1;
+      return factor;
+}
+
+// Loops the profile shows running at least two iterations per entry get the
+// test at the bottom, which saves the unconditional jmp on every iteration.
+bool rotateLoop(NodeTenpo tenpo) {
+      return tenpo.profiled && tenpo.iterations >= 2*tenpo.entries && tenpo.iterations > 0;
+}
+
+size_t loopAlignment = 0;
+
+bool nodesLoop(Nodes *nodes) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Tenpo) return true;
+            if (node.type == La && (nodesLoop(&node.node.la->nodes) || nodesLoop(&node.node.la->ante))) return true;
+      }
+      return false;
+}
+
+// Innermost loops get their header aligned, so the front end fetches the
+// body in as few blocks as it can. Padding is multi-byte nops from nasm's
+// smartalign, and is either jumped over or run once on entry.
+size_t headerAlignment() {
+      return loopAlignment ? loopAlignment : (optLevel >= 2 ? 16 : 1);
+}
+
+size_t loopAlign(NodeTenpo *tenpo) {
+      size_t align = headerAlignment();
+      if (align < 2 || nodesLoop(&tenpo->nodes)) return 1;
+      return align;
+}
+
+// The body being generated and the statement in it, so a tenpo can look
+// back at how its counter was set. Bodies of la go on to the .laout label
+// numbered bodyExit when they end, everything else has it at -1.
+_Thread_local Nodes *body = NULL;
+_Thread_local size_t bodyIndex = 0;
+_Thread_local int64_t bodyExit = -1;
+
+// With -g every statement is preceded by a %line directive, so nasm's DWARF
+// line table points into the .ln source. Node lines are relative to their
+// body, which starts bodyLine or anteLine lines below the statement it
+// belongs to, or below the pali for an inlined body.
+_Thread_local Node *lineNode = NULL;
+_Thread_local int32_t lineNumber = 1;
+
+void generateLine(int32_t line) {
+      fprintf(out, "%%line %d+0 %s\n", line, sourceName);
+}
+
+int32_t bodyLine(Nodes *nodes) {
+      if (lineNode && lineNode->type == Tenpo && nodes->nodes == lineNode->node.tenpo->nodes.nodes) {
+            return lineNumber + lineNode->node.tenpo->bodyLine;
+      }
+      if (lineNode && lineNode->type == La && nodes->nodes == lineNode->node.la->nodes.nodes) {
+            return lineNumber + lineNode->node.la->bodyLine;
+      }
+      if (lineNode && lineNode->type == La && nodes->nodes == lineNode->node.la->ante.nodes) {
+            return lineNumber + lineNode->node.la->anteLine;
+      }
+      for (size_t i = 0; i < palis.size; i++) {
+            if (nodes->nodes == palis.palis[i]->nodes.nodes) return palis.palis[i]->line + palis.palis[i]->bodyLine;
+      }
+      return 1;
+}
+
+void generateBodyTo(Nodes *nodes, int64_t exit) {
+      Nodes *oldBody = body;
+      size_t oldIndex = bodyIndex;
+      int64_t oldExit = bodyExit;
+      Node *oldLineNode = lineNode;
+      int32_t oldLineNumber = lineNumber;
+      int32_t base = debugInfo ? bodyLine(nodes) : 0;
+      body = nodes;
+      bodyExit = exit;
+      for (bodyIndex = 0; bodyIndex < nodes->size; bodyIndex++) {
+            Node node = getNode(nodes, bodyIndex);
+            if (debugInfo && node.type != Pali) {
+                  lineNode = &node;
+                  lineNumber = base + node.line;
+                  generateLine(lineNumber);
+            }
+            generateStatement(&node);
+      }
+      body = oldBody;
+      bodyIndex = oldIndex;
+      bodyExit = oldExit;
+      lineNode = oldLineNode;
+      lineNumber = oldLineNumber;
+      // What follows the body belongs to the statement it is in
+      if (debugInfo && lineNode) generateLine(lineNumber);
+}
+
+void generateBody(Nodes *nodes) {
+      generateBodyTo(nodes, -1);
+}
+
+// Finds the value var enters the current tenpo with: the last o or kama of
+// it earlier in the same body, when that is a number that isn't negative or
+// the length of an array.
+bool loopEntry(char *var, LoopRange *range) {
+      for (size_t i = bodyIndex; body && i > 0; i--) {
+            Node node = getNode(body, i-1);
+            NodeExpression *expr = NULL;
+            if (node.type == O && !strcmp(node.node.o->name.value, var)) expr = node.node.o->expr;
+            else if (node.type == Kama && !node.node.kama.kama->index
+                     && !strcmp(node.node.kama.kama->nimi.value, var)) expr = node.node.kama.kama->expr;
+            else if (node.type == Asen || nodeWrites(node, var)) return false;
+            else continue;
+
+            expr = foldExpression(expr);
+            if (expr->type == TermExpr && expr->value.term.type == NanpaExpr) {
+                  range->entry = expr->value.term.value.nanpa.value;
+                  return range->entry >= 0;
+            }
+            if (!isCallTo(expr, "suli") || expr->value.term.value.call.argc != 1) return false;
+            NodeExpression *arg = expr->value.term.value.call.args[0];
+            if (arg->type != TermExpr || arg->value.term.type != NimiExpr) return false;
+            char *array = arg->value.term.value.nimi.value;
+            if (!hasNameMap(&vars, array) || !isArray(getNameMapType(&vars, array))) return false;
+            NodeType type = getNameMapType(&vars, array);
+            if (inFrame(type)) range->entry = type.count;
+            else range->array = array;
+            return true;
+      }
+      return false;
+}
+
+// The counter of a loop, with what is known about its range, goes on
+// loopRanges while the body is generated
+bool loopRange(NodeTenpo *tenpo, LoopRange *range) {
+      char *var = countedLoopVar(tenpo);
+      if (!var || loopRangeCount == LOOP_RANGE_MAX) return false;
+      NodeType type = getNameMapType(&vars, var);
+      *range = (LoopRange){.var = var};
+      if (isTelo(type) || !loopEntry(var, range)) return false;
+      size_t size = typeSize(type);
+      return size == 8 || (!range->array && range->entry < (1LL << (size*8 - 1)));
+}
+
+// Element-wise array loops are vectorized at -O2: a counted loop whose body
+// is i = i - 1 and then only stores a[i] = e, where e combines the [i]
+// elements of arrays of one element type with + - * / and values the loop
+// doesn't change. Two arrays are either the same memory or don't overlap,
+// and each element is only read and written at its own index, so doing one
+// store for a whole vector before the next is the same as going element by
+// element. -march picks sse2, which every x86-64 cpu has, or avx2 with
+// vectors twice as wide.
+enum {MarchSse2, MarchAvx2} march = MarchSse2;
+bool vectorize = true;
+
+#define VECTOR_REGISTERS 16
+#define VECTOR_INVARIANTS 8
+#define VECTOR_STORES 16
+#define VECTOR_ARRAYS 16
+
+// The stores of a vectorized loop and the values it broadcasts, which get
+// the registers from xmm15 down. Values are computed from xmm0 up.
+typedef struct {
+      char *var;
+      NodeExpression *index;
+      NodeType element;
+      size_t width;
+      size_t storeCount;
+      char *stores[VECTOR_STORES];
+      NodeExpression *values[VECTOR_STORES];
+      size_t invariantCount;
+      NodeExpression *invariants[VECTOR_INVARIANTS];
+      size_t arrayCount;
+      char *arrays[VECTOR_ARRAYS];
+} VectorLoop;
+
+// The instruction for op on vectors of element, NULL when there is none.
+// Bytes and qwords can't be multiplied, and pmulld needs more than sse2.
+char *vectorOp(BinaryExpressionType op, NodeType element) {
+      if (isTelo(element)) {
+            bool single = element.type == TeloLili;
+            if (op == BinAdd) return single ? "addps" : "addpd";
+            if (op == BinSub) return single ? "subps" : "subpd";
+            if (op == BinMul) return single ? "mulps" : "mulpd";
+            if (op == BinDiv) return single ? "divps" : "divpd";
+            return NULL;
+      }
+      static char *adds[] = {"paddb", "paddw", "paddd", "paddq"};
+      static char *subs[] = {"psubb", "psubw", "psubd", "psubq"};
+      static char *muls[] = {NULL, "pmullw", NULL, NULL};
+      size_t size = typeSize(element);
+      int index = size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3;
+      if (op == BinAdd) return adds[index];
+      if (op == BinSub) return subs[index];
+      if (op == BinMul) return size == 4 && march == MarchAvx2 ? "pmulld" : muls[index];
+      return NULL;
+}
+
+char *vectorMove(NodeType element) {
+      return !isTelo(element) ? "movdqu" : element.type == TeloLili ? "movups" : "movupd";
+}
+
+// nanpa elements only have to be the same size, since adding, subtracting
+// and multiplying give the same low bits either way
+bool vectorElement(NodeType want, NodeType type) {
+      if (type.type == Pule || type.type == Linja) return false;
+      if (isTelo(want) || isTelo(type)) return want.type == type.type;
+      return typeSize(want) == typeSize(type);
+}
+
+// Adds array to the ones the loop reads or writes
+bool vectorArray(VectorLoop *loop, char *array) {
+      for (size_t i = 0; i < loop->arrayCount; i++) {
+            if (!strcmp(loop->arrays[i], array)) return true;
+      }
+      if (loop->arrayCount == VECTOR_ARRAYS) return false;
+      loop->arrays[loop->arrayCount++] = array;
+      return true;
+}
+
+// The register of a value that is broadcast, -1 for anything else
+int vectorInvariant(VectorLoop *loop, NodeExpression *expr) {
+      for (size_t i = 0; i < loop->invariantCount; i++) {
+            if (loop->invariants[i] == expr) return VECTOR_REGISTERS - 1 - i;
+      }
+      return -1;
+}
+
+// Checks that expr can be computed on vectors, and counts the registers it
+// needs on top of the broadcast ones
+bool vectorValue(VectorLoop *loop, NodeExpression *expr, size_t *registers) {
+      if (expr->type == BinaryExpr) {
+            NodeBinaryExpression *binExpr = expr->value.binExpr;
+            if (!vectorOp(binExpr->type, loop->element)) return false;
+            // telo is computed in the type of the wider side, which has to
+            // be the element type all the way through
+            if (isTelo(loop->element) && operandType(*binExpr).type != loop->element.type) return false;
+            size_t lhs, rhs;
+            if (!vectorValue(loop, binExpr->lhs, &lhs) || !vectorValue(loop, binExpr->rhs, &rhs)) return false;
+            if (vectorInvariant(loop, binExpr->rhs) >= 0) rhs = 0;
+            *registers = lhs > rhs + 1 ? lhs : rhs + 1;
+            return true;
+      }
+      NodeTerm term = expr->value.term;
+      *registers = 1;
+      if (term.type == IndexExpr) {
+            char *array = term.value.index.nimi.value;
+            return isNimi(term.value.index.index, loop->var) && hasNameMap(&vars, array)
+                  && isArray(getNameMapType(&vars, array))
+                  && vectorElement(loop->element, elementType(getNameMapType(&vars, array)))
+                  && vectorArray(loop, array);
+      }
+      if (term.type == TeloExpr && !isTelo(loop->element)) return false;
+      if (term.type == NimiExpr) {
+            char *name = term.value.nimi.value;
+            if (!strcmp(name, loop->var) || !hasNameMap(&vars, name)) return false;
+            NodeType type = getNameMapType(&vars, name);
+            if (isPair(type) || (isTelo(type) && !isTelo(loop->element))) return false;
+      } else if (term.type != NanpaExpr && term.type != TeloExpr) {
+            return false;
+      }
+      if (loop->invariantCount == VECTOR_INVARIANTS) return false;
+      loop->invariants[loop->invariantCount++] = expr;
+      return true;
+}
+
+bool vectorLoop(NodeTenpo *tenpo, VectorLoop *loop) {
+      char *var = countedLoopVar(tenpo);
+      if (optLevel < 2 || !vectorize || instrumentPath || !var || tenpo->nodes.size < 2) return false;
+      NodeType type = getNameMapType(&vars, var);
+      if (isTelo(type) || typeSize(type) != 8 || tenpo->nodes.size - 1 > VECTOR_STORES) return false;
+      *loop = (VectorLoop){.var = var};
+
+      Node first = getNode(&tenpo->nodes, 0);
+      if (first.type != Kama || first.node.kama.kama->index || strcmp(first.node.kama.kama->nimi.value, var)) return false;
+      size_t registers = 0;
+      for (size_t i = 1; i < tenpo->nodes.size; i++) {
+            Node node = getNode(&tenpo->nodes, i);
+            if (node.type != Kama || !node.node.kama.kama->index) return false;
+            NodeKamaExpression *kama = node.node.kama.kama;
+            char *array = kama->nimi.value;
+            if (!isNimi(kama->index, var) || !hasNameMap(&vars, array)) return false;
+            NodeType type = getNameMapType(&vars, array);
+            if (!isArray(type) || type.awen) return false;
+            if (i == 1) loop->element = elementType(type);
+            if (!vectorElement(loop->element, elementType(type)) || !vectorArray(loop, array)) return false;
+            size_t needed;
+            NodeExpression *value = foldExpression(kama->expr);
+            if (!vectorValue(loop, value, &needed)) return false;
+            if (needed > registers) registers = needed;
+            loop->index = kama->index;
+            loop->stores[loop->storeCount] = array;
+            loop->values[loop->storeCount++] = value;
+      }
+      if (registers + loop->invariantCount > VECTOR_REGISTERS) return false;
+      loop->width = (march == MarchAvx2 ? 32 : 16) / typeSize(loop->element);
+      return !tenpo->profiled || tenpo->iterations >= 2 * loop->width * tenpo->entries;
+}
+
+// Elements [rcx, rcx + width) of array
+Operand vectorElements(char *array) {
+      NodeType type = getNameMapType(&vars, array);
+      size_t size = typeSize(elementType(type));
+      Operand op = {.lon = true, .memory = true};
+      if (inFrame(type)) {
+            snprintf(op.text, sizeof(op.text), "[rbp+rcx*%zu%+ld]", size, lookupVar(array));
+      } else {
+            fprintf(out, "    mov r11, qword [rbp%+ld]\n", lookupVar(array));
+            snprintf(op.text, sizeof(op.text), "[r11+rcx*%zu]", size);
+      }
+      return op;
+}
+
+// Fills register reg with copies of a value the loop doesn't change
+void generateBroadcast(VectorLoop *loop, NodeExpression *expr, int reg) {
+      NodeType element = loop->element;
+      bool single = element.type == TeloLili;
+      if (isTelo(element)) {
+            generateTeloInto(*expr, element);
+            if (march == MarchAvx2) {
+                  fprintf(out, "    vbroadcasts%c ymm%d, xmm0\n", single ? 's' : 'd', reg);
+            } else {
+                  fprintf(out, "    movaps xmm%d, xmm0\n", reg);
+                  if (single) fprintf(out, "    shufps xmm%d, xmm%d, 0\n", reg, reg);
+                  else fprintf(out, "    unpcklpd xmm%d, xmm%d\n", reg, reg);
+            }
+            return;
+      }
+      size_t size = typeSize(element);
+      generateExpressionInto(*expr, "r8");
+      fprintf(out, "    %smov%s xmm%d, %s\n", march == MarchAvx2 ? "v" : "", size == 8 ? "q" : "d", reg,
+              size == 8 ? "r8" : "r8d");
+      if (march == MarchAvx2) {
+            fprintf(out, "    vpbroadcast%c ymm%d, xmm%d\n", size == 1 ? 'b' : size == 2 ? 'w' : size == 4 ? 'd' : 'q', reg, reg);
+            return;
+      }
+      if (size == 1) fprintf(out, "    punpcklbw xmm%d, xmm%d\n", reg, reg);
+      if (size <= 2) fprintf(out, "    pshuflw xmm%d, xmm%d, 0\n", reg, reg);
+      if (size == 4) fprintf(out, "    pshufd xmm%d, xmm%d, 0\n", reg, reg);
+      else fprintf(out, "    punpcklqdq xmm%d, xmm%d\n", reg, reg);
+}
+
+// Computes expr for elements [rcx, rcx + width) into register reg, with
+// the three operand forms of avx2
+void generateVectorInto(VectorLoop *loop, NodeExpression *expr, int reg) {
+      char *prefix = march == MarchAvx2 ? "v" : "";
+      char vector = march == MarchAvx2 ? 'y' : 'x';
+      if (expr->type == TermExpr) {
+            int invariant = vectorInvariant(loop, expr);
+            if (invariant >= 0) {
+                  fprintf(out, "    %s%s %cmm%d, %cmm%d\n", prefix, vectorMove(loop->element), vector, reg, vector, invariant);
+            } else {
+                  Operand elements = vectorElements(expr->value.term.value.index.nimi.value);
+                  fprintf(out, "    %s%s %cmm%d, %s\n", prefix, vectorMove(loop->element), vector, reg, elements.text);
+            }
+            return;
+      }
+      NodeBinaryExpression *binExpr = expr->value.binExpr;
+      generateVectorInto(loop, binExpr->lhs, reg);
+      int rhs = vectorInvariant(loop, binExpr->rhs);
+      if (rhs < 0) generateVectorInto(loop, binExpr->rhs, rhs = reg + 1);
+      char *op = vectorOp(binExpr->type, loop->element);
+      if (march == MarchAvx2) fprintf(out, "    v%s ymm%d, ymm%d, ymm%d\n", op, reg, reg, rhs);
+      else fprintf(out, "    %s xmm%d, xmm%d\n", op, reg, rhs);
+}
+
+// Runs vectors of elements [i - width, i) while i is at least width, then
+// goes on to the scalar loop. The highest element of a vector is the one
+// the first of its scalar iterations would use, so that is the one checked
+// against the length of each array the range doesn't cover.
+void generateVectorLoop(VectorLoop *loop, LoopRange *range, size_t number, size_t align) {
+      for (size_t i = 0; i < loop->invariantCount; i++) {
+            generateBroadcast(loop, loop->invariants[i], VECTOR_REGISTERS - 1 - i);
+      }
+      Operand counter = varOperand(lookupVar(loop->var), nanpaType);
+      if (align > 1) fprintf(out, "    align %ld\n", align);
+      fprintf(out, ".vector%ld:\n"
+             "    cmp %s, %zu\n"
+             "    jl .vectorout%ld\n"
+             "    mov rcx, %s\n"
+             "    sub rcx, %zu\n"
+             "    mov %s, rcx\n",
+             number, counter.text, loop->width, number, counter.text, loop->width, counter.text);
+
+      range->decremented = true;
+      bool highest = false;
+      for (size_t i = 0; i < loop->arrayCount && boundsChecks != BoundsNone; i++) {
+            char *array = loop->arrays[i];
+            NodeType type = getNameMapType(&vars, array);
+            if (indexInRange(loop->index, array, type)) continue;
+            if (!highest) fprintf(out, "    lea rdx, [rcx+%zu]\n", loop->width - 1);
+            highest = true;
+            if (inFrame(type)) fprintf(out, "    cmp rdx, %ld\n", type.count);
+            else fprintf(out, "    cmp rdx, qword [rbp%+ld]\n", lookupVar(array) + 8);
+            fprintf(out, "    jae lpc_out_of_range\n");
+      }
+
+      char *prefix = march == MarchAvx2 ? "v" : "";
+      for (size_t i = 0; i < loop->storeCount; i++) {
+            generateVectorInto(loop, loop->values[i], 0);
+            Operand elements = vectorElements(loop->stores[i]);
+            fprintf(out, "    %s%s %s, %cmm0\n", prefix, vectorMove(loop->element), elements.text, march == MarchAvx2 ? 'y' : 'x');
+      }
+      fprintf(out, "    jmp .vector%ld\n"
+             ".vectorout%ld:\n",
+             number, number);
+      if (march == MarchAvx2) fprintf(out, "    vzeroupper\n");
+}
+
+void generateTenpo(NodeTenpo tenpo) {
+      size_t oldLoop = loopNumber++;
+      if (instrumentPath) {
+            fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", tenpo.id*16);
+      }
+      // A loop whose condition folded to 0 never runs
+      if (isNanpa(tenpo.expr, 0)) return;
+      LoopRange range;
+      bool ranged = loopRange(&tenpo, &range);
+      if (ranged) loopRanges[loopRangeCount++] = range;
+      LoopRange *current = ranged ? &loopRanges[loopRangeCount-1] : &range;
+
+      // Counted loops run factor copies of the body per test while the counter
+      // is at least factor, then finish in the loop below.
+      // The rest of a rotated loop starts at its test, not its body.
+      // Vectorized loops leave fewer iterations than a vector to it, so
+      // those aren't unrolled.
+      size_t factor = loopUnroll(&tenpo);
+      size_t align = loopAlign(&tenpo);
+      bool rotated = rotateLoop(tenpo);
+      VectorLoop vector;
+      if (vectorLoop(&tenpo, &vector)) {
+            generateVectorLoop(&vector, current, oldLoop, align);
+            factor = 1;
+            align = 1;
+      }
+      if (factor > 1) {
+            if (align > 1) fprintf(out, "    align %ld\n", align);
+            fprintf(out, ".unroll%ld:\n"
+                   "    cmp %s, %ld\n"
+                   "    jl %s%ld\n",
+                   oldLoop, varOperand(lookupVar(countedLoopVar(&tenpo)), getNameMapType(&vars, countedLoopVar(&tenpo))).text, factor,
+                   rotated ? ".looptest" : ".loopin", oldLoop);
+            for (size_t u = 0; u < factor; u++) {
+                  if (instrumentPath) {
+                        fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", tenpo.id*16 + 8);
+                  }
+                  current->decremented = false;
+                  generateBody(&tenpo.nodes);
+            }
+            fprintf(out, "    jmp .unroll%ld\n", oldLoop);
+      }
+
+      // The unrolled copies are the hot part of an unrolled loop
+      if (factor > 1) align = 1;
+      if (rotated) {
+            if (factor == 1) fprintf(out, "    jmp .looptest%ld\n", oldLoop);
+            if (align > 1) fprintf(out, "    align %ld\n", align);
+            fprintf(out, ".loopin%ld:\n", oldLoop);
+      } else {
+            if (align > 1) fprintf(out, "    align %ld\n", align);
+            fprintf(out, ".loopin%ld:\n", oldLoop);
+            generateBranch(tenpo.expr, false, label(".loopout", oldLoop));
+      }
+
+      if (instrumentPath) {
+            fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", tenpo.id*16 + 8);
+      }
+      current->decremented = false;
+      generateBody(&tenpo.nodes);
+      if (ranged) loopRangeCount--;
+
+      if (rotated) {
+            fprintf(out, ".looptest%ld:\n", oldLoop);
+            generateBranch(tenpo.expr, true, label(".loopin", oldLoop));
+            fprintf(out, ".loopout%ld:\n", oldLoop);
+      } else {
+            fprintf(out, "    jmp .loopin%ld\n"
+                   ".loopout%ld:\n",
+                   oldLoop, oldLoop);
+      }
+}
+
+// Code moved out of line is written to its own stream while it is generated
+// and emitted behind the function it belongs to, so the hot path runs
+// straight through without taken jumps.
+typedef struct {
+      FILE *file;
+      char *bytes;
+      size_t length;
+} ColdBlock;
+
+_Thread_local ColdBlock **coldBlocks = NULL;
+_Thread_local size_t coldBlockCount = 0;
+
+// Starts writing out of line code, returns the stream to go back to
+FILE *startCold() {
+      coldBlocks = realloc(coldBlocks, sizeof(ColdBlock*)*(coldBlockCount + 1));
+      ColdBlock *block = calloc(1, sizeof(ColdBlock));
+      coldBlocks[coldBlockCount++] = block;
+      FILE *hot = out;
+      block->file = out = open_memstream(&block->bytes, &block->length);
+      return hot;
+}
+
+void endCold(FILE *hot) {
+      for (size_t i = coldBlockCount; i > 0; i--) {
+            if (coldBlocks[i-1]->file != out) continue;
+            fclose(out);
+            coldBlocks[i-1]->file = NULL;
+            break;
+      }
+      out = hot;
+}
+
+// Emits the blocks when emit is set and forgets them. A failed generate
+// can leave some of them open.
+void clearColdBlocks(bool emit) {
+      for (size_t i = 0; i < coldBlockCount; i++) {
+            if (coldBlocks[i]->file) fclose(coldBlocks[i]->file);
+            else if (emit) fwrite(coldBlocks[i]->bytes, 1, coldBlocks[i]->length, out);
+            free(coldBlocks[i]->bytes);
+            free(coldBlocks[i]);
+      }
+      coldBlockCount = 0;
+}
+
+bool endsInOtawa(Nodes *nodes) {
+      return nodes->size && getNode(nodes, nodes->size - 1).type == Otawa;
+}
+
+// A branch is cold when the profile shows it taken at most once in 16
+// times, or without a profile when it reports with pakala or ends the
+// program.
+bool coldBranch(NodeLa *la, Nodes *nodes, bool isLa) {
+      if (optLevel < 1 || !nodes->size) return false;
+      if (la->profiled) {
+            uint64_t taken = isLa ? la->taken : la->entries - la->taken;
+            return la->entries > 0 && taken * 16 <= la->entries;
+      }
+      return nodesCall(nodes, "pakala") || (!frame.pali && endsInOtawa(nodes));
+}
+
+// Values cmov can pick from: numbers, nanpa variables and arithmetic on
+// them that can't fault
+bool cheapExpression(NodeExpression *expr) {
+      if (expr->type == BinaryExpr) {
+            NodeBinaryExpression *binExpr = expr->value.binExpr;
+            return (binExpr->type == BinAdd || binExpr->type == BinSub || binExpr->type == BinMul)
+                  && cheapExpression(binExpr->lhs) && cheapExpression(binExpr->rhs);
+      }
+      return expr->value.term.type == NanpaExpr || isNanpaVar(expr);
+}
+
+bool cheapCondition(NodeExpression *expr) {
+      if (expr->type == BinaryExpr && isComparison(*expr->value.binExpr)) {
+            return cheapExpression(expr->value.binExpr->lhs) && cheapExpression(expr->value.binExpr->rhs);
+      }
+      return cheapExpression(expr);
+}
+
+NodeKamaExpression *onlyKama(Nodes *nodes) {
+      if (nodes->size != 1 || getNode(nodes, 0).type != Kama) return NULL;
+      NodeKamaExpression *kama = getNode(nodes, 0).node.kama.kama;
+      return kama->index ? NULL : kama;
+}
+
+// c la x = a; ante x = b; pini and the same without the ante are done
+// without a branch when everything in them is cheap: both values are
+// computed and cmov keeps one. Conditionals the profile shows going the
+// same way nearly always are left to the branch predictor.
+bool generateSelect(NodeLa *la) {
+      if (optLevel < 1 || instrumentPath || la->ante.size > 1) return false;
+      if (la->profiled && la->entries > 0 && (la->taken * 16 <= la->entries
+                                             || (la->entries - la->taken) * 16 <= la->entries)) return false;
+      NodeKamaExpression *then = onlyKama(&la->nodes);
+      NodeKamaExpression *otherwise = la->ante.size ? onlyKama(&la->ante) : NULL;
+      if (!then || (la->ante.size && (!otherwise || strcmp(otherwise->nimi.value, then->nimi.value)))) return false;
+      NodeExpression var = {.lon = true, .type = TermExpr, .value.term = {.lon = true, .type = NimiExpr, .value.nimi = then->nimi}};
+      if (!isNanpaVar(&var) || getNameMapType(&vars, then->nimi.value).awen) return false;
+      if (!cheapExpression(then->expr) || (otherwise && !cheapExpression(otherwise->expr))
+          || !cheapCondition(la->expr)) return false;
+
+      int64_t slot = lookupVar(then->nimi.value);
+      NodeType type = getNameMapType(&vars, then->nimi.value);
+      generateExpressionInto(*foldExpression(then->expr), "r10");
+      generateExpressionInto(otherwise ? *foldExpression(otherwise->expr) : var, "r11");
+      NodeExpression *cond = la->expr;
+      char *code = "ne";
+      if (cond->type == BinaryExpr && isComparison(*cond->value.binExpr)) {
+            NodeBinaryExpression binExpr = *cond->value.binExpr;
+            bool isUnsigned = expressionUnsigned(binExpr.lhs) || expressionUnsigned(binExpr.rhs);
+            Operand rhs = generateOperands(binExpr);
+            generateCompare("r8", rhs.text);
+            code = conditionCode(binExpr, isUnsigned, false);
+      } else {
+            generateExpressionInto(*cond, "r8");
+            fprintf(out, "    test r8, r8\n");
+      }
+      fprintf(out, "    cmov%s r11, r10\n"
+             "    mov %s, %s\n", code, varOperand(slot, type).text, subRegister("r11", typeSize(type)));
+      return true;
+}
+
+_Thread_local size_t laNumber = 0;
+
+// Generates the la branch, falling through to the ante, or the other way
+// around when the la branch is cold. Cold branches go out of line. A la
+// that is the last statement of the body of another la jumps straight to
+// the end of that one, which threads chains of ante conditions.
+void generateLa(NodeLa *la) {
+      size_t number = laNumber++;
+      if (instrumentPath) {
+            fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", la->id*16);
+      }
+      bool last = bodyExit >= 0 && bodyIndex + 1 == body->size;
+      int64_t end = last ? bodyExit : (int64_t)number;
+
+      // A condition that folded to a number only leaves one of the bodies
+      if (la->expr->type == TermExpr && la->expr->value.term.type == NanpaExpr) {
+            bool taken = la->expr->value.term.value.nanpa.value != 0;
+            if (taken && instrumentPath) {
+                  fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", la->id*16 + 8);
+            }
+            generateBodyTo(taken ? &la->nodes : &la->ante, end);
+            if (!last) fprintf(out, ".laout%ld:\n", number);
+            return;
+      }
+      if (generateSelect(la)) return;
+
+      bool coldAnte = coldBranch(la, &la->ante, false);
+      bool coldLa = !coldAnte && coldBranch(la, &la->nodes, true);
+      Nodes *hot = coldLa ? &la->ante : &la->nodes;
+      Nodes *cold = coldLa ? &la->nodes : &la->ante;
+      bool outOfLine = coldLa || coldAnte;
+
+      // Into the branch that isn't laid out first
+      Label other = label(outOfLine ? ".lacold" : la->ante.size ? ".laante" : ".laout", outOfLine || la->ante.size ? (int64_t)number : end);
+      generateBranch(la->expr, coldLa, other);
+      if (!coldLa && instrumentPath) {
+            fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", la->id*16 + 8);
+      }
+      generateBodyTo(hot, end);
+
+      if (outOfLine) {
+            FILE *hotOut = startCold();
+            fprintf(out, ".lacold%ld:\n", number);
+            if (coldLa && instrumentPath) {
+                  fprintf(out, "    inc qword [rel lpc_counters+%ld]\n", la->id*16 + 8);
+            }
+            generateBodyTo(cold, end);
+            if (!endsInOtawa(cold)) fprintf(out, "    jmp .laout%ld\n", end);
+            endCold(hotOut);
+      } else if (la->ante.size) {
+            if (!endsInOtawa(&la->nodes)) fprintf(out, "    jmp .laout%ld\n", end);
+            fprintf(out, ".laante%ld:\n", number);
+            generateBodyTo(&la->ante, end);
+      }
+      if (!last) fprintf(out, ".laout%ld:\n", number);
+}
+
+// open, write and close the profile file; the exit status in rdi survives.
+void generateProfileDump() {
+      fprintf(out, "\nlpc_profile_dump:\n"
+             "    push rdi\n"
+             "    mov rax, 2\n"
+             "    lea rdi, [rel lpc_profile_path]\n"
+             "    mov rsi, 577\n"
+             "    mov rdx, 420\n"
+             "    syscall\n"
+             "    cmp rax, 0\n"
+             "    jl .done\n"
+             "    mov rdi, rax\n"
+             "    push rdi\n"
+             "    mov rax, 1\n"
+             "    lea rsi, [rel lpc_profile]\n"
+             "    mov rdx, %ld\n"
+             "    syscall\n"
+             "    pop rdi\n"
+             "    mov rax, 3\n"
+             "    syscall\n"
+             ".done:\n"
+             "    pop rdi\n"
+             "    ret\n",
+             16 + tenpoNumber*16);
+      fprintf(out, "\nsection .data\n"
+             "lpc_profile_path: db \"%s\", 0\n"
+             "lpc_profile: db \"%s\"\n"
+             "    dq %ld\n"
+             "lpc_counters: times %ld dq 0\n",
+             instrumentPath, PROFILE_MAGIC, tenpoNumber, tenpoNumber*2);
+}
+
+void generatePrologue() {
+      frameBytes = 0;
+      frameMax = 0;
+      stackOffset = 0;
+      fprintf(out, "    push rbp\n"
+             "    mov rbp, rsp\n"
+             "    sub rsp, .frame\n");
+}
+
+// The frame size is only known once the body is generated, so the prologue
+// refers to it through a constant defined after the body.
+void generateFrameSize() {
+      fprintf(out, ".frame equ %ld\n", (frameMax + 7) / 8 * 8);
+}
+
+// Arguments are pushed left to right and popped by the caller, the result
+// comes back in rax, and a linja result's length in rdx.
+void generatePali(NodePali *pali) {
+      vars = nameMapNew();
+      int64_t displacement = 16;
+      for (size_t i = pali->paramCount; i > 0; i--) {
+            addNameMap(&vars, pali->params[i-1], displacement, pali->paramTypes[i-1]);
+            displacement += stackEntries(pali->paramTypes[i-1]) * 8;
+      }
+      frame = (Frame){.pali = pali};
+
+      if (debugInfo) generateLine(pali->line);
+      fprintf(out, "\npali_%s:\n", pali->name);
+      generatePrologue();
+      if (tailCalls && optLevel >= 1 && nodesTailCall(&pali->nodes, pali->name)) fprintf(out, ".tailcall:\n");
+      for (size_t i = 0; debugInfo && i < pali->paramCount; i++) generateVarLocation(pali->params[i]);
+      generateBody(&pali->nodes);
+      fprintf(out, "    mov rax, 0\n");
+      if (isPair(pali->ret)) fprintf(out, "    mov rdx, 0\n");
+      fprintf(out, "    leave\n"
+             "    ret\n");
+      clearColdBlocks(true);
+      generateFrameSize();
+      frame = (Frame){};
+}
+
+bool programCalls(Prog *prog, char *name) {
+      if (nodesCall(&prog->nodes, name)) return true;
+      for (size_t i = 0; i < palis.size; i++) {
+            if (nodesCall(&palis.palis[i]->nodes, name)) return true;
+      }
+      return false;
+}
+
+// Arrays all start out as an o, so they need the runtime when one is declared
+bool nodesDeclareArray(Nodes *nodes) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == O && isArray(node.node.o->type)) return true;
+            if (node.type == Tenpo && nodesDeclareArray(&node.node.tenpo->nodes)) return true;
+            if (node.type == La && (nodesDeclareArray(&node.node.la->nodes) || nodesDeclareArray(&node.node.la->ante))) return true;
+      }
+      return false;
+}
+
+void generateStart(Prog *prog) {
+      vars = nameMapNew();
+      frame = (Frame){};
+      if (debugInfo) generateLine(1);
+      fprintf(out, "global _start\n"
              "_start:\n");
-      for (size_t i = 0; i < prog.nodes.size; i++) {
-            Node node = getNode(&prog.nodes, i);
-            generateStatement(&node);
+      generatePrologue();
+      if (usesRuntime) {
+            fprintf(out, "    mov qword [rel lpc_stdout+8], 1\n"
+                   "    mov qword [rel lpc_stderr+8], 2\n");
       }
-      printf("    mov rax, 60\n"
-             "    mov rdi, 0\n"
+      generateBody(&prog->nodes);
+      fprintf(out, "    mov rdi, 0\n");
+      if (instrumentPath) fprintf(out, "    call lpc_profile_dump\n");
+      if (usesRuntime) fprintf(out, "    call lpc_flush_all\n");
+      fprintf(out, "    mov rax, 60\n"
              "    syscall\n");
+      clearColdBlocks(true);
+      generateFrameSize();
+}
+
+// Code is generated in units: the top level and every pali. A unit only
+// uses the state of the thread it is generated on and numbers its labels
+// from 0, which is fine as they are all local to its own global label, so
+// the units can be generated on codegenThreads threads at once. Which pali
+// are called after inlining is only known once the code calling them is
+// generated, so they are all generated and only the ones the top level
+// calls, directly or through other pali, are written out. That is done in
+// a fixed order whatever thread generated them: the top level, then in
+// rounds the pali called from the round before in the order they were
+// declared.
+size_t codegenThreads = 1;
+
+typedef struct {
+      Prog *prog;
+      NodePali *pali;
+      char *text;
+      size_t textLength;
+      char *errorText;
+      size_t errorLength;
+      Linjas linjas;
+      NodePali **calls;
+      size_t callCount;
+      bool failed;
+} Unit;
+
+typedef struct {
+      Unit *units;
+      size_t count;
+      size_t next;
+} UnitQueue;
+
+typedef struct {
+      char *name;
+      size_t length;
+      size_t next;
+} JumpLabel;
+
+int compareJumpLabels(const void *a, const void *b) {
+      const JumpLabel *x = a, *y = b;
+      size_t length = x->length < y->length ? x->length : y->length;
+      int order = memcmp(x->name, y->name, length);
+      return order ? order : (x->length > y->length) - (x->length < y->length);
+}
+
+JumpLabel *findJumpLabel(JumpLabel *labels, size_t count, char *name, size_t length) {
+      JumpLabel key = {.name = name, .length = length};
+      return bsearch(&key, labels, count, sizeof(JumpLabel), compareJumpLabels);
+}
+
+// The label of a jump line, "    jcc label", or NULL
+char *jumpTarget(char *line, char *end) {
+      if (end - line < 7 || memcmp(line, "    j", 5)) return NULL;
+      char *space = memchr(line + 5, ' ', end - line - 5);
+      return space && space + 1 < end ? space + 1 : NULL;
+}
+
+// A jump to a label that is only followed by a jmp goes to where that jmp
+// goes, which the la at the end of a tenpo body leaves behind, and a jmp to
+// a label directly below it is dropped. nasm picks the short or near form
+// of every jump after that.
+void threadJumps(char **text, size_t *length) {
+      if (!*length || (*text)[*length-1] != '\n') return;
+      size_t lineCount = 0;
+      for (size_t i = 0; i < *length; i++) lineCount += (*text)[i] == '\n';
+      char **lines = malloc(sizeof(char*)*(lineCount + 1));
+      JumpLabel *labels = malloc(sizeof(JumpLabel)*(lineCount + 1));
+      size_t count = 0, labelCount = 0;
+      for (char *line = *text; line < *text + *length; line = strchr(line, '\n') + 1) lines[count++] = line;
+      lines[count] = *text + *length;
+      for (size_t i = 0; i < count; i++) {
+            size_t lineLength = lines[i+1] - lines[i] - 1;
+            if (!lineLength || lines[i][0] == ' ' || lines[i][lineLength-1] != ':') continue;
+            size_t next = i + 1;
+            while (next < count && lines[next][0] != ' ') next++;
+            labels[labelCount++] = (JumpLabel){lines[i], lineLength - 1, next};
+      }
+      qsort(labels, labelCount, sizeof(JumpLabel), compareJumpLabels);
+      // Local labels can repeat under another global one, that is left alone
+      for (size_t i = 1; i < labelCount; i++) {
+            if (!compareJumpLabels(&labels[i-1], &labels[i])) labelCount = 0;
+      }
+      if (!labelCount) {
+            free(lines);
+            free(labels);
+            return;
+      }
+
+      char *threaded;
+      size_t threadedLength;
+      FILE *stream = open_memstream(&threaded, &threadedLength);
+      for (size_t i = 0; i < count; i++) {
+            char *end = lines[i+1] - 1;
+            char *target = jumpTarget(lines[i], end);
+            if (!target) {
+                  fwrite(lines[i], 1, lines[i+1] - lines[i], stream);
+                  continue;
+            }
+            size_t targetLength = end - target;
+            JumpLabel *label;
+            for (int hops = 0; hops < 8 && (label = findJumpLabel(labels, labelCount, target, targetLength)); hops++) {
+                  if (label->next >= count) break;
+                  char *nextEnd = lines[label->next+1] - 1;
+                  char *nextTarget = jumpTarget(lines[label->next], nextEnd);
+                  if (!nextTarget || memcmp(lines[label->next], "    jmp ", 8)) break;
+                  target = nextTarget;
+                  targetLength = nextEnd - nextTarget;
+            }
+            bool fallsThrough = false;
+            if (!memcmp(lines[i], "    jmp ", 8)) {
+                  for (size_t j = i + 1; j < count && lines[j][0] != ' '; j++) {
+                        size_t lineLength = lines[j+1] - lines[j] - 1;
+                        fallsThrough |= lineLength == targetLength + 1 && !memcmp(lines[j], target, targetLength);
+                  }
+            }
+            if (fallsThrough) continue;
+            fprintf(stream, "%.*s%.*s\n", (int)(jumpTarget(lines[i], end) - lines[i]), lines[i], (int)targetLength, target);
+      }
+      fclose(stream);
+      free(*text);
+      *text = threaded;
+      *length = threadedLength;
+      free(lines);
+      free(labels);
+}
+
+void generateUnit(Unit *unit) {
+      FILE *oldOut = out, *oldErrors = errors;
+      jmp_buf *oldFailure = failure;
+      Linjas oldLinjas = linjas;
+      FILE *stream = open_memstream(&unit->text, &unit->textLength);
+      out = stream;
+      errors = open_memstream(&unit->errorText, &unit->errorLength);
+      stackOffset = 0;
+      loopNumber = 0;
+      laNumber = 0;
+      branchNumber = 0;
+      inlineNumber = 0;
+      teloNumber = 0;
+      linjas = (Linjas){};
+      unitCalls = NULL;
+      unitCallCount = unitCallCapacity = 0;
+
+      jmp_buf here;
+      failure = &here;
+      if (setjmp(here)) {
+            unit->failed = true;
+            out = stream;
+            clearColdBlocks(false);
+      } else if (unit->pali) {
+            generatePali(unit->pali);
+      } else {
+            generateStart(unit->prog);
+      }
+      clearFolds();
+      fclose(stream);
+      if (optLevel >= 1 && !unit->failed) threadJumps(&unit->text, &unit->textLength);
+      fclose(errors);
+      unit->linjas = linjas;
+      unit->calls = unitCalls;
+      unit->callCount = unitCallCount;
+      linjas = oldLinjas;
+      out = oldOut;
+      errors = oldErrors;
+      failure = oldFailure;
+}
+
+void *generateUnits(void *arg) {
+      UnitQueue *queue = arg;
+      size_t i;
+      while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+            generateUnit(&queue->units[i]);
+      }
+      return NULL;
+}
+
+void freeUnit(Unit *unit) {
+      clearLinjas(&unit->linjas);
+      free(unit->linjas.bytes);
+      free(unit->linjas.lengths);
+      free(unit->linjas.hashes);
+      free(unit->calls);
+      free(unit->text);
+      free(unit->errorText);
+}
+
+// Writes out the code, errors and linja of the units that are called, and
+// fails once they are all written when one of them failed
+void writeUnits(Unit *units) {
+      Unit **order = malloc(sizeof(Unit*)*(palis.size + 1));
+      size_t count = 0;
+      order[count++] = &units[0];
+      for (size_t from = 0; from < count;) {
+            size_t end = count;
+            for (size_t i = from; i < end; i++) {
+                  for (size_t j = 0; j < order[i]->callCount; j++) order[i]->calls[j]->called = true;
+            }
+            for (size_t i = 0; i < palis.size; i++) {
+                  if (!palis.palis[i]->called || palis.palis[i]->emitted) continue;
+                  palis.palis[i]->emitted = true;
+                  order[count++] = &units[i + 1];
+            }
+            from = end;
+      }
+
+      bool failed = false;
+      for (size_t i = 0; i < count; i++) {
+            Unit *unit = order[i];
+            fwrite(unit->errorText, 1, unit->errorLength, errors);
+            failed |= unit->failed;
+            if (unit->failed) continue;
+            fwrite(unit->text, 1, unit->textLength, out);
+            for (size_t j = 0; j < unit->linjas.size; j++) {
+                  addLinja(&linjas, unit->linjas.bytes[j], unit->linjas.lengths[j], unit->linjas.hashes[j]);
+            }
+      }
+      free(order);
+      if (failed) fail();
+}
+
+void generate(Prog prog) {
+      usesRuntime = nodesDeclareArray(&prog.nodes);
+      for (size_t i = 0; i < palis.size; i++) {
+            usesRuntime |= nodesDeclareArray(&palis.palis[i]->nodes);
+      }
+      for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+            usesRuntime |= programCalls(&prog, builtins[i]);
+      }
+
+      // Loop headers are padded with multi-byte nops instead of nop runs
+      if (headerAlignment() > 1) fprintf(out, "%%use smartalign\n"
+             "alignmode p6\n");
+
+      UnitQueue queue = {.units = calloc(palis.size + 1, sizeof(Unit)), .count = palis.size + 1};
+      queue.units[0] = (Unit){.prog = &prog};
+      for (size_t i = 0; i < palis.size; i++) queue.units[i + 1] = (Unit){.prog = &prog, .pali = palis.palis[i]};
+      size_t threads = codegenThreads < queue.count ? codegenThreads : queue.count;
+      if (threads <= 1) {
+            generateUnits(&queue);
+      } else {
+            pthread_t *workers = malloc(sizeof(pthread_t)*threads);
+            for (size_t i = 0; i < threads; i++) pthread_create(&workers[i], NULL, generateUnits, &queue);
+            for (size_t i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+            free(workers);
+      }
+
+      // The units are freed on the way out of a failed write too
+      jmp_buf here;
+      jmp_buf *oldFailure = failure;
+      failure = &here;
+      bool failed = setjmp(here);
+      if (!failed) writeUnits(queue.units);
+      failure = oldFailure;
+      for (size_t i = 0; i < queue.count; i++) freeUnit(&queue.units[i]);
+      free(queue.units);
+      if (failed) fail();
+      // The runtime is numbered on in a file of its own
+      if (debugInfo) fprintf(out, "%%line 1+1 lpc-runtime\n");
+      if (usesRuntime) generateRuntime();
+      if (instrumentPath) generateProfileDump();
+      generateLinjas();
 }
       
 char* file_to_charptr_new(char* filename) {
@@ -1268,10 +6285,11 @@ char* file_to_charptr_new(char* filename) {
                   fseek (f, 0, SEEK_END);
                   length = ftell (f);
                   fseek (f, 0, SEEK_SET);
-                  buffer = malloc (length);
+                  buffer = malloc (length + 1);
                   if (buffer)
                         {
-                              fread (buffer, 1, length, f);
+                              length = fread (buffer, 1, length, f);
+                              buffer[length] = 0;
                         }
                   fclose (f);
             }
@@ -1284,16 +6302,730 @@ char* file_to_charptr_new(char* filename) {
       }
 }
 
-int main(int argc, char **argv) {
-      vars = nameMapNew();
+// Lexes and parses buffer into prog. On errors the diagnostics are written
+// to errors and false is returned.
+bool parseSource(char *buffer, Prog *prog) {
+      cur = 0;
+      curToken = 0;
+      tenpoNumber = 0;
+      blockDepth = 0;
+      spanBase = 0;
+      spanLine = 1;
+      recovery = NULL;
+      clearDiagnostics(&diagnostics);
+      source = buffer;
+      Tokens tokens = tokenize(buffer);
+      *prog = parse(&tokens);
+      freeTokens(&tokens);
+      if (diagnostics.size) {
+            printDiagnostics();
+            fprintf(errors, "%zu error%s\n", diagnostics.size, diagnostics.size == 1 ? "" : "s");
+            return false;
+      }
+      return true;
+}
+
+// Numbers the tenpo and la of nodes in source order, the way parsing numbers
+// them. Re-parsed nodes of an edited document come out of order.
+void renumberNodes(Nodes *nodes) {
+      for (size_t i = 0; i < nodes->size; i++) {
+            Node node = getNode(nodes, i);
+            if (node.type == Pali) renumberNodes(&node.node.pali->nodes);
+            if (node.type == La) {
+                  node.node.la->id = tenpoNumber++;
+                  renumberNodes(&node.node.la->nodes);
+                  renumberNodes(&node.node.la->ante);
+            }
+            if (node.type == Tenpo) {
+                  node.node.tenpo->id = tenpoNumber++;
+                  renumberNodes(&node.node.tenpo->nodes);
+            }
+      }
+}
+
+// Runs the passes over a parsed program and generates it to out. A prog
+// can be generated any number of times, with different options.
+bool generateProgram(Prog *prog) {
+      jmp_buf here;
+      FILE *target = out;
+      failure = &here;
+      if (setjmp(here)) {
+            failure = NULL;
+            out = target;
+            return false;
+      }
+
+      tenpoNumber = 0;
+      renumberNodes(&prog->nodes);
+      prog->tenpoCount = tenpoNumber;
+      clearLinjas(&linjas);
+
+      // Clears what an earlier generate of the same prog left in the AST
+      collectPalis(prog);
+      applyProfileNodes(&prog->nodes, NULL);
+      if (profilePath) applyProfile(prog, profilePath);
+      inlinePass(prog);
+      generate(*prog);
+
+      failure = NULL;
+      return true;
+}
+
+// A document is a source file kept parsed while it is being edited. An edit
+// only re-lexes and re-parses the statements it touches: the innermost body
+// it falls into is found through the node spans, the touched statements of
+// that body are parsed again and the nodes behind them are moved. Anything
+// that doesn't parse cleanly that way falls back to parsing the whole file.
+typedef struct {
+      char *text;
+      size_t length;
+      size_t capacity;
+      Prog prog;
+      bool parsed;
+} Document;
+
+typedef struct {
+      int32_t offset;
+      int32_t deleted;
+      int32_t delta;
+      int32_t lineDelta;
+} Edit;
+
+int32_t countLines(char *text, int32_t from, int32_t to) {
+      int32_t lines = 0;
+      for (int32_t i = from; i < to; i++) lines += text[i] == '\n';
+      return lines;
+}
+
+bool documentParse(Document *doc) {
+      freeNodes(&doc->prog.nodes);
+      doc->parsed = parseSource(doc->text, &doc->prog);
+      return doc->parsed;
+}
+
+void documentSet(Document *doc, char *text, size_t length) {
+      if (length + 1 > doc->capacity) {
+            doc->capacity = length + 1;
+            doc->text = realloc(doc->text, doc->capacity);
+      }
+      memcpy(doc->text, text, length);
+      doc->text[length] = 0;
+      doc->length = length;
+}
+
+void shiftNodes(Nodes *nodes, size_t from, Edit edit) {
+      for (size_t i = from; i < nodes->size; i++) {
+            nodes->nodes[i].start += edit.delta;
+            nodes->nodes[i].end += edit.delta;
+            nodes->nodes[i].line += edit.lineDelta;
+      }
+}
+
+// The first node in nodes that ends at or behind offset
+size_t firstNodeEnding(Nodes *nodes, int32_t offset) {
+      size_t low = 0, high = nodes->size;
+      while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (nodes->nodes[mid].end < offset) low = mid + 1;
+            else high = mid;
+      }
+      return low;
+}
+
+// Re-parses the nodes of a body touched by edit. The body starts at base on
+// line baseLine, and ended at limit before the edit.
+bool reparseNodes(Document *doc, Nodes *nodes, int32_t base, int32_t baseLine, int32_t limit, size_t depth, Edit edit) {
+      int32_t offset = edit.offset - base;
+      size_t first = firstNodeEnding(nodes, offset);
+      size_t last = firstNodeEnding(nodes, offset + edit.deleted + 1);
+      while (last < nodes->size && nodes->nodes[last].start <= offset + edit.deleted) last++;
+      // Touched nodes are [first, last)
+
+      if (last == first + 1) {
+            Node *node = &nodes->nodes[first];
+            Nodes *body = NULL;
+            int32_t bodyStart = 0, bodyLine = 0;
+            if (node->type == Tenpo) {
+                  body = &node->node.tenpo->nodes;
+                  bodyStart = node->node.tenpo->bodyStart;
+                  bodyLine = node->node.tenpo->bodyLine;
+            } else if (node->type == Pali) {
+                  body = &node->node.pali->nodes;
+                  bodyStart = node->node.pali->bodyStart;
+                  bodyLine = node->node.pali->bodyLine;
+            }
+            // Inside the body means between 'la' and 'pini', not touching either
+            int32_t bodyBase = base + node->start + bodyStart;
+            int32_t bodyEnd = base + node->end - (int32_t)strlen("pini");
+            if (body && edit.offset > bodyBase && edit.offset + edit.deleted < bodyEnd
+                && reparseNodes(doc, body, bodyBase, baseLine + node->line + bodyLine, bodyEnd, depth + 1, edit)) {
+                  node->end += edit.delta;
+                  shiftNodes(nodes, first + 1, edit);
+                  return true;
+            }
+      }
+
+      // Lex from the end of the node before to the start of the node after,
+      // taking in more nodes while a token runs into the next one
+      int32_t from = base;
+      int32_t fromLine = baseLine;
+      if (first > 0) {
+            Node before = nodes->nodes[first - 1];
+            from = base + before.end;
+            fromLine = baseLine + before.line + countLines(doc->text, base + before.start, from);
+      }
+      Tokens tokens;
+      int32_t to;
+      while (true) {
+            to = (last < nodes->size ? base + nodes->nodes[last].start : limit) + edit.delta;
+            clearDiagnostics(&diagnostics);
+            tokens = tokenizeRange(doc->text, from, to, fromLine);
+            if (cur <= to) break;
+            freeTokens(&tokens);
+            if (last == nodes->size) return false;
+            last++;
+      }
+      if (diagnostics.size) {
+            freeTokens(&tokens);
+            return false;
+      }
+
+      size_t oldToken = curToken, oldDepth = blockDepth;
+      int32_t oldBase = spanBase, oldLine = spanLine;
+      curToken = 0;
+      blockDepth = depth;
+      spanBase = base;
+      spanLine = baseLine;
+      Nodes fresh = nodesNew();
+      // A 'pini' here would close the body early
+      bool closed = false;
+      while (tokenPeek(&tokens).type != -1 && !diagnostics.size) {
+            if (depth > 0 && tokenPeek(&tokens).type == TOKEN_PINI) {
+                  closed = true;
+                  break;
+            }
+            parseStatement(&tokens, &doc->prog.arena, &fresh);
+      }
+      curToken = oldToken;
+      blockDepth = oldDepth;
+      spanBase = oldBase;
+      spanLine = oldLine;
+      freeTokens(&tokens);
+      if (closed || diagnostics.size) {
+            freeNodes(&fresh);
+            return false;
+      }
+
+      size_t removed = last - first;
+      for (size_t i = first; i < last; i++) freeNode(nodes->nodes[i]);
+      size_t size = nodes->size - removed + fresh.size;
+      if (size + 1 > nodes->capacity) {
+            nodes->capacity = size + 1;
+            nodes->nodes = realloc(nodes->nodes, sizeof(Node)*nodes->capacity);
+      }
+      if (fresh.size != removed) {
+            memmove(&nodes->nodes[first + fresh.size], &nodes->nodes[last], sizeof(Node)*(nodes->size - last));
+      }
+      memcpy(&nodes->nodes[first], fresh.nodes, sizeof(Node)*fresh.size);
+      nodes->size = size;
+      shiftNodes(nodes, first + fresh.size, edit);
+      free(fresh.nodes);
+      return true;
+}
+
+// Replaces deleted bytes at offset with inserted and brings the parse up to
+// date. Returns whether the document parses without errors.
+bool documentEdit(Document *doc, int32_t offset, int32_t deleted, char *inserted, int32_t insertedLength) {
+      if (offset < 0 || deleted < 0 || offset + deleted > (int32_t)doc->length) {
+            fprintf(errors, "Edit at %d of %d bytes is outside of the document\n", offset, deleted);
+            return false;
+      }
+      Edit edit = {offset, deleted, insertedLength - deleted, 0};
+      edit.lineDelta = countLines(inserted, 0, insertedLength) - countLines(doc->text, offset, offset + deleted);
+
+      size_t length = doc->length + edit.delta;
+      if (length + 1 > doc->capacity) {
+            doc->capacity = (length + 1) * 2;
+            doc->text = realloc(doc->text, doc->capacity);
+      }
+      memmove(doc->text + offset + insertedLength, doc->text + offset + deleted, doc->length - offset - deleted + 1);
+      memcpy(doc->text + offset, inserted, insertedLength);
+      int32_t limit = doc->length;
+      doc->length = length;
+
+      if (!doc->parsed) return documentParse(doc);
+      source = doc->text;
+      if (reparseNodes(doc, &doc->prog.nodes, 0, 1, limit, 0, edit)) return true;
+      return documentParse(doc);
+}
+
+// Options that apply to a single compile, the compile server takes them per
+// request.
+typedef struct {
+      int optLevel;
+      size_t inlineThreshold;
+      bool inlineReport;
+      size_t unrollFactor;
+      char *instrumentPath;
+      char *profilePath;
+      int boundsChecks;
+      size_t loopAlignment;
+      bool debugInfo;
+      bool tailCalls;
+      int march;
+      bool vectorize;
+      size_t lexThreads;
+      size_t codegenThreads;
+      int lexWidth;
+} Options;
+
+Options saveOptions() {
+      return (Options){optLevel, inlineThreshold, inlineReport, unrollFactor, instrumentPath, profilePath, boundsChecks,
+                       loopAlignment, debugInfo, tailCalls, march, vectorize, lexThreads, codegenThreads, lexWidth};
+}
+
+void restoreOptions(Options options) {
+      optLevel = options.optLevel;
+      inlineThreshold = options.inlineThreshold;
+      inlineReport = options.inlineReport;
+      unrollFactor = options.unrollFactor;
+      instrumentPath = options.instrumentPath;
+      profilePath = options.profilePath;
+      boundsChecks = options.boundsChecks;
+      loopAlignment = options.loopAlignment;
+      debugInfo = options.debugInfo;
+      tailCalls = options.tailCalls;
+      march = options.march;
+      vectorize = options.vectorize;
+      lexThreads = options.lexThreads;
+      codegenThreads = options.codegenThreads;
+      lexWidth = options.lexWidth;
+}
+
+// Parses the option at argv[*i], moving *i past its argument. Returns false
+// for anything that isn't a compile option.
+bool parseOption(int argc, char **argv, int *i) {
+      char *arg = argv[*i];
+      bool hasValue = *i + 1 < argc;
+      if (!strncmp(arg, "-O", 2)) {
+            optLevel = atoi(arg + 2);
+      } else if (!strcmp(arg, "-g")) {
+            debugInfo = true;
+      } else if (!strcmp(arg, "--no-tail-calls")) {
+            tailCalls = false;
+      } else if (!strcmp(arg, "-march=sse2")) {
+            march = MarchSse2;
+      } else if (!strcmp(arg, "-march=avx2")) {
+            march = MarchAvx2;
+      } else if (!strcmp(arg, "-march=native")) {
+            march = MarchSse2;
+#if defined(__x86_64__)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) march = MarchAvx2;
+#endif
+      } else if (!strcmp(arg, "--no-vectorize")) {
+            vectorize = false;
+      } else if (!strcmp(arg, "--inline-threshold") && hasValue) {
+            inlineThreshold = atol(argv[++*i]);
+      } else if (!strcmp(arg, "--inline-report")) {
+            inlineReport = true;
+      } else if (!strcmp(arg, "--unroll") && hasValue) {
+            unrollFactor = atol(argv[++*i]);
+      } else if (!strcmp(arg, "--align-loops") && hasValue) {
+            loopAlignment = atol(argv[++*i]);
+            if (loopAlignment & (loopAlignment - 1)) return false;
+      } else if (!strcmp(arg, "--instrument") && hasValue) {
+            instrumentPath = argv[++*i];
+      } else if (!strcmp(arg, "--profile-use") && hasValue) {
+            profilePath = argv[++*i];
+      } else if (!strcmp(arg, "--bounds-checks") && hasValue) {
+            char *mode = argv[++*i];
+            if (!strcmp(mode, "all")) boundsChecks = BoundsAll;
+            else if (!strcmp(mode, "range")) boundsChecks = BoundsRange;
+            else if (!strcmp(mode, "none")) boundsChecks = BoundsNone;
+            else return false;
+      } else if (!strcmp(arg, "--lex-threads") && hasValue) {
+            lexThreads = atol(argv[++*i]);
+      } else if (!strcmp(arg, "--codegen-threads") && hasValue) {
+            codegenThreads = atol(argv[++*i]);
+      } else if (!strcmp(arg, "--lexer") && hasValue) {
+            char *width = argv[++*i];
+            if (!strcmp(width, "scalar")) pickLexer(LexScalar);
+            else if (!strcmp(width, "sse2")) pickLexer(LexSse2);
+            else if (!strcmp(width, "avx2")) pickLexer(LexAvx2);
+            else return false;
+      } else {
+            return false;
+      }
+      return true;
+}
+
+uint64_t hashBytes(char *bytes, size_t length) {
+      uint64_t hash = 14695981039346656037ULL;
+      for (size_t i = 0; i < length; i++) {
+            hash ^= (uint8_t)bytes[i];
+            hash *= 1099511628211ULL;
+      }
+      return hash;
+}
+
+// The compile server keeps every file it has seen parsed, along with the
+// output of each set of options it was compiled with. A file is only parsed
+// again when the hash of its contents changes, or incrementally when an
+// editor sends its edits. The edited copy is compiled until the file on disk
+// changes.
+typedef struct {
+      char *key;
+      bool ok;
+      char *bytes;
+      size_t length;
+      char *messages;
+      size_t messagesLength;
+} CachedOutput;
+
+typedef struct {
+      char *path;
+      uint64_t hash;
+      uint64_t diskHash;
+      Document doc;
+      char *parseErrors;
+      size_t parseErrorsLength;
+      size_t size;
+      size_t capacity;
+      CachedOutput *outputs;
+} CacheEntry;
+
+typedef struct {
+      size_t size;
+      size_t capacity;
+      CacheEntry *entries;
+} Cache;
+
+CacheEntry *getCache(Cache *cache, char *path) {
+      for (size_t i = 0; i < cache->size; i++) {
+            if (!strcmp(cache->entries[i].path, path)) return &cache->entries[i];
+      }
+      if (cache->size >= cache->capacity) {
+            cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+            cache->entries = realloc(cache->entries, sizeof(CacheEntry)*cache->capacity);
+      }
+      CacheEntry *entry = &cache->entries[cache->size++];
+      *entry = (CacheEntry){.path = strdup(path)};
+      return entry;
+}
+
+void addCachedOutput(CacheEntry *entry, CachedOutput output) {
+      if (entry->size >= entry->capacity) {
+            entry->capacity = entry->capacity ? entry->capacity * 2 : 4;
+            entry->outputs = realloc(entry->outputs, sizeof(CachedOutput)*entry->capacity);
+      }
+      entry->outputs[entry->size++] = output;
+}
+
+char *readWhole(char *path, size_t *length) {
+      FILE *f = fopen(path, "rb");
+      if (!f) return NULL;
+      size_t capacity = 4096;
+      char *buffer = malloc(capacity + 1);
+      *length = 0;
+      size_t n;
+      while ((n = fread(buffer + *length, 1, capacity - *length, f)) > 0) {
+            *length += n;
+            if (*length == capacity) {
+                  capacity *= 2;
+                  buffer = realloc(buffer, capacity + 1);
+            }
+      }
+      fclose(f);
+      buffer[*length] = 0;
+      return buffer;
+}
+
+// Assembles asm with nasm, returning the object file's bytes.
+char *assemble(char *text, size_t textLength, size_t *length) {
+      char asmPath[] = "/tmp/lpc-XXXXXX.asm";
+      char objPath[] = "/tmp/lpc-XXXXXX.o";
+      int fd = mkstemps(asmPath, 4);
+      if (fd < 0) return NULL;
+      write(fd, text, textLength);
+      close(fd);
+      memcpy(objPath + 9, asmPath + 9, 6);
+
+      pid_t pid = fork();
+      if (pid == 0) {
+            execlp("nasm", "nasm", "-felf64", asmPath, "-o", objPath, NULL);
+            _exit(127);
+      }
+      int status = 0;
+      waitpid(pid, &status, 0);
+      char *object = NULL;
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            object = readWhole(objPath, length);
+      }
+      unlink(asmPath);
+      unlink(objPath);
+      return object;
+}
+
+// Parses the entry's document again, after applying an edit unless offset
+// is negative. Its outputs were for the old contents and are dropped.
+bool updateEntry(CacheEntry *entry, int32_t offset, int32_t deleted, char *inserted, int32_t insertedLength) {
+      for (size_t i = 0; i < entry->size; i++) {
+            free(entry->outputs[i].key);
+            free(entry->outputs[i].bytes);
+            free(entry->outputs[i].messages);
+      }
+      entry->size = 0;
+      free(entry->parseErrors);
+
+      sourceName = entry->path;
+      errors = open_memstream(&entry->parseErrors, &entry->parseErrorsLength);
+      bool ok = offset < 0 ? documentParse(&entry->doc)
+            : documentEdit(&entry->doc, offset, deleted, inserted, insertedLength);
+      fclose(errors);
+      errors = stderr;
+      entry->hash = hashBytes(entry->doc.text, entry->doc.length);
+      return ok;
+}
+
+void writeAll(int client, char *bytes, size_t length) {
+      while (length > 0) {
+            ssize_t n = write(client, bytes, length);
+            if (n <= 0) return;
+            bytes += n;
+            length -= n;
+      }
+}
+
+void respond(int client, bool ok, char *bytes, size_t length, char *messages, size_t messagesLength) {
+      char header[64];
+      int headerLength = snprintf(header, sizeof(header), "%s %zu %zu\n", ok ? "ok" : "error", length, messagesLength);
+      write(client, header, headerLength);
+      writeAll(client, bytes, length);
+      writeAll(client, messages, messagesLength);
+}
+
+// A request is a single line: "asm" or "obj", the path of the file, then
+// any compile options. The answer is "ok <n> <m>" or "error <n> <m>" on a
+// line of its own followed by n bytes of output or error messages, then m
+// bytes of what a compile that worked printed to stderr, like the
+// --inline-report.
+// An editor sends "edit <path> <offset> <deleted> <n>" followed by n bytes
+// to insert, and gets the errors of the edited file back.
+void serveRequest(Cache *cache, int client) {
+      char line[4096];
       size_t length = 0;
-      char *f = file_to_charptr_new("test.ln");
-      Tokens tokens = tokenize(f);
-      Prog prog = parse(&tokens);
+      while (length < sizeof(line) - 1) {
+            ssize_t n = read(client, line + length, 1);
+            if (n <= 0 || line[length] == '\n') break;
+            length++;
+      }
+      line[length] = 0;
+
+      char *argv[64];
+      int argc = 0;
+      for (char *word = strtok(line, " "); word && argc < 64; word = strtok(NULL, " ")) {
+            argv[argc++] = word;
+      }
+      bool edit = argc == 5 && !strcmp(argv[0], "edit");
+      if (!edit && (argc < 2 || (strcmp(argv[0], "asm") && strcmp(argv[0], "obj")))) {
+            char *message = "bad request\n";
+            respond(client, false, message, strlen(message), NULL, 0);
+            return;
+      }
+      bool object = !strcmp(argv[0], "obj");
+      size_t insertedLength = edit ? atol(argv[4]) : 0;
+
+      Options defaults = saveOptions();
+      for (int i = 2; i < argc && !edit; i++) {
+            if (!parseOption(argc, argv, &i)) {
+                  char message[256];
+                  snprintf(message, sizeof(message), "unknown option %s\n", argv[i]);
+                  respond(client, false, message, strlen(message), NULL, 0);
+                  restoreOptions(defaults);
+                  return;
+            }
+      }
+
+      size_t sourceLength;
+      char *buffer = readWhole(argv[1], &sourceLength);
+      if (!buffer) {
+            char message[4200];
+            snprintf(message, sizeof(message), "unable to read %s\n", argv[1]);
+            respond(client, false, message, strlen(message), NULL, 0);
+            restoreOptions(defaults);
+            return;
+      }
+
+      CacheEntry *entry = getCache(cache, argv[1]);
+      uint64_t hash = hashBytes(buffer, sourceLength);
+      if (!entry->doc.text || (hash != entry->diskHash && hash != entry->hash)) {
+            documentSet(&entry->doc, buffer, sourceLength);
+            updateEntry(entry, -1, 0, NULL, 0);
+      }
+      entry->diskHash = hash;
+      free(buffer);
+
+      if (edit) {
+            char *inserted = malloc(insertedLength + 1);
+            size_t got = 0;
+            while (got < insertedLength) {
+                  ssize_t n = read(client, inserted + got, insertedLength - got);
+                  if (n <= 0) break;
+                  got += n;
+            }
+            bool ok = updateEntry(entry, atoi(argv[2]), atoi(argv[3]), inserted, got);
+            free(inserted);
+            respond(client, ok, entry->parseErrors, entry->parseErrorsLength, NULL, 0);
+            restoreOptions(defaults);
+            return;
+      }
+
+      if (!entry->doc.parsed) {
+            respond(client, false, entry->parseErrors, entry->parseErrorsLength, NULL, 0);
+            restoreOptions(defaults);
+            return;
+      }
+
+      // The key is everything after the path, and the contents of the
+      // profile, which can be written again under the same name
+      char key[4096] = "";
+      for (int i = 0; i < argc; i++) {
+            if (i == 1) continue;
+            strncat(key, argv[i], sizeof(key) - strlen(key) - 2);
+            strcat(key, " ");
+      }
+      if (profilePath) {
+            size_t profileLength;
+            char *profile = readWhole(profilePath, &profileLength);
+            char profileKey[64] = "profile:none";
+            if (profile) snprintf(profileKey, sizeof(profileKey), "profile:%016lx", hashBytes(profile, profileLength));
+            free(profile);
+            strncat(key, profileKey, sizeof(key) - strlen(key) - 1);
+      }
+
+      CachedOutput *cached = NULL;
+      for (size_t i = 0; i < entry->size; i++) {
+            if (!strcmp(entry->outputs[i].key, key)) cached = &entry->outputs[i];
+      }
+      if (!cached) {
+            CachedOutput output = {.key = strdup(key)};
+            char *messages = NULL;
+            size_t messagesLength = 0;
+            sourceName = entry->path;
+            source = entry->doc.text;
+            out = open_memstream(&output.bytes, &output.length);
+            errors = open_memstream(&messages, &messagesLength);
+            output.ok = generateProgram(&entry->doc.prog);
+            fclose(out);
+            fclose(errors);
+            out = stdout;
+            errors = stderr;
+
+            if (!output.ok) {
+                  free(output.bytes);
+                  output.bytes = messages;
+                  output.length = messagesLength;
+            } else {
+                  output.messages = messages;
+                  output.messagesLength = messagesLength;
+                  if (object) {
+                        size_t objectLength = 0;
+                        char *objectBytes = assemble(output.bytes, output.length, &objectLength);
+                        free(output.bytes);
+                        output.ok = objectBytes != NULL;
+                        output.bytes = output.ok ? objectBytes : strdup("nasm failed\n");
+                        output.length = output.ok ? objectLength : strlen(output.bytes);
+                  }
+            }
+            addCachedOutput(entry, output);
+            cached = &entry->outputs[entry->size - 1];
+      }
+
+      respond(client, cached->ok, cached->bytes, cached->length, cached->messages, cached->messagesLength);
+      restoreOptions(defaults);
+}
+
+void serve(char *socketPath) {
+      signal(SIGPIPE, SIG_IGN);
+      int server = socket(AF_UNIX, SOCK_STREAM, 0);
+      struct sockaddr_un address = {.sun_family = AF_UNIX};
+      if (server < 0 || strlen(socketPath) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "Unable to create socket %s\n", socketPath);
+            exit(1);
+      }
+      strcpy(address.sun_path, socketPath);
+      unlink(socketPath);
+      if (bind(server, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(server, 16) < 0) {
+            fprintf(stderr, "Unable to listen on %s\n", socketPath);
+            exit(1);
+      }
+
+      Cache cache = {};
+      while (true) {
+            int client = accept(server, NULL, NULL);
+            if (client < 0) continue;
+            serveRequest(&cache, client);
+            close(client);
+      }
+}
+
+void usage(char *program) {
+      fprintf(stderr, "Usage: %s [options] [file.ln]\n"
+              "       %s --server <socket> [options]\n"
+              "    -O<level>                 optimization level (default 1, 0 disables inlining, 2 unrolls and vectorizes loops)\n"
+              "    -g                        source lines for nasm -g -F dwarf, and variable slots as comments\n"
+              "    --inline-threshold <n>    largest pali body, in AST nodes, inlined outside loops\n"
+              "    --no-tail-calls           call and return for otawa f(...) in a pali instead of jumping\n"
+              "    -march=<isa>              vectorize with sse2, avx2 or what this cpu has with native (default sse2)\n"
+              "    --no-vectorize            leave element-wise array loops to the scalar loop at -O2\n"
+              "    --inline-report           print every inlined call site to stderr\n"
+              "    --unroll <n>              unroll counted tenpo loops n times (default 4 at -O2)\n"
+              "    --align-loops <n>         align innermost tenpo headers to n bytes, 1 disables (default 16 at -O2)\n"
+              "    --instrument <file>       count tenpo iterations and la branches taken, written to <file> on exit\n"
+              "    --profile-use <file>      use counts from an instrumented run for layout and inlining\n"
+              "    --bounds-checks <mode>    all, range to leave out the ones tenpo ranges prove (default) or none\n"
+              "    --lexer <width>           scan with scalar, sse2 or avx2 code, capped to what the cpu has (default widest)\n"
+              "    --lex-threads <n>         lex files of several MB in chunks on n threads (default 1)\n"
+              "    --codegen-threads <n>     generate pali on n threads (default 1)\n"
+              "    --server <socket>         keep compiling requests from bin/client on a unix socket\n",
+              program, program);
+      exit(1);
+}
+
+// Tools that include main.c build with -DLPC_LIBRARY to leave main out
+#ifndef LPC_LIBRARY
+int main(int argc, char **argv) {
+      out = stdout;
+      errors = stderr;
+
+      char *filename = "test.ln";
+      char *socketPath = NULL;
+      for (int i = 1; i < argc; i++) {
+            if (parseOption(argc, argv, &i)) {
+                  continue;
+            } else if (!strcmp(argv[i], "--server")) {
+                  if (i + 1 == argc) usage(argv[0]);
+                  socketPath = argv[++i];
+            } else if (argv[i][0] == '-') {
+                  usage(argv[0]);
+            } else {
+                  filename = argv[i];
+            }
+      }
 
-      generate(prog);
+      if (socketPath) {
+            serve(socketPath);
+            return 0;
+      }
+
+      char *f = file_to_charptr_new(filename);
+      sourceName = filename;
+      Prog prog;
+      if (!parseSource(f, &prog)) exit(1);
+      if (!generateProgram(&prog)) exit(1);
       
       free(f);
       return 0;
 }
-
+#endif